@@ -4,465 +4,5139 @@
 #include <map>
 #include <tuple>
 #include <array>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
 #include <string>
+#include <stdexcept>
+#include <cctype>
+#include <cmath>
+#include <string_view>
+#include <unordered_map>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <bit>
+#include <limits>
+#include <utility>
+#include <span>
 
-// TODO(tomas): linking to user-given functions, might require some rethinking
+#ifdef PAR_PROFILE
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #elif defined(__x86_64__) || defined(__i386__)
+        #include <x86intrin.h>
+    #else
+        #include <chrono>
+    #endif
+#endif
 
 namespace ParVm
 {
+    ////////////////////////////////////////////////////////////////
+    // Boilerplate helpers
+    #define GLOBAL_SCOPE    0
+    #define WORK_SCOPE      1
+    #define LOCAL_SCOPE     2
+
+    // Literals and specialized globals, read only, lives behind the bytecode of the program
+    #define CONSTANT_SCOPE  3
+
+    // Private copy of the reduced globals, see Reductions
+    #define REDUCTION_SCOPE 4
+
+    // SoA work scope fields get a scope slot each, starting here
+    #define COLUMN_SCOPE    5
+    #define PAR_MAX_COLUMNS 60
+    #define PAR_MAX_SCOPES  (COLUMN_SCOPE + PAR_MAX_COLUMNS)
+
+    // Jump targets, never bound to memory. In bytecode the offset is the program counter of a label,
+    // in decoded instructions it is the label's index, counting PAR_LABELs from the start of the program
+    #define CODE_SCOPE      0xFFU
+
+    // Host function table, never bound to memory. Only the header of a PAR_CALL lives here
+    #define HOST_SCOPE      0xFEU
+
     struct Scope
     {
         [[maybe_unused]] uint64_t scopeSize;
+        bool structOfArrays = false;
         std::map<std::string, uint64_t> m_ScopeOffsetResolver{};
+        std::map<std::string, std::vector<std::string>> m_FieldGroups{};   // pos -> x, y, z, the members of a grouped field in declaration order
+        std::map<std::string, std::string> m_Reductions{};                  // DoneCounter -> Count, how a reduced global merges
+    };
+
+    // A single work scope field stored as its own array, element n lives at pData + n * stride
+    struct Column
+    {
+        void *pData     = nullptr;
+        uint64_t stride = sizeof(float);
+    };
+
+    // Where the VM finds every scope and how far each one moves when stepping to the next work unit
+    struct ScopeBinding
+    {
+        std::array<uint8_t*, PAR_MAX_SCOPES> pScopes{};
+        std::array<uint64_t, PAR_MAX_SCOPES> strides{};
+
+        // Scopes in [firstWorkScope, lastWorkScope) advance with the work unit
+        uint32_t firstWorkScope = WORK_SCOPE;
+        uint32_t lastWorkScope  = WORK_SCOPE + 1U;
+
+        // Array of structs, work unit n lives at pWorkScopes + n * workScopeSize
+        [[nodiscard]] static ScopeBinding AoS(void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize) noexcept
+        {
+            ScopeBinding binding{};
+            binding.pScopes[GLOBAL_SCOPE] = static_cast<uint8_t*>(pGlobalScope);
+            binding.pScopes[WORK_SCOPE] = static_cast<uint8_t*>(pWorkScopes);
+            binding.strides[WORK_SCOPE] = workScopeSize;
+            return binding;
+        }
+
+        // Struct of arrays, one column per field declared in a [ WorkScope[SoA] ]
+        [[nodiscard]] static ScopeBinding SoA(void *pGlobalScope, const Column *pColumns, uint64_t columnCount)
+        {
+            if(columnCount > PAR_MAX_COLUMNS)
+                throw std::runtime_error("Too many work scope columns...");
+
+            ScopeBinding binding{};
+            binding.pScopes[GLOBAL_SCOPE] = static_cast<uint8_t*>(pGlobalScope);
+            binding.firstWorkScope = COLUMN_SCOPE;
+            binding.lastWorkScope = COLUMN_SCOPE + (uint32_t)columnCount;
+
+            for(uint64_t col = 0U; col < columnCount; ++col)
+            {
+                binding.pScopes[COLUMN_SCOPE + col] = static_cast<uint8_t*>(pColumns[col].pData);
+                binding.strides[COLUMN_SCOPE + col] = pColumns[col].stride;
+            }
+
+            return binding;
+        }
+
+        // Moves every work scope forward by unitCount work units
+        void Advance(uint64_t unitCount) noexcept
+        {
+            for(uint32_t s = firstWorkScope; s < lastWorkScope; ++s)
+                pScopes[s] += unitCount * strides[s];
+        }
+
+        void Rewind(uint64_t unitCount) noexcept
+        {
+            for(uint32_t s = firstWorkScope; s < lastWorkScope; ++s)
+                pScopes[s] -= unitCount * strides[s];
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////
+    // Instruction set
+    enum class OpCode : uint8_t
+    {
+        PAR_HALT                = 0,
+        INC_FLOAT               = 1,
+        DEC_FLOAT               = 2,
+        ADD_FLOAT               = 3,
+        SUB_FLOAT               = 4,
+        MUL_FLOAT               = 5,
+        INC_INT                 = 6,
+        DEC_INT                 = 7,
+        INC_UINT                = 8,
+        DEC_UINT                = 9,
+        ADD_INT                 = 10,
+        SUB_INT                 = 11,
+        MUL_INT                 = 12,
+        PAR_HALT_CONDITIONAL    = 13,
+        BIGGER_THAN_FLOAT       = 14,
+        SMALLER_THAN_FLOAT      = 15,
+
+        // Emitted by the optimizer only
+        MAD_FLOAT               = 16,   // MAD_FLOAT d, a, b, c -> d = a * b + c
+        HALT_BIGGER_THAN_FLOAT  = 17,   // HALT_BIGGER_THAN_FLOAT a, b -> halt if a > b
+        HALT_SMALLER_THAN_FLOAT = 18,   // HALT_SMALLER_THAN_FLOAT a, b -> halt if a < b
+
+        PAR_RETIRE_CONDITIONAL  = 19,   // PAR_RETIRE_CONDITIONAL c -> halt if c and report the work unit as dead
+
+        // Branch free, d = c ? a : b copies the 4 bytes whatever their type
+        SELECT                  = 20,   // SELECT d, c, a, b
+        MIN_FLOAT               = 21,
+        MAX_FLOAT               = 22,
+        MIN_INT                 = 23,
+        MAX_INT                 = 24,
+
+        // Control flow, jumps only go forward so every work unit still runs to the end of the program
+        PAR_LABEL               = 25,   // PAR_LABEL -> where lanes that jumped join back up
+        PAR_JUMP_CONDITIONAL    = 26,   // PAR_JUMP_CONDITIONAL c, label -> continue at label if c
+
+        // Field groups, a vector operand addresses the first of three floats next to each other
+        ADD_VEC3                = 27,   // ADD_VEC3 d, a, b
+        SUB_VEC3                = 28,   // SUB_VEC3 d, a, b
+        SCALE_VEC3              = 29,   // SCALE_VEC3 d, a, s -> d = a * s
+        MAD_VEC3                = 30,   // MAD_VEC3 d, a, s, b -> d = a * s + b
+        DOT_VEC3                = 31,   // DOT_VEC3 f, a, b
+        LENGTH_VEC3             = 32,   // LENGTH_VEC3 f, a
+
+        // PAR_CALL [HOST_SCOPE, function], [HOST_SCOPE, operand count], operands... -> result first, then the arguments
+        PAR_CALL                = 33,
+
+        COUNT
+    };
+
+    // Number of [Scope, Offset] operands every opcode carries, including the assigned one.
+    // A PAR_CALL carries as many again as the offset of its second operand says
+    static constexpr uint8_t OpOperandCount[] = { 0, 1, 1, 3, 3, 3, 1, 1, 1, 1, 3, 3, 3, 1, 3, 3, 4, 2, 2, 1, 4, 3, 3, 3, 3, 0, 2, 3, 3, 3, 4, 3, 2, 2 };
+    static_assert(sizeof(OpOperandCount) == (size_t)OpCode::COUNT, "Missing operand count for an opcode");
+
+    static constexpr const char* OpCodeNames[] = {
+        "PAR_HALT", "INC_FLOAT", "DEC_FLOAT", "ADD_FLOAT", "SUB_FLOAT", "MUL_FLOAT",
+        "INC_INT", "DEC_INT", "INC_UINT", "DEC_UINT", "ADD_INT", "SUB_INT", "MUL_INT",
+        "PAR_HALT_CONDITIONAL", "BIGGER_THAN_FLOAT", "SMALLER_THAN_FLOAT",
+        "MAD_FLOAT", "HALT_BIGGER_THAN_FLOAT", "HALT_SMALLER_THAN_FLOAT", "PAR_RETIRE_CONDITIONAL",
+        "SELECT", "MIN_FLOAT", "MAX_FLOAT", "MIN_INT", "MAX_INT", "PAR_LABEL", "PAR_JUMP_CONDITIONAL",
+        "ADD_VEC3", "SUB_VEC3", "SCALE_VEC3", "MAD_VEC3", "DOT_VEC3", "LENGTH_VEC3", "PAR_CALL"
+    };
+    static_assert(sizeof(OpCodeNames) / sizeof(OpCodeNames[0]) == (size_t)OpCode::COUNT, "Missing name for an opcode");
+
+    // A decoded instruction, what the compiler works on before emitting bytecode
+    struct Instruction
+    {
+        OpCode opCode = OpCode::PAR_HALT;
+        std::vector<std::pair<uint64_t, uint64_t>> operands{}; // [Scope, Offset]
+        uint32_t line = 0U; // Source line, 0 for anything the compiler added
+    };
+
+    // How a reduced global merges, the type comes from the instructions that accumulate in to it
+    enum class ReductionOp : uint8_t
+    {
+        SUM_INT,
+        SUM_FLOAT,
+        MIN_INT,
+        MIN_FLOAT,
+        MAX_INT,
+        MAX_FLOAT
+    };
+
+    // A reduced global, REDUCTION_SCOPE and GLOBAL_SCOPE share the offset
+    struct Reduction
+    {
+        uint32_t offset     = 0U;
+        ReductionOp op      = ReductionOp::SUM_INT;
+        uint8_t padding[3]  = {};
     };
+    static_assert(sizeof(Reduction) == 8U, "The reduction table is assembled byte by byte in this layout");
 
+    // Bytecode layout
+    // Every instruction is an opcode byte followed by its operands, an operand is a scope byte followed by
+    // an offset of offsetSize bytes (1, 2 or 4, little endian). The compiler picks the smallest size that fits.
+    // The constant pool and then the reduction table follow the bytecode.
     class Program
     {
     public:
-        uint64_t programCounter = 0U;
-        uint64_t programSize    = 0U;
-        uint8_t *pCode          = nullptr;
+        uint64_t programSize        = 0U; // Bytes of bytecode plus constants
+        uint64_t codeSize           = 0U; // Bytes of bytecode, the 4 byte aligned constant pool follows it
+        uint64_t workScopeColumns   = 0U; // Column count of a [ WorkScope[SoA] ], 0 for the usual AoS layout
+        uint64_t localScopeSize     = 0U; // Bytes of local scope every work unit gets
+        uint64_t hostCalls          = 0U; // PAR_CALLs in the bytecode, work units run in batches around them
+        uint64_t reductionCount     = 0U; // Reduced globals, their table sits at the very end
+        uint8_t offsetSize          = 1U; // Bytes per operand offset
+        bool scratchLocals          = false; // The optimizer dropped what units leave in the local scope, runs have to zero it
+        uint8_t *pCode              = nullptr;
+
+        [[nodiscard]] static constexpr uint64_t ConstantsOffset(uint64_t codeSize) noexcept { return (codeSize + 3U) & ~3ULL; }
+
+        // Base of CONSTANT_SCOPE
+        [[nodiscard]] uint8_t *Constants() const noexcept { return pCode + ConstantsOffset(codeSize); }
+        [[nodiscard]] uint64_t ConstantsSize() const noexcept { return programSize - std::min(programSize, ConstantsOffset(codeSize) + reductionCount * sizeof(Reduction)); }
+
+        // 4 byte aligned behind the constant pool, reductionCount entries
+        [[nodiscard]] const Reduction *Reductions() const noexcept { return reinterpret_cast<const Reduction*>(pCode + programSize - reductionCount * sizeof(Reduction)); }
+    };
+
+    // Bindings for the pointer and the Column overloads of the run functions. A program compiled for the other layout
+    // would read work scopes that were never bound, Program and DecodedProgram alike
+    template<typename ProgramT>
+    [[nodiscard]] inline ScopeBinding BindAoS(const ProgramT *pProgram, void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize)
+    {
+        if(pProgram->workScopeColumns != 0U)
+            throw std::runtime_error("The program declares a [ WorkScope[SoA] ], bind its work scopes as columns...");
+
+        return ScopeBinding::AoS(pGlobalScope, pWorkScopes, workScopeSize);
+    }
+
+    template<typename ProgramT>
+    [[nodiscard]] inline ScopeBinding BindSoA(const ProgramT *pProgram, void *pGlobalScope, const Column *pColumns)
+    {
+        if(pProgram->workScopeColumns == 0U)
+            throw std::runtime_error("The program declares an AoS work scope, bind its work scopes as one array...");
+
+        return ScopeBinding::SoA(pGlobalScope, pColumns, pProgram->workScopeColumns);
+    }
+
+    // Without zeroLocalScope a unit starts on what the last one left in the local scope, the optimizer may have dropped it
+    template<typename ProgramT>
+    inline void CheckLocalScope(const ProgramT *pProgram, bool zeroLocalScope)
+    {
+        if(!zeroLocalScope && pProgram->scratchLocals)
+            throw std::runtime_error("The program was optimized with a per unit local scope, compile it with CompileOptions::persistentLocals to run it without zeroLocalScope...");
+    }
+
+    template<typename OffsetT>
+    [[nodiscard]] inline uint64_t ReadOffset(const uint8_t *pOffset) noexcept
+    {
+        OffsetT offset{};
+        std::memcpy(&offset, pOffset, sizeof(OffsetT));
+        return offset;
+    }
+
+    [[nodiscard]] inline uint64_t ReadOffset(const uint8_t *pOffset, uint8_t offsetSize) noexcept
+    {
+        switch (offsetSize)
+        {
+            case sizeof(uint8_t):   return ReadOffset<uint8_t>(pOffset);
+            case sizeof(uint16_t):  return ReadOffset<uint16_t>(pOffset);
+            default:                return ReadOffset<uint32_t>(pOffset);
+        }
+    }
+
+    // Turns bytecode back in to instructions
+    [[nodiscard]] inline std::vector<Instruction> Disassemble(const Program *pProgram)
+    {
+        std::vector<Instruction> instructions{};
+        std::unordered_map<uint64_t, uint64_t> labels{}; // [program counter] -> [label index]
+        const uint64_t operandBytes = 1U + pProgram->offsetSize;
+
+        for(uint64_t pc = 0U; pc < pProgram->codeSize;)
+        {
+            uint8_t op = pProgram->pCode[pc];
+            if(op >= (uint8_t)OpCode::COUNT)
+                throw std::runtime_error("Invalid opcode in program...");
+
+            if(op == (uint8_t)OpCode::PAR_LABEL)
+                labels.emplace(pc, labels.size());
+
+            Instruction instruction{ (OpCode)op };
+            uint64_t operandCount = OpOperandCount[op];
+            for(uint64_t idx = 0U; idx < operandCount; ++idx)
+            {
+                if(pc + 1U + (idx + 1U) * operandBytes > pProgram->codeSize)
+                    throw std::runtime_error("Instruction runs past the end of the program...");
+
+                const uint8_t *pOperand = pProgram->pCode + pc + 1U + idx * operandBytes;
+                instruction.operands.emplace_back(pOperand[0], ReadOffset(pOperand + 1U, pProgram->offsetSize));
+
+                if(op == (uint8_t)OpCode::PAR_CALL && idx == 1U)
+                    operandCount += instruction.operands[1].second;
+            }
+
+            pc += 1U + operandCount * operandBytes;
+            instructions.push_back(instruction);
+        }
+
+        // Jump targets go from program counters back to label indices, only labels further down are valid
+        uint64_t labelsPassed = 0U;
+        for(auto& instruction : instructions)
+        {
+            labelsPassed += instruction.opCode == OpCode::PAR_LABEL;
+
+            for(auto& operand : instruction.operands)
+            {
+                if(operand.first != CODE_SCOPE)
+                    continue;
+
+                auto it = labels.find(operand.second);
+                if(it == labels.end() || it->second < labelsPassed)
+                    throw std::runtime_error("Jump to something that is not a label further down...");
+
+                operand.second = it->second;
+            }
+        }
+
+        return instructions;
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Host functions
+    // Native functions a script calls like any library function, registered through Compiler::RegisterFunction.
+    // A host function is never called per work unit. The interpreter runs a batch of work units up to the call
+    // and hands the host the operand addresses of every unit waiting there, once.
+    #ifndef PAR_CALL_BATCH
+        #define PAR_CALL_BATCH 256U     // Work units per host call, WorkerState::callBatch overrides it per worker
+    #endif
+
+    // The units of a batch that reached a call. Operand k of unit n lives at pOperands[k * count + n], every
+    // operand is a span of count addresses. The result comes first when the function returns one, then the arguments.
+    // NOTE(tomas): only the result may be written, literal arguments point in to the read only constant pool
+    struct HostBatch
+    {
+        uint64_t count                  = 0U;
+        uint64_t operandCount           = 0U;
+        uint8_t *const *pOperands       = nullptr;
+        const uint64_t *pWorkUnits      = nullptr;  // Work unit index of every unit in the batch
+
+        [[nodiscard]] uint8_t *const *Operand(uint64_t operandIdx) const noexcept { return pOperands + operandIdx * count; }
+
+        template<typename T>
+        [[nodiscard]] T &Get(uint64_t operandIdx, uint64_t unitIdx) const noexcept { return *reinterpret_cast<T*>(pOperands[operandIdx * count + unitIdx]); }
+    };
+
+    typedef std::function<void(const HostBatch&)> HostFunction;
+
+    struct HostFunctionInfo
+    {
+        std::string library{};
+        std::string name{};
+        std::string arguments{};    // One character per argument, 'f' for a float and 'i' for an integer
+        bool returnsValue = false;
+        HostFunction function{};
+    };
+
+    // Every registered host function, a PAR_CALL refers to them by index.
+    // NOTE(tomas): register everything before compiling or running scripts, lookups while running are not locked
+    [[nodiscard]] inline std::deque<HostFunctionInfo> &HostFunctions() noexcept
+    {
+        static std::deque<HostFunctionInfo> functions{};
+        return functions;
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Front end
+    // A single pass tokenizer and recursive descent parser over the source. Nothing is copied, every name in
+    // the tree is a view in to the source and nodes go in to a few flat arrays, so parsing is linear in script size.
+    // All of it is constexpr, Compiler::Compile and Compiler::CompileStatic run the same front end
+
+    struct SourceLocation
+    {
+        uint32_t line   = 1U;
+        uint32_t column = 1U;
+    };
+
+    [[noreturn]] inline void SyntaxError(SourceLocation location, const std::string &message)
+    {
+        throw std::runtime_error(("Error at " + std::to_string(location.line) + ":" + std::to_string(location.column) + " -> " + message).c_str());
+    }
+
+    enum class TokenType : uint8_t
+    {
+        End,
+        Identifier,
+        Number,
+        Symbol
+    };
+
+    struct Token
+    {
+        TokenType type = TokenType::End;
+        std::string_view text{};
+        SourceLocation location{};
+    };
+
+    // Character classes of the C locale, usable at compile time
+    [[nodiscard]] constexpr bool IsDigit(char c) noexcept { return c >= '0' && c <= '9'; }
+    [[nodiscard]] constexpr bool IsAlpha(char c) noexcept { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+    [[nodiscard]] constexpr bool IsAlnum(char c) noexcept { return IsAlpha(c) || IsDigit(c); }
+    [[nodiscard]] constexpr bool IsSpace(char c) noexcept { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+    // std::to_string, for messages built at compile time
+    [[nodiscard]] constexpr std::string ToDecimal(uint64_t value)
+    {
+        std::string text{};
+        do
+        {
+            text.insert(text.begin(), (char)('0' + value % 10U));
+            value /= 10U;
+        }
+        while (value);
+
+        return text;
+    }
+
+    class Lexer
+    {
+    public:
+        constexpr explicit Lexer(std::string_view source) : m_Source(source) {}
+
+        [[nodiscard]] constexpr Token Next()
+        {
+            SkipTrivia();
+
+            Token token{};
+            token.location = Location();
+
+            if(m_Cursor >= m_Source.size())
+                return token;
+
+            uint64_t start = m_Cursor;
+            char c = m_Source[m_Cursor];
+
+            if(IsAlpha(c) || c == '_')
+            {
+                while (m_Cursor < m_Source.size() && (IsAlnum(m_Source[m_Cursor]) || m_Source[m_Cursor] == '_'))
+                    ++m_Cursor;
+
+                token.type = TokenType::Identifier;
+            }
+            else if(IsDigit(c))
+            {
+                // 12, 0.5, 1e-3, 2.5f
+                while (m_Cursor < m_Source.size() && (IsAlnum(m_Source[m_Cursor]) || m_Source[m_Cursor] == '.' ||
+                       ((m_Source[m_Cursor] == '-' || m_Source[m_Cursor] == '+') && (m_Source[m_Cursor - 1U] == 'e' || m_Source[m_Cursor - 1U] == 'E'))))
+                    ++m_Cursor;
+
+                token.type = TokenType::Number;
+            }
+            else
+            {
+                // Two character symbols first
+                constexpr std::string_view pairs[] = { "->", "::", "++", "--" };
+                constexpr std::string_view singles = "[]{}();,.=+-*/<>";
+
+                token.type = TokenType::Symbol;
+                m_Cursor += 1U;
+
+                for(auto pair : pairs)
+                {
+                    if(m_Source.substr(start, 2U) == pair)
+                    {
+                        m_Cursor = start + 2U;
+                        break;
+                    }
+                }
+
+                if(m_Cursor == start + 1U && singles.find(c) == std::string_view::npos)
+                    SyntaxError(token.location, std::string("Unexpected character '") + c + "'");
+            }
+
+            token.text = m_Source.substr(start, m_Cursor - start);
+            return token;
+        }
+
+    private:
+        constexpr void SkipTrivia()
+        {
+            while (m_Cursor < m_Source.size())
+            {
+                char c = m_Source[m_Cursor];
+
+                if(c == '\n')
+                {
+                    ++m_Line;
+                    m_LineStart = ++m_Cursor;
+                }
+                else if(IsSpace(c))
+                {
+                    ++m_Cursor;
+                }
+                else if(c == '/' && m_Cursor + 1U < m_Source.size() && m_Source[m_Cursor + 1U] == '/')
+                {
+                    // Comments run to the end of the line
+                    while (m_Cursor < m_Source.size() && m_Source[m_Cursor] != '\n')
+                        ++m_Cursor;
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+
+        [[nodiscard]] constexpr SourceLocation Location() const noexcept
+        {
+            return SourceLocation{ m_Line, (uint32_t)(m_Cursor - m_LineStart) + 1U };
+        }
+
+        std::string_view m_Source;
+        uint64_t m_Cursor       = 0U;
+        uint64_t m_LineStart    = 0U;
+        uint32_t m_Line         = 1U;
+    };
+
+    ////////////////////////////////////////////////////////////////
+    // Syntax tree, every list is a range of one of the arrays in Ast
+
+    // [first, first + count) of an array in Ast
+    struct AstRange
+    {
+        uint64_t first = 0U;
+        uint64_t count = 0U;
+    };
+
+    // lifetime or pos.x
+    struct AstName
+    {
+        std::string_view base{};
+        std::string_view member{};
+        SourceLocation location{};
+
+        [[nodiscard]] constexpr std::string Full() const
+        {
+            return member.empty() ? std::string(base) : std::string(base) + "." + std::string(member);
+        }
+    };
+
+    // [4] -> DeltaTime; a grouped field such as [0, 4, 8] -> pos[x, y, z]; becomes one node per member
+    struct AstField
+    {
+        AstName name{};
+        uint64_t offset = 0U;
+        std::string_view reduction{};   // Sum, Min, Max or Count for [0] -> Count(DoneCounter); empty otherwise
+    };
+
+    // [ GlobalScope[16] ] { ... };
+    struct AstScope
+    {
+        std::string_view name{};
+        bool structOfArrays = false;
+        uint64_t size = 0U;
+        AstRange fields{};
+        SourceLocation location{};
+    };
+
+    // A variable or a numeric literal, ie: pos.x or -9.81
+    struct AstArgument
+    {
+        AstName name{};
+        std::string_view literal{};     // Digits of a literal, without the sign, empty for variables
+        bool negative = false;
+    };
+
+    // [target =] Library::Function(arguments); or a <Label>
+    struct AstStatement
+    {
+        std::string_view label{};       // Name of a label, everything below is empty for those
+        bool assigns = false;
+        AstName target{};
+        std::string_view library{};
+        std::string_view function{};
+        AstRange arguments{};
+        SourceLocation location{};
+    };
+
+    // [ Worker ]() { ... };
+    struct AstWorker
+    {
+        std::string_view name{};
+        AstRange statements{};
+        SourceLocation location{};
+    };
+
+    // Integrate in [ Frame ](Integrate, Age);
+    struct AstStage
+    {
+        std::string_view name{};
+        SourceLocation location{};
+    };
+
+    // [ Frame ](Integrate, Age); runs the listed workers one after the other on every work unit
+    struct AstPipeline
+    {
+        std::string_view name{};
+        AstRange stages{};
+        SourceLocation location{};
+    };
+
+    // Scopes, workers and pipelines in declaration order, their lists in one array per node type
+    struct Ast
+    {
+        std::vector<AstScope> scopes{};
+        std::vector<AstWorker> workers{};
+        std::vector<AstPipeline> pipelines{};
+
+        std::vector<AstField> fields{};
+        std::vector<AstStatement> statements{};
+        std::vector<AstArgument> arguments{};
+        std::vector<AstStage> stages{};
+
+        [[nodiscard]] constexpr std::span<const AstField> Fields(const AstScope& scope) const noexcept { return Slice(fields, scope.fields); }
+        [[nodiscard]] constexpr std::span<const AstStatement> Statements(const AstWorker& worker) const noexcept { return Slice(statements, worker.statements); }
+        [[nodiscard]] constexpr std::span<const AstArgument> Arguments(const AstStatement& statement) const noexcept { return Slice(arguments, statement.arguments); }
+        [[nodiscard]] constexpr std::span<const AstStage> Stages(const AstPipeline& pipeline) const noexcept { return Slice(stages, pipeline.stages); }
+
+    private:
+        template<typename T>
+        [[nodiscard]] static constexpr std::span<const T> Slice(const std::vector<T>& items, AstRange range) noexcept
+        {
+            return std::span<const T>(items.data() + range.first, range.count);
+        }
+    };
+
+    // Token level helpers of Parser
+    class TokenReader
+    {
+    protected:
+        constexpr explicit TokenReader(std::string_view source) : m_Lexer(source)
+        {
+            m_Token = m_Lexer.Next();
+        }
+
+        constexpr void Advance() { m_Token = m_Lexer.Next(); }
+
+        [[nodiscard]] constexpr bool Is(std::string_view symbol) const noexcept
+        {
+            return m_Token.type == TokenType::Symbol && m_Token.text == symbol;
+        }
+
+        constexpr bool Accept(std::string_view symbol)
+        {
+            if(!Is(symbol))
+                return false;
+
+            Advance();
+            return true;
+        }
+
+        constexpr void Expect(std::string_view symbol)
+        {
+            if(!Accept(symbol))
+                SyntaxError(m_Token.location, "Expected '" + std::string(symbol) + "' but found " + Describe(m_Token));
+        }
+
+        constexpr std::string_view ExpectIdentifier()
+        {
+            if(m_Token.type != TokenType::Identifier)
+                SyntaxError(m_Token.location, "Expected an identifier but found " + Describe(m_Token));
+
+            auto text = m_Token.text;
+            Advance();
+            return text;
+        }
+
+        constexpr uint64_t ExpectInteger()
+        {
+            if(m_Token.type != TokenType::Number)
+                SyntaxError(m_Token.location, "Expected a number but found " + Describe(m_Token));
+
+            uint64_t value = 0U;
+            for(char c : m_Token.text)
+            {
+                if(!IsDigit(c))
+                    SyntaxError(m_Token.location, "Expected an integer but found " + Describe(m_Token));
+
+                value = value * 10U + (uint64_t)(c - '0');
+            }
+
+            Advance();
+            return value;
+        }
+
+        [[nodiscard]] static constexpr std::string Describe(const Token &token)
+        {
+            return token.type == TokenType::End ? std::string("end of file") : "'" + std::string(token.text) + "'";
+        }
+
+        constexpr AstName ParseName()
+        {
+            AstName name{};
+            name.location = m_Token.location;
+            name.base = ExpectIdentifier();
+
+            if(Accept("."))
+                name.member = ExpectIdentifier();
+
+            return name;
+        }
+
+
+        Lexer m_Lexer;
+        Token m_Token{};
     };
 
-    class Compiler
+    class Parser : private TokenReader
+    {
+    public:
+        constexpr explicit Parser(std::string_view source) : TokenReader(source)
+        {
+            // Growing the arrays would copy the tree over and over on big scripts. Every statement ends in ';' or '>' and
+            // every argument comes after '(' or ',', so counting those is enough room
+            uint64_t statements = 0U;
+            uint64_t arguments = 0U;
+            for(char c : source)
+            {
+                statements += c == ';' || c == '>';
+                arguments += c == '(' || c == ',';
+            }
+
+            m_Ast.statements.reserve(statements);
+            m_Ast.arguments.reserve(arguments);
+        }
+
+        [[nodiscard]] constexpr Ast Parse()
+        {
+            while (m_Token.type != TokenType::End)
+            {
+                SourceLocation location = m_Token.location;
+                Expect("[");
+                std::string_view name = ExpectIdentifier();
+
+                if(Accept("["))
+                {
+                    ParseScope(name, location);
+                }
+                else
+                {
+                    Expect("]");
+                    Expect("(");
+
+                    // A worker takes no arguments, a pipeline lists its stages
+                    if(Accept(")"))
+                        ParseWorker(name, location);
+                    else
+                        ParsePipeline(name, location);
+                }
+            }
+
+            return std::move(m_Ast);
+        }
+
+    private:
+        // After "[ Name [", parses "Size ] ] { fields };"
+        constexpr void ParseScope(std::string_view name, SourceLocation location)
+        {
+            AstScope scope{};
+            scope.name = name;
+            scope.location = location;
+            scope.fields.first = m_Ast.fields.size();
+
+            if(m_Token.type == TokenType::Identifier && m_Token.text == "SoA")
+            {
+                scope.structOfArrays = true;
+                Advance();
+            }
+            else
+            {
+                scope.size = ExpectInteger();
+            }
+
+            Expect("]");
+            Expect("]");
+            Expect("{");
+
+            while (!Accept("}"))
+            {
+                // [0, 4, 8] -> pos[x, y, z];
+                SourceLocation fieldLocation = m_Token.location;
+                std::vector<uint64_t> offsets{};
+
+                Expect("[");
+                do { offsets.push_back(ExpectInteger()); } while (Accept(","));
+                Expect("]");
+                Expect("->");
+
+                SourceLocation nameLocation = m_Token.location;
+                std::string_view base = ExpectIdentifier();
+                std::string_view reduction{};
+
+                // [0] -> Count(DoneCounter);
+                if(Accept("("))
+                {
+                    reduction = base;
+                    nameLocation = m_Token.location;
+                    base = ExpectIdentifier();
+                    Expect(")");
+                }
+
+                if(reduction.empty() && Accept("["))
+                {
+                    uint64_t memberIdx = 0U;
+
+                    do
+                    {
+                        SourceLocation memberLocation = m_Token.location;
+                        std::string_view member = ExpectIdentifier();
+
+                        if(memberIdx >= offsets.size())
+                            SyntaxError(memberLocation, "More members than offsets in field " + std::string(base));
+
+                        m_Ast.fields.push_back(AstField{ AstName{ base, member, memberLocation }, offsets[memberIdx++] });
+                    }
+                    while (Accept(","));
+
+                    Expect("]");
+
+                    if(memberIdx != offsets.size())
+                        SyntaxError(fieldLocation, "More offsets than members in field " + std::string(base));
+                }
+                else
+                {
+                    if(offsets.size() != 1U)
+                        SyntaxError(fieldLocation, "A single field takes a single offset -> " + std::string(base));
+
+                    m_Ast.fields.push_back(AstField{ AstName{ base, {}, nameLocation }, offsets[0], reduction });
+                }
+
+                Expect(";");
+            }
+
+            Accept(";");
+
+            scope.fields.count = m_Ast.fields.size() - scope.fields.first;
+            m_Ast.scopes.push_back(scope);
+        }
+
+        // After "[ Name ]()", parses "{ statements };"
+        constexpr void ParseWorker(std::string_view name, SourceLocation location)
+        {
+            AstWorker worker{};
+            worker.name = name;
+            worker.location = location;
+            worker.statements.first = m_Ast.statements.size();
+
+            Expect("{");
+
+            while (!Accept("}"))
+                ParseStatement();
+
+            Accept(";");
+
+            worker.statements.count = m_Ast.statements.size() - worker.statements.first;
+            m_Ast.workers.push_back(worker);
+        }
+
+        // After "[ Name ](", parses "Stage, Stage);"
+        constexpr void ParsePipeline(std::string_view name, SourceLocation location)
+        {
+            AstPipeline pipeline{};
+            pipeline.name = name;
+            pipeline.location = location;
+            pipeline.stages.first = m_Ast.stages.size();
+
+            do
+            {
+                AstStage stage{};
+                stage.location = m_Token.location;
+                stage.name = ExpectIdentifier();
+                m_Ast.stages.push_back(stage);
+            }
+            while (Accept(","));
+
+            Expect(")");
+            Accept(";");
+
+            pipeline.stages.count = m_Ast.stages.size() - pipeline.stages.first;
+            m_Ast.pipelines.push_back(pipeline);
+        }
+
+        constexpr void ParseStatement()
+        {
+            AstStatement statement{};
+            statement.location = m_Token.location;
+
+            // <Label>, the semicolon is optional
+            if(Accept("<"))
+            {
+                statement.label = ExpectIdentifier();
+                Expect(">");
+                Accept(";");
+                m_Ast.statements.push_back(statement);
+                return;
+            }
+
+            AstName first = ParseName();
+
+            if(Accept("="))
+            {
+                statement.assigns = true;
+                statement.target = first;
+                statement.library = ExpectIdentifier();
+            }
+            else
+            {
+                if(!first.member.empty())
+                    SyntaxError(first.location, "Expected '=' after " + first.Full());
+
+                statement.library = first.base;
+            }
+
+            Expect("::");
+
+            // Function names are identifiers or operators, ie: Float::+ or VM::HaltConditional
+            if(m_Token.type != TokenType::Identifier && m_Token.type != TokenType::Symbol)
+                SyntaxError(m_Token.location, "Expected a function name but found " + Describe(m_Token));
+
+            statement.function = m_Token.text;
+            Advance();
+
+            Expect("(");
+
+            statement.arguments.first = m_Ast.arguments.size();
+
+            if(!Is(")"))
+            {
+                do
+                {
+                    AstArgument argument{};
+
+                    if(m_Token.type == TokenType::Number || Is("-"))
+                    {
+                        argument.name.location = m_Token.location;
+                        argument.negative = Accept("-");
+
+                        if(m_Token.type != TokenType::Number)
+                            SyntaxError(m_Token.location, "Expected a number but found " + Describe(m_Token));
+
+                        argument.literal = m_Token.text;
+                        Advance();
+                    }
+                    else
+                    {
+                        argument.name = ParseName();
+                    }
+
+                    m_Ast.arguments.push_back(argument);
+                }
+                while (Accept(","));
+            }
+
+            Expect(")");
+            Expect(";");
+
+            statement.arguments.count = m_Ast.arguments.size() - statement.arguments.first;
+            m_Ast.statements.push_back(statement);
+        }
+
+        Ast m_Ast{};
+    };
+
+    // What the bytecode optimizer did to a program
+    struct OptimizationReport
+    {
+        uint64_t instructionsIn     = 0U;
+        uint64_t instructionsOut    = 0U;
+        uint64_t bytesIn            = 0U;
+        uint64_t bytesOut           = 0U;
+        uint64_t fusedMultiplyAdds  = 0U;
+        uint64_t superInstructions  = 0U;
+        uint64_t deadStores         = 0U;
+        uint64_t specializedOperands = 0U;  // Global reads Specialize turned in to constants
+        uint64_t constantsFolded    = 0U;   // Instructions Specialize evaluated at compile time
+
+        [[nodiscard]] uint64_t InstructionsSaved() const noexcept { return instructionsIn - instructionsOut; }
+    };
+
+    // Maps bytecode back to the .pars source it came from, one entry per instruction in program order
+    struct DebugTable
+    {
+        struct Entry
+        {
+            uint64_t programCounter = 0U;
+            uint32_t line           = 0U;   // 0 for instructions the compiler added, like the final halt
+        };
+
+        std::vector<Entry> entries{};
+
+        [[nodiscard]] uint32_t LineOf(uint64_t programCounter) const noexcept
+        {
+            auto it = std::upper_bound(entries.begin(), entries.end(), programCounter, [](uint64_t pc, const Entry& entry) { return pc < entry.programCounter; });
+            return it == entries.begin() ? 0U : std::prev(it)->line;
+        }
+    };
+
+    struct CompileOptions
+    {
+        bool optimize = true;                       // Run the bytecode optimizer between extraction and emission
+        OptimizationReport *pReport = nullptr;      // Filled in with what the optimizer did, if set
+        std::array<Scope, 3> *pScopes = nullptr;    // Filled in with the Global, Work and Local scope tables, if set
+        DebugTable *pDebugTable = nullptr;          // Filled in with the source line of every instruction, if set
+        std::string entry{};                        // Worker or pipeline to compile, empty for the first pipeline or else the first worker
+        bool persistentLocals = false;              // Keep what a unit leaves in the local scope, to run without zeroLocalScope
+    };
+
+    // A .pars string literal as a template argument, Compiler::CompileStatic<"...">()
+    template<size_t N>
+    struct StaticSource
+    {
+        char text[N]{};
+
+        constexpr StaticSource(const char (&source)[N])
+        {
+            for(size_t idx = 0U; idx < N; ++idx)
+                text[idx] = source[idx];
+        }
+
+        [[nodiscard]] constexpr std::string_view View() const noexcept { return std::string_view(text, N - 1U); }
+    };
+
+    // A program compiled at compile time, the bytes are laid out like Program::pCode and live in the binary.
+    // Run<Program> unrolls it, View() hands it to every other interpreter
+    template<uint64_t Size>
+    struct StaticProgram
+    {
+        std::array<uint8_t, Size> bytes{};
+        uint64_t codeSize       = 0U;
+        uint64_t localScopeSize = 0U;
+        uint8_t offsetSize      = 1U;
+
+        // NOTE(tomas): pCode points in to this, never free it
+        [[nodiscard]] Program View() const noexcept
+        {
+            Program p{};
+            p.programSize = Size;
+            p.codeSize = codeSize;
+            p.localScopeSize = localScopeSize;
+            p.offsetSize = offsetSize;
+            p.pCode = const_cast<uint8_t*>(bytes.data());
+            return p;
+        }
+    };
+
+    class Compiler
+    {
+    private:
+        // A declared field. The resolver keeps them sorted by name, scope and declaration, a lookup is a binary search
+        struct Symbol
+        {
+            AstName name{};
+            uint64_t scope = GLOBAL_SCOPE;     // GLOBAL_SCOPE, WORK_SCOPE or LOCAL_SCOPE
+            uint64_t offset = 0U;
+            std::string_view reduction{};
+            uint64_t order = 0U;                // Declaration order over every scope
+
+            [[nodiscard]] constexpr bool operator<(const Symbol& other) const noexcept
+            {
+                return std::tie(name.base, name.member, scope, order) < std::tie(other.name.base, other.name.member, other.scope, other.order);
+            }
+        };
+
+        // What the resolver makes of a syntax tree, the stages of the entry back to back and the final halt
+        struct Resolution
+        {
+            std::vector<Instruction> instructions{};
+            std::vector<uint32_t> constants{};
+            std::vector<Symbol> symbols{};
+            std::array<uint64_t, 3> scopeSizes{};
+            bool structOfArrays = false;        // The work scope, the global and local scopes are always AoS
+            uint64_t localScopeSize = 0U;       // As declared, or as big as its fields need
+        };
+
+        // The Global, Work and Local scope tables of CompileOptions::pScopes, the resolver already checked the declarations
+        [[nodiscard]] static std::array<Scope, 3> BuildScopes(const Resolution& resolution)
+        {
+            std::array<Scope, 3> scopes{};
+            for(uint64_t scopeIdx = 0U; scopeIdx < scopes.size(); ++scopeIdx)
+                scopes[scopeIdx].scopeSize = resolution.scopeSizes[scopeIdx];
+
+            scopes[WORK_SCOPE].structOfArrays = resolution.structOfArrays;
+
+            // Field groups list their members in declaration order
+            std::vector<const Symbol*> declared(resolution.symbols.size());
+            for(const Symbol& symbol : resolution.symbols)
+                declared[symbol.order] = &symbol;
+
+            for(const Symbol* pSymbol : declared)
+            {
+                Scope& scope = scopes[pSymbol->scope];
+                scope.m_ScopeOffsetResolver.emplace(pSymbol->name.Full(), pSymbol->offset);
+
+                if(!pSymbol->name.member.empty())
+                    scope.m_FieldGroups[std::string(pSymbol->name.base)].emplace_back(pSymbol->name.member);
+
+                if(!pSymbol->reduction.empty())
+                    scope.m_Reductions.emplace(pSymbol->name.Full(), pSymbol->reduction);
+            }
+
+            return scopes;
+        }
+
+        ////////////////////////////////////////////////////////////////
+        // Bytecode optimizer
+        // NOTE(tomas): the local scope is treated as per work unit scratch, whatever is left in it when the worker ends is dead.
+        // With CompileOptions::persistentLocals the next unit may read it, every local is live wherever a unit can end
+        // One bit per local scope byte
+        typedef std::vector<bool> LocalMask;
+
+        [[nodiscard]] static constexpr uint64_t EncodedSize(const std::vector<Instruction>& instructions, uint64_t offsetSize = 1U) noexcept
+        {
+            uint64_t size = 0U;
+            for(const auto& instruction : instructions)
+                size += 1U + instruction.operands.size() * (1U + offsetSize);
+
+            return size;
+        }
+
+        // Operand 0 is only written, never read
+        [[nodiscard]] static constexpr bool Assigns(OpCode op) noexcept
+        {
+            switch (op)
+            {
+                case OpCode::ADD_FLOAT: case OpCode::SUB_FLOAT: case OpCode::MUL_FLOAT: case OpCode::MAD_FLOAT:
+                case OpCode::ADD_INT: case OpCode::SUB_INT: case OpCode::MUL_INT:
+                case OpCode::BIGGER_THAN_FLOAT: case OpCode::SMALLER_THAN_FLOAT:
+                case OpCode::SELECT: case OpCode::MIN_FLOAT: case OpCode::MAX_FLOAT: case OpCode::MIN_INT: case OpCode::MAX_INT:
+                case OpCode::ADD_VEC3: case OpCode::SUB_VEC3: case OpCode::SCALE_VEC3: case OpCode::MAD_VEC3:
+                case OpCode::DOT_VEC3: case OpCode::LENGTH_VEC3:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // Operand 0 is read, modified and written back
+        [[nodiscard]] static constexpr bool Modifies(OpCode op) noexcept
+        {
+            switch (op)
+            {
+                case OpCode::INC_FLOAT: case OpCode::DEC_FLOAT:
+                case OpCode::INC_INT: case OpCode::DEC_INT:
+                case OpCode::INC_UINT: case OpCode::DEC_UINT:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        [[nodiscard]] static constexpr uint64_t WriteWidth(OpCode op) noexcept
+        {
+            switch (op)
+            {
+                case OpCode::BIGGER_THAN_FLOAT: case OpCode::SMALLER_THAN_FLOAT:
+                    return sizeof(bool);
+                case OpCode::ADD_VEC3: case OpCode::SUB_VEC3: case OpCode::SCALE_VEC3: case OpCode::MAD_VEC3:
+                    return 3U * sizeof(float);
+                default:
+                    return sizeof(float);
+            }
+        }
+
+        // Conditions are read as a bool, field groups as 3 floats, everything else as 4 bytes
+        [[nodiscard]] static constexpr uint64_t ReadWidth(OpCode op, uint64_t operandIdx) noexcept
+        {
+            switch (op)
+            {
+                case OpCode::PAR_HALT_CONDITIONAL: case OpCode::PAR_RETIRE_CONDITIONAL: case OpCode::PAR_JUMP_CONDITIONAL:
+                    return operandIdx == 0U ? sizeof(bool) : sizeof(float);
+                case OpCode::SELECT:
+                    return operandIdx == 1U ? sizeof(bool) : sizeof(float);
+                case OpCode::ADD_VEC3: case OpCode::SUB_VEC3: case OpCode::DOT_VEC3: case OpCode::LENGTH_VEC3:
+                    return 3U * sizeof(float);
+                case OpCode::SCALE_VEC3: case OpCode::MAD_VEC3:
+                    return operandIdx == 2U ? sizeof(float) : 3U * sizeof(float);
+                default:
+                    return sizeof(float);
+            }
+        }
+
+        [[nodiscard]] static bool IsConditionalHalt(OpCode op) noexcept
+        {
+            return op == OpCode::PAR_HALT_CONDITIONAL || op == OpCode::PAR_RETIRE_CONDITIONAL ||
+                   op == OpCode::HALT_BIGGER_THAN_FLOAT || op == OpCode::HALT_SMALLER_THAN_FLOAT;
+        }
+
+        [[nodiscard]] static float AsFloat(uint32_t bits) noexcept { float f; std::memcpy(&f, &bits, sizeof(f)); return f; }
+        [[nodiscard]] static uint32_t AsBits(float f) noexcept { uint32_t bits; std::memcpy(&bits, &f, sizeof(bits)); return bits; }
+
+        // Whether a conditional halt with constant inputs is taken
+        [[nodiscard]] static bool HaltTaken(OpCode op, const uint32_t *pInputs) noexcept
+        {
+            switch (op)
+            {
+                case OpCode::HALT_BIGGER_THAN_FLOAT:    return AsFloat(pInputs[0]) > AsFloat(pInputs[1]);
+                case OpCode::HALT_SMALLER_THAN_FLOAT:   return AsFloat(pInputs[0]) < AsFloat(pInputs[1]);
+                default:                                return (uint8_t)pInputs[0] != 0U;
+            }
+        }
+
+        // Evaluates an assigning instruction on constant inputs, the same way the interpreter would
+        [[nodiscard]] static uint32_t Fold(OpCode op, const uint32_t *pInputs) noexcept
+        {
+            const float a = AsFloat(pInputs[0]); float b = AsFloat(pInputs[1]), c = AsFloat(pInputs[2]);
+
+            switch (op)
+            {
+                case OpCode::ADD_FLOAT:             return AsBits(a + b);
+                case OpCode::SUB_FLOAT:             return AsBits(a - b);
+                case OpCode::MUL_FLOAT:             return AsBits(a * b);
+                case OpCode::MAD_FLOAT:             return AsBits(a * b + c);
+                case OpCode::BIGGER_THAN_FLOAT:     return a > b ? 1U : 0U;
+                case OpCode::SMALLER_THAN_FLOAT:    return a < b ? 1U : 0U;
+                case OpCode::MIN_FLOAT:             return AsBits(a < b ? a : b);
+                case OpCode::MAX_FLOAT:             return AsBits(a > b ? a : b);
+                case OpCode::SELECT:                return (uint8_t)pInputs[0] != 0U ? pInputs[1] : pInputs[2];
+
+                // Unsigned math wraps the same way the int opcodes do on every target we care about
+                case OpCode::ADD_INT:               return pInputs[0] + pInputs[1];
+                case OpCode::SUB_INT:               return pInputs[0] - pInputs[1];
+                case OpCode::MUL_INT:               return pInputs[0] * pInputs[1];
+                case OpCode::MIN_INT:               return (int32_t)pInputs[0] < (int32_t)pInputs[1] ? pInputs[0] : pInputs[1];
+                case OpCode::MAX_INT:               return (int32_t)pInputs[0] > (int32_t)pInputs[1] ? pInputs[0] : pInputs[1];
+                default:                            return 0U;
+            }
+        }
+
+        // Sets or clears the local scope bytes touched by an operand, other scopes are ignored
+        static void MarkLocal(LocalMask& mask, const std::pair<uint64_t, uint64_t>& operand, bool live, uint64_t width = sizeof(float))
+        {
+            if(operand.first == LOCAL_SCOPE)
+                for(uint64_t b = operand.second; b < operand.second + width && b < mask.size(); ++b)
+                    mask[b] = live;
+        }
+
+        [[nodiscard]] static bool AnyLocal(const LocalMask& mask, const std::pair<uint64_t, uint64_t>& operand, uint64_t width = sizeof(float))
+        {
+            if(operand.first == LOCAL_SCOPE)
+                for(uint64_t b = operand.second; b < operand.second + width && b < mask.size(); ++b)
+                    if(mask[b])
+                        return true;
+
+            return false;
+        }
+
+        [[nodiscard]] static bool LocalOverlap(const std::pair<uint64_t, uint64_t>& lhs, const std::pair<uint64_t, uint64_t>& rhs, uint64_t width = sizeof(float))
+        {
+            return lhs.first == LOCAL_SCOPE && rhs.first == LOCAL_SCOPE &&
+                   lhs.second < rhs.second + width && rhs.second < lhs.second + width;
+        }
+
+        // Local scope bytes that are still going to be read after every instruction.
+        // Jumps only go forward, so one backward pass has seen every label before the jumps to it.
+        // A PAR_CALL neither assigns nor modifies, every operand counts as read and the result never kills a store
+        [[nodiscard]] static std::vector<LocalMask> Liveness(const std::vector<Instruction>& instructions, uint64_t localScopeSize, bool persistentLocals)
+        {
+            std::vector<LocalMask> liveOut(instructions.size());
+            LocalMask live(localScopeSize + sizeof(float), false);
+
+            std::vector<LocalMask> labelLive{};
+            for(const auto& instruction : instructions)
+                if(instruction.opCode == OpCode::PAR_LABEL)
+                    labelLive.emplace_back(live.size(), false);
+
+            uint64_t labelIdx = labelLive.size();
+
+            for(int64_t idx = (int64_t)instructions.size() - 1; idx >= 0; --idx)
+            {
+                const auto& instruction = instructions[idx];
+
+                // Nothing survives the end of a work unit, unless the next unit starts on it
+                if(instruction.opCode == OpCode::PAR_HALT)
+                    live.assign(live.size(), persistentLocals);
+                else if(persistentLocals && IsConditionalHalt(instruction.opCode))
+                    live.assign(live.size(), true);
+
+                // Whatever is live where a jump lands is live before the jump
+                if(instruction.opCode == OpCode::PAR_JUMP_CONDITIONAL)
+                {
+                    const auto& target = labelLive[instruction.operands[1].second];
+                    for(uint64_t b = 0U; b < live.size(); ++b)
+                        live[b] = live[b] || target[b];
+                }
+
+                if(instruction.opCode == OpCode::PAR_LABEL)
+                    labelLive[--labelIdx] = live;
+
+                liveOut[idx] = live;
+
+                uint64_t firstRead = 0U;
+                if(Assigns(instruction.opCode))
+                {
+                    MarkLocal(live, instruction.operands[0], false, WriteWidth(instruction.opCode));
+                    firstRead = 1U;
+                }
+
+                for(uint64_t op = firstRead; op < instruction.operands.size(); ++op)
+                    MarkLocal(live, instruction.operands[op], true, ReadWidth(instruction.opCode, op));
+            }
+
+            return liveOut;
+        }
+
+        static void Optimize(std::vector<Instruction>& instructions, uint64_t localScopeSize, bool persistentLocals, OptimizationReport& report)
+        {
+            bool changed = true;
+
+            while (changed)
+            {
+                changed = false;
+                auto liveOut = Liveness(instructions, localScopeSize, persistentLocals);
+
+                const auto IsDeadTemp = [&liveOut](uint64_t idx, const std::pair<uint64_t, uint64_t>& operand, uint64_t width) {
+                    return operand.first == LOCAL_SCOPE && !AnyLocal(liveOut[idx], operand, width);
+                };
+
+                std::vector<Instruction> optimized{};
+                optimized.reserve(instructions.size());
+                uint64_t labelsPassed = 0U;
+
+                for(uint64_t idx = 0U; idx < instructions.size(); ++idx)
+                {
+                    const auto& current = instructions[idx];
+                    const auto* pNext = idx + 1U < instructions.size() ? &instructions[idx + 1U] : nullptr;
+
+                    labelsPassed += current.opCode == OpCode::PAR_LABEL;
+
+                    ////////////////////////////////////////////////////////////////
+                    // A jump to the label right behind it goes nowhere
+                    if(pNext && current.opCode == OpCode::PAR_JUMP_CONDITIONAL && pNext->opCode == OpCode::PAR_LABEL &&
+                       current.operands[1].second == labelsPassed)
+                    {
+                        changed = true;
+                        continue;
+                    }
+
+                    ////////////////////////////////////////////////////////////////
+                    // t = a * b; d = t + c; -> d = a * b + c;
+                    if(pNext && current.opCode == OpCode::MUL_FLOAT && pNext->opCode == OpCode::ADD_FLOAT &&
+                       IsDeadTemp(idx + 1U, current.operands[0], sizeof(float)))
+                    {
+                        const auto& temp = current.operands[0];
+                        const auto& lhs = pNext->operands[1];
+                        const auto& rhs = pNext->operands[2];
+
+                        if((lhs == temp) != (rhs == temp))
+                        {
+                            const auto& addend = lhs == temp ? rhs : lhs;
+
+                            if(!LocalOverlap(addend, temp))
+                            {
+                                optimized.push_back(Instruction{ OpCode::MAD_FLOAT, { pNext->operands[0], current.operands[1], current.operands[2], addend }, current.line });
+                                ++report.fusedMultiplyAdds;
+                                ++idx;
+                                changed = true;
+                                continue;
+                            }
+                        }
+                    }
+
+                    ////////////////////////////////////////////////////////////////
+                    // t = Vec3::Scale(a, s); d = Vec3::Add(t, c); -> d = Vec3::Mad(a, s, c);
+                    if(pNext && current.opCode == OpCode::SCALE_VEC3 && pNext->opCode == OpCode::ADD_VEC3 &&
+                       IsDeadTemp(idx + 1U, current.operands[0], 3U * sizeof(float)))
+                    {
+                        const auto& temp = current.operands[0];
+                        const auto& lhs = pNext->operands[1];
+                        const auto& rhs = pNext->operands[2];
+
+                        if((lhs == temp) != (rhs == temp))
+                        {
+                            const auto& addend = lhs == temp ? rhs : lhs;
+
+                            if(!LocalOverlap(addend, temp, 3U * sizeof(float)))
+                            {
+                                optimized.push_back(Instruction{ OpCode::MAD_VEC3, { pNext->operands[0], current.operands[1], current.operands[2], addend }, current.line });
+                                ++report.fusedMultiplyAdds;
+                                ++idx;
+                                changed = true;
+                                continue;
+                            }
+                        }
+                    }
+
+                    ////////////////////////////////////////////////////////////////
+                    // t = a > b; VM::HaltConditional(t); -> halt if a > b
+                    if(pNext && (current.opCode == OpCode::BIGGER_THAN_FLOAT || current.opCode == OpCode::SMALLER_THAN_FLOAT) &&
+                       pNext->opCode == OpCode::PAR_HALT_CONDITIONAL && pNext->operands[0] == current.operands[0] &&
+                       IsDeadTemp(idx + 1U, current.operands[0], sizeof(bool)))
+                    {
+                        OpCode fused = current.opCode == OpCode::BIGGER_THAN_FLOAT ? OpCode::HALT_BIGGER_THAN_FLOAT : OpCode::HALT_SMALLER_THAN_FLOAT;
+                        optimized.push_back(Instruction{ fused, { current.operands[1], current.operands[2] }, current.line });
+                        ++report.superInstructions;
+                        ++idx;
+                        changed = true;
+                        continue;
+                    }
+
+                    ////////////////////////////////////////////////////////////////
+                    // Stores to local scope temps nobody reads
+                    if((Assigns(current.opCode) || Modifies(current.opCode)) &&
+                       IsDeadTemp(idx, current.operands[0], WriteWidth(current.opCode)))
+                    {
+                        ++report.deadStores;
+                        changed = true;
+                        continue;
+                    }
+
+                    optimized.push_back(current);
+                }
+
+                instructions = std::move(optimized);
+            }
+        }
+
+        // Fused, every stage runs on a work unit before the next unit starts. A stage that reads a global an earlier stage
+        // writes would see it half way through the other units, same for writing one an earlier stage reads, those stages
+        // have to run as separate passes. Work scopes are per unit and reductions are never read, they always fuse.
+        // Only the last stage may retire, a retire ends the fused unit while separate passes still run the later stages on it.
+        // Fused stages share the local scope, where a pass of its own would start on a cleared one. So a stage may only read
+        // a local it wrote itself first
+        static constexpr void CheckFusable(const std::vector<Instruction>& instructions, const std::vector<std::pair<uint64_t, uint64_t>>& stageRanges,
+                                           const std::vector<const AstWorker*>& stages, const std::vector<Symbol>& symbols)
+        {
+            if(stages.size() < 2U)
+                return;
+
+            // [global byte] -> first stage that writes or reads it
+            std::vector<uint64_t> writers{}, readers{};
+
+            // The first name in alphabetical order that lives there
+            const auto NameOf = [&symbols](uint64_t scope, uint64_t offset) {
+                const Symbol* pName = nullptr;
+                for(const Symbol& symbol : symbols)
+                    if(symbol.scope == scope && symbol.offset == offset && (!pName || symbol.name.Full() < pName->name.Full()))
+                        pName = &symbol;
+
+                return pName ? pName->name.Full() : ToDecimal(offset);
+            };
+
+            for(uint64_t stageIdx = 0U; stageIdx < stages.size(); ++stageIdx)
+            {
+                for(uint64_t idx = stageRanges[stageIdx].first; idx < stageRanges[stageIdx].second; ++idx)
+                {
+                    const Instruction& instruction = instructions[idx];
+                    const OpCode op = instruction.opCode;
+
+                    if(op == OpCode::PAR_RETIRE_CONDITIONAL && stageIdx + 1U < stages.size())
+                        SyntaxError(SourceLocation{ instruction.line, 1U }, "Can't fuse " + std::string(stages[stageIdx + 1U]->name) + " behind " + std::string(stages[stageIdx]->name) +
+                                    ", it retires work units the later stages still have to run on. Run them separately or retire in the last stage");
+
+                    for(uint64_t opIdx = 0U; opIdx < instruction.operands.size(); ++opIdx)
+                    {
+                        const auto& operand = instruction.operands[opIdx];
+                        if(operand.first != GLOBAL_SCOPE)
+                            continue;
+
+                        // The bytecode doesn't say which operand of a call is the result, every one could be either
+                        const bool call = op == OpCode::PAR_CALL;
+                        const bool writes = call || (opIdx == 0U && (Assigns(op) || Modifies(op)));
+                        const bool reads = call || opIdx != 0U || !Assigns(op);
+                        const uint64_t width = call ? sizeof(float) : std::max(writes ? WriteWidth(op) : 0U, reads ? ReadWidth(op, opIdx) : 0U);
+
+                        const uint64_t end = operand.second + width;
+                        writers.resize(std::max<uint64_t>(writers.size(), end), UINT64_MAX);
+                        readers.resize(std::max<uint64_t>(readers.size(), end), UINT64_MAX);
+
+                        for(uint64_t b = operand.second; b < end; ++b)
+                        {
+                            uint64_t earlier = reads && writers[b] < stageIdx ? writers[b] : writes && readers[b] < stageIdx ? readers[b] : UINT64_MAX;
+                            if(earlier != UINT64_MAX)
+                                SyntaxError(SourceLocation{ instruction.line, 1U }, "Can't fuse " + std::string(stages[stageIdx]->name) + " behind " + std::string(stages[earlier]->name) +
+                                            ", both use " + NameOf(GLOBAL_SCOPE, operand.second) + " and one of them writes it. Run them separately or make it a reduction");
+
+                            if(writes)
+                                writers[b] = std::min(writers[b], stageIdx);
+                            if(reads)
+                                readers[b] = std::min(readers[b], stageIdx);
+                        }
+                    }
+                }
+            }
+
+            // [local byte] -> written since the stage started, on every path to here. Jumps only go forward, once the scan
+            // reaches a label it has seen every jump to it, a byte counts as written there when all of them wrote it
+            uint64_t labelIdx = (uint64_t)std::count_if(instructions.begin(), instructions.begin() + stageRanges[0].first,
+                                                        [](const Instruction& instruction) { return instruction.opCode == OpCode::PAR_LABEL; });
+
+            // [label] -> written on every jump to it seen so far, for the labels some jump went to
+            const uint64_t labelTotal = (uint64_t)std::count_if(instructions.begin(), instructions.end(), [](const Instruction& instruction) { return instruction.opCode == OpCode::PAR_LABEL; });
+            std::vector<std::vector<uint8_t>> jumpedWritten(labelTotal);
+            std::vector<uint8_t> jumped(labelTotal, 0U);
+
+            for(uint64_t stageIdx = 0U; stageIdx < stages.size(); ++stageIdx)
+            {
+                std::vector<uint8_t> written{};
+
+                const auto Mark = [&written](uint64_t offset, uint64_t width) {
+                    written.resize(std::max<uint64_t>(written.size(), offset + width), 0U);
+                    std::fill_n(written.begin() + offset, width, 1U);
+                };
+
+                const auto IsWritten = [&written](uint64_t offset, uint64_t width) {
+                    for(uint64_t b = offset; b < offset + width; ++b)
+                        if(b >= written.size() || !written[b])
+                            return false;
+
+                    return true;
+                };
+
+                for(uint64_t idx = stageRanges[stageIdx].first; idx < stageRanges[stageIdx].second; ++idx)
+                {
+                    const Instruction& instruction = instructions[idx];
+                    const OpCode op = instruction.opCode;
+
+                    if(op == OpCode::PAR_LABEL)
+                    {
+                        const uint64_t label = labelIdx++;
+                        if(jumped[label])
+                            for(uint64_t b = 0U; b < written.size(); ++b)
+                                written[b] &= b < jumpedWritten[label].size() ? jumpedWritten[label][b] : 0U;
+
+                        continue;
+                    }
+
+                    // A host call's result follows the function and operand count, it only has one when the function returns
+                    const bool call = op == OpCode::PAR_CALL;
+                    const bool callAssigns = call && HostFunctions()[instruction.operands[0].second].returnsValue;
+                    const uint64_t firstOperand = call ? 2U : 0U;
+
+                    for(uint64_t opIdx = firstOperand; opIdx < instruction.operands.size(); ++opIdx)
+                    {
+                        const auto& operand = instruction.operands[opIdx];
+                        const bool reads = call ? !(callAssigns && opIdx == 2U) : opIdx != 0U || !Assigns(op);
+                        if(stageIdx == 0U || operand.first != LOCAL_SCOPE || !reads || IsWritten(operand.second, call ? sizeof(float) : ReadWidth(op, opIdx)))
+                            continue;
+
+                        SyntaxError(SourceLocation{ instruction.line, 1U }, "Can't fuse " + std::string(stages[stageIdx]->name) + " behind " + std::string(stages[stageIdx - 1U]->name) +
+                                    ", it reads " + NameOf(LOCAL_SCOPE, operand.second) + " before writing it and would see what the stage in front left there. Write it first or run them separately");
+                    }
+
+                    const bool writes = call ? callAssigns : Assigns(op) || Modifies(op);
+                    if(writes && instruction.operands[firstOperand].first == LOCAL_SCOPE)
+                        Mark(instruction.operands[firstOperand].second, call ? sizeof(float) : WriteWidth(op));
+
+                    if(op == OpCode::PAR_JUMP_CONDITIONAL)
+                    {
+                        const uint64_t label = instruction.operands[1].second;
+                        if(!jumped[label])
+                        {
+                            jumped[label] = 1U;
+                            jumpedWritten[label] = written;
+                        }
+                        else
+                        {
+                            for(uint64_t b = 0U; b < jumpedWritten[label].size(); ++b)
+                                jumpedWritten[label][b] &= b < written.size() ? written[b] : 0U;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Whether the instruction only adds to, subtracts from, or takes the min or max of its first operand, the way a
+        // reduction of that kind may be written. Sets the merge that goes with it
+        [[nodiscard]] static bool Accumulates(const Instruction& instruction, std::string_view kind, ReductionOp& op) noexcept
+        {
+            const auto& operands = instruction.operands;
+            const auto IsAccumulator = [&operands](uint64_t idx) { return operands[idx] == operands[0]; };
+
+            // d = d op x or d = x op d, the accumulator only once on the right
+            const bool binary = operands.size() == 3U && IsAccumulator(1U) != IsAccumulator(2U);
+
+            switch (instruction.opCode)
+            {
+                case OpCode::INC_INT: case OpCode::INC_UINT:    op = ReductionOp::SUM_INT; return kind == "Sum" || kind == "Count";
+                case OpCode::DEC_INT: case OpCode::DEC_UINT:    op = ReductionOp::SUM_INT; return kind == "Sum";
+                case OpCode::INC_FLOAT: case OpCode::DEC_FLOAT: op = ReductionOp::SUM_FLOAT; return kind == "Sum";
+                case OpCode::ADD_INT:                           op = ReductionOp::SUM_INT; return kind == "Sum" && binary;
+                case OpCode::ADD_FLOAT:                         op = ReductionOp::SUM_FLOAT; return kind == "Sum" && binary;
+                case OpCode::SUB_INT:                           op = ReductionOp::SUM_INT; return kind == "Sum" && binary && IsAccumulator(1U);
+                case OpCode::SUB_FLOAT:                         op = ReductionOp::SUM_FLOAT; return kind == "Sum" && binary && IsAccumulator(1U);
+                case OpCode::MIN_INT:                           op = ReductionOp::MIN_INT; return kind == "Min" && binary;
+                case OpCode::MIN_FLOAT:                         op = ReductionOp::MIN_FLOAT; return kind == "Min" && binary;
+                case OpCode::MAX_INT:                           op = ReductionOp::MAX_INT; return kind == "Max" && binary;
+                case OpCode::MAX_FLOAT:                         op = ReductionOp::MAX_FLOAT; return kind == "Max" && binary;
+                default:                                        return false;
+            }
+        }
+
+        // Reduced globals are never read, a work unit only accumulates in to them, so every run can start on a private copy
+        // and merge it in later. Checks every use and picks the merge from them, unused reductions are left out
+        [[nodiscard]] static std::vector<Reduction> BuildReductions(const std::vector<Instruction>& instructions, const Scope& globals)
+        {
+            std::map<uint64_t, std::pair<std::string, std::string>> reduced{};  // [offset] -> [name, kind]
+            for(const auto& [name, kind] : globals.m_Reductions)
+                reduced[globals.m_ScopeOffsetResolver.at(name)] = { name, kind };
+
+            std::map<uint64_t, ReductionOp> merges{};
+
+            for(const auto& instruction : instructions)
+            {
+                for(const auto& operand : instruction.operands)
+                {
+                    if(operand.first != REDUCTION_SCOPE)
+                        continue;
+
+                    const auto& [name, kind] = reduced[operand.second];
+                    SourceLocation location{ instruction.line, 1U };
+
+                    ReductionOp op{};
+                    if(operand != instruction.operands[0] || !Accumulates(instruction, kind, op))
+                    {
+                        std::string example = kind == "Count" ? "Int::++(" + name + ")" :
+                                              kind == "Sum"   ? name + " = Float::+(" + name + ", x) or Int::++(" + name + ")" :
+                                                                name + " = Float::" + kind + "(" + name + ", x)";
+
+                        SyntaxError(location, kind + "(" + name + ") can only be accumulated in to, like " + example);
+                    }
+
+                    auto [it, inserted] = merges.emplace(operand.second, op);
+                    if(it->second != op)
+                        SyntaxError(location, "Reduction accumulated as both Int and Float -> " + name);
+                }
+            }
+
+            std::vector<Reduction> reductions{};
+            for(const auto& [offset, op] : merges)
+            {
+                if(offset > UINT32_MAX)
+                    throw std::runtime_error(("Reduction offset does not fit in 32 bits -> " + reduced[offset].first).c_str());
+
+                Reduction reduction{};
+                reduction.offset = (uint32_t)offset;
+                reduction.op = op;
+                reductions.push_back(reduction);
+            }
+
+            return reductions;
+        }
+
+        // Removes labels nothing jumps to, they cost a dispatch, and renumbers the rest
+        static void DropUnusedLabels(std::vector<Instruction>& instructions)
+        {
+            std::vector<bool> used{};
+            for(const auto& instruction : instructions)
+                if(instruction.opCode == OpCode::PAR_LABEL)
+                    used.push_back(false);
+
+            for(const auto& instruction : instructions)
+                for(const auto& [scope, label] : instruction.operands)
+                    if(scope == CODE_SCOPE)
+                        used[label] = true;
+
+            std::vector<uint64_t> remap(used.size());
+            std::vector<Instruction> kept{};
+            uint64_t labelIdx = 0U, keptLabels = 0U;
+
+            for(auto& instruction : instructions)
+            {
+                if(instruction.opCode == OpCode::PAR_LABEL)
+                {
+                    remap[labelIdx] = keptLabels;
+                    if(!used[labelIdx++])
+                        continue;
+
+                    ++keptLabels;
+                }
+
+                kept.push_back(std::move(instruction));
+            }
+
+            for(auto& instruction : kept)
+                for(auto& [scope, label] : instruction.operands)
+                    if(scope == CODE_SCOPE)
+                        label = remap[label];
+
+            instructions = std::move(kept);
+        }
+
+        // Removes constants no instruction reads anymore and renumbers the rest
+        static constexpr void DropUnusedConstants(std::vector<Instruction>& instructions, std::vector<uint32_t>& constants)
+        {
+            std::vector<uint32_t> used{};
+            std::vector<uint64_t> remap(constants.size(), UINT64_MAX);    // [old index] -> new offset
+
+            for(auto& instruction : instructions)
+            {
+                for(auto& operand : instruction.operands)
+                {
+                    if(operand.first != CONSTANT_SCOPE)
+                        continue;
+
+                    uint64_t& offset = remap[operand.second / sizeof(uint32_t)];
+                    if(offset == UINT64_MAX)
+                    {
+                        offset = used.size() * sizeof(uint32_t);
+                        used.push_back(constants[operand.second / sizeof(uint32_t)]);
+                    }
+
+                    operand.second = offset;
+                }
+            }
+
+            constants = std::move(used);
+        }
+
+        // Bytecode with the constant pool and the reduction table behind it, before it's copied in to a Program
+        struct Assembly
+        {
+            std::vector<uint8_t> bytes{};
+            uint64_t codeSize = 0U;
+            uint8_t offsetSize = 1U;
+        };
+
+        // Picks the narrowest offset encoding that fits every operand, assembles the bytecode and puts the constant pool and
+        // the reduction table behind it. Runs at compile time too, see CompileStatic
+        [[nodiscard]] static constexpr Assembly Assemble(const std::vector<Instruction>& instructions, const std::vector<uint32_t>& constants, const std::vector<Reduction>& reductions,
+                                                         DebugTable *pDebugTable = nullptr)
+        {
+            uint64_t largestOffset = 0U;
+            for(const auto& instruction : instructions)
+                for(const auto& [scope, offset] : instruction.operands)
+                    if(scope != CODE_SCOPE)
+                        largestOffset = std::max(largestOffset, offset);
+
+            const auto OffsetSizeOf = [](uint64_t offset) -> uint8_t {
+                return offset <= UINT8_MAX ? sizeof(uint8_t) : offset <= UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t);
+            };
+
+            ////////////////////////////////////////////////////////////////
+            // Jumps encode the program counter of their label, which moves with the offset size. Grow until both fit
+            uint8_t offsetSize = OffsetSizeOf(largestOffset);
+            std::vector<uint64_t> labelCounters{};
+
+            while (true)
+            {
+                labelCounters.clear();
+
+                uint64_t pc = 0U;
+                for(const auto& instruction : instructions)
+                {
+                    if(instruction.opCode == OpCode::PAR_LABEL)
+                        labelCounters.push_back(pc);
+
+                    pc += 1U + instruction.operands.size() * (1U + offsetSize);
+                }
+
+                uint64_t largestLabel = labelCounters.empty() ? 0U : labelCounters.back();
+                if(OffsetSizeOf(largestLabel) <= offsetSize || offsetSize == sizeof(uint32_t))
+                {
+                    largestOffset = std::max(largestOffset, largestLabel);
+                    break;
+                }
+
+                offsetSize = OffsetSizeOf(largestLabel);
+            }
+
+            if(largestOffset > UINT32_MAX)
+                throw std::runtime_error("Scope offset does not fit in 32 bits...");
+
+            ////////////////////////////////////////////////////////////////
+            // Assemble instructions in to bytecode
+            Assembly assembly{};
+            std::vector<uint8_t>& program = assembly.bytes;
+            program.reserve(EncodedSize(instructions, offsetSize) + 3U + constants.size() * sizeof(uint32_t) + reductions.size() * sizeof(Reduction));
+
+            if(pDebugTable)
+                pDebugTable->entries.clear();
+
+            for(const auto& instruction : instructions)
+            {
+                if(pDebugTable)
+                    pDebugTable->entries.push_back(DebugTable::Entry{ program.size(), instruction.line });
+
+                program.push_back((uint8_t)instruction.opCode);
+
+                for(const auto& [scope, operandOffset] : instruction.operands)
+                {
+                    uint64_t offset = scope == CODE_SCOPE ? labelCounters[operandOffset] : operandOffset;
+
+                    program.push_back((uint8_t)scope);
+                    for(uint8_t b = 0U; b < offsetSize; ++b)
+                        program.push_back((uint8_t)(offset >> (b * 8U)));
+                }
+            }
+
+            assembly.codeSize = program.size();
+            assembly.offsetSize = offsetSize;
+
+            if(!constants.empty() || !reductions.empty())
+            {
+                program.resize(Program::ConstantsOffset(assembly.codeSize), 0U);
+                for(uint32_t constant : constants)
+                    for(uint8_t b = 0U; b < sizeof(uint32_t); ++b)
+                        program.push_back((uint8_t)(constant >> (b * 8U)));
+
+                // Written out field by field in the layout of Reduction, reinterpreting isn't allowed at compile time
+                for(const Reduction& reduction : reductions)
+                {
+                    for(uint8_t b = 0U; b < sizeof(uint32_t); ++b)
+                        program.push_back((uint8_t)(reduction.offset >> (b * 8U)));
+
+                    program.push_back((uint8_t)reduction.op);
+                    program.insert(program.end(), sizeof(reduction.padding), 0U);
+                }
+            }
+
+            return assembly;
+        }
+
+        [[nodiscard]] static Program Emit(const std::vector<Instruction>& instructions, const std::vector<uint32_t>& constants, const std::vector<Reduction>& reductions,
+                                          uint64_t localScopeSize, uint64_t workScopeColumns, DebugTable *pDebugTable = nullptr)
+        {
+            Assembly assembly = Assemble(instructions, constants, reductions, pDebugTable);
+
+            ////////////////////////////////////////////////////////////////
+            // Write out program
+            Program p{};
+            p.programSize = assembly.bytes.size();
+            p.codeSize = assembly.codeSize;
+            p.workScopeColumns = workScopeColumns;
+            p.localScopeSize = localScopeSize;
+            p.hostCalls = (uint64_t)std::count_if(instructions.begin(), instructions.end(), [](const Instruction& instruction) { return instruction.opCode == OpCode::PAR_CALL; });
+            p.reductionCount = reductions.size();
+            p.offsetSize = assembly.offsetSize;
+            p.pCode = static_cast<uint8_t*>(malloc(assembly.bytes.size()));
+            std::memcpy(p.pCode, assembly.bytes.data(), assembly.bytes.size());
+            return p;
+        }
+
+        ////////////////////////////////////////////////////////////////
+        // Literals
+        // Constexpr and independent of the locale the host set
+        [[nodiscard]] static constexpr bool ParseInteger(std::string_view text, int64_t &value) noexcept
+        {
+            value = 0;
+            for(char c : text)
+            {
+                if(!IsDigit(c) || value > UINT32_MAX)
+                    return false;
+
+                value = value * 10 + (c - '0');
+            }
+
+            return !text.empty();
+        }
+
+        // Unsigned integer wide enough to hold a float literal and the point half way between two floats exactly
+        struct BigInt
+        {
+            std::array<uint32_t, 32> words{};
+
+            constexpr void MulAdd(uint32_t factor, uint32_t add) noexcept
+            {
+                uint64_t carry = add;
+                for(uint32_t& word : words)
+                {
+                    uint64_t product = (uint64_t)word * factor + carry;
+                    word = (uint32_t)product;
+                    carry = product >> 32U;
+                }
+            }
+
+            constexpr void MulPow10(int64_t count) noexcept { for(; count > 0; --count) MulAdd(10U, 0U); }
+            constexpr void MulPow2(int64_t count) noexcept { for(; count > 0; count -= 16) MulAdd(1U << std::min<int64_t>(count, 16), 0U); }
+
+            [[nodiscard]] static constexpr int Compare(const BigInt& a, const BigInt& b) noexcept
+            {
+                for(uint64_t idx = a.words.size(); idx-- > 0U;)
+                    if(a.words[idx] != b.words[idx])
+                        return a.words[idx] < b.words[idx] ? -1 : 1;
+
+                return 0;
+            }
+        };
+
+        // 2, 0.5, 1e-3 and 2.5f, rounded like strtof in the "C" locale (no hex floats). A first guess through double, then fixed
+        // up by comparing the literal with the points half way to the floats around the guess
+        [[nodiscard]] static constexpr bool ParseFloat(std::string_view text, float &value) noexcept
+        {
+            uint64_t idx = 0U;
+            const auto SkipDigits = [&text, &idx]() {
+                uint64_t begin = idx;
+                while (idx < text.size() && IsDigit(text[idx]))
+                    ++idx;
+
+                return idx - begin;
+            };
+
+            uint64_t digitCount = SkipDigits();
+            if(idx < text.size() && text[idx] == '.')
+            {
+                ++idx;
+                digitCount += SkipDigits();
+            }
+
+            if(digitCount == 0U)
+                return false;
+
+            const uint64_t digitsEnd = idx;
+            int64_t exponent = 0;
+
+            if(idx < text.size() && (text[idx] == 'e' || text[idx] == 'E'))
+            {
+                ++idx;
+                bool negative = idx < text.size() && text[idx] == '-';
+                if(idx < text.size() && (text[idx] == '-' || text[idx] == '+'))
+                    ++idx;
+
+                if(idx == text.size() || !IsDigit(text[idx]))
+                    return false;
+
+                for(; idx < text.size() && IsDigit(text[idx]); ++idx)
+                    exponent = std::min<int64_t>(exponent * 10 + (text[idx] - '0'), 100000);
+
+                exponent = negative ? -exponent : exponent;
+            }
+
+            if(idx < text.size() && (text[idx] == 'f' || text[idx] == 'F'))
+                ++idx;
+
+            if(idx != text.size())
+                return false;
+
+            ////////////////////////////////////////////////////////////////
+            // The literal is digits * 10^exponent, past 100 significant digits only whether any of the rest is set counts
+            BigInt digits{};
+            uint64_t significant = 0U;
+            uint64_t leading = 0U;      // The first 19 significant digits, for the guess
+            int64_t leadingCount = 0;
+            bool inexact = false;
+            bool fraction = false;
+
+            for(uint64_t pos = 0U; pos < digitsEnd; ++pos)
+            {
+                if(text[pos] == '.')
+                {
+                    fraction = true;
+                    continue;
+                }
+
+                uint32_t digit = (uint32_t)(text[pos] - '0');
+                if(significant == 0U && digit == 0U)
+                {
+                    exponent -= fraction;
+                    continue;
+                }
+
+                if(significant < 100U)
+                {
+                    digits.MulAdd(10U, digit);
+                    exponent -= fraction;
+                    ++significant;
+                }
+                else
+                {
+                    inexact = inexact || digit != 0U;
+                    exponent += !fraction;
+                }
+
+                if(leadingCount < 19)
+                {
+                    leading = leading * 10U + digit;
+                    ++leadingCount;
+                }
+            }
+
+            // Below half the smallest float or past the largest, the big integers stay small in between
+            const int64_t magnitude = exponent + (int64_t)significant - 1;
+            if(significant == 0U || magnitude < -46)
+            {
+                value = 0.f;
+                return true;
+            }
+
+            if(magnitude > 38)
+            {
+                value = std::numeric_limits<float>::infinity();
+                return true;
+            }
+
+            constexpr double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+            double guess = (double)leading;
+            int64_t scale = magnitude - leadingCount + 1;
+            for(; scale > 22; scale -= 22)
+                guess *= 1e22;
+
+            for(; scale < -22; scale += 22)
+                guess /= 1e22;
+
+            guess = scale < 0 ? guess / powers[-scale] : guess * powers[scale];
+
+            ////////////////////////////////////////////////////////////////
+            // Compares the literal with the point half way between the float of these bits and the next one up
+            const auto CompareHalfWay = [&digits, exponent, inexact](uint32_t bits) {
+                const uint32_t biased = bits >> 23U;
+                const uint64_t mantissa = biased ? (bits & 0x7FFFFFU) | 0x800000U : bits & 0x7FFFFFU;
+                const int64_t binaryExponent = (biased ? (int64_t)biased : 1) - 150;   // float = mantissa * 2^binaryExponent
+
+                BigInt literal = digits;
+                BigInt halfWay{};
+                halfWay.MulAdd(1U, (uint32_t)(mantissa * 2U + 1U));
+
+                literal.MulPow10(exponent);
+                halfWay.MulPow10(-exponent);
+                halfWay.MulPow2(binaryExponent - 1);
+                literal.MulPow2(1 - binaryExponent);
+
+                int order = BigInt::Compare(literal, halfWay);
+                return order == 0 && inexact ? 1 : order;
+            };
+
+            constexpr uint32_t InfinityBits = 0x7F800000U;
+            uint32_t bits = guess >= (double)std::numeric_limits<float>::max() ? InfinityBits - 1U : std::bit_cast<uint32_t>((float)guess);
+
+            // Half way rounds to the even one, the guess is a float or two off at worst
+            while (true)
+            {
+                int above = CompareHalfWay(bits);
+                if(above > 0 || (above == 0 && (bits & 1U)))
+                {
+                    if(++bits == InfinityBits)
+                        break;
+
+                    continue;
+                }
+
+                int below = bits == 0U ? 1 : CompareHalfWay(bits - 1U);
+                if(below < 0 || (below == 0 && (bits & 1U)))
+                {
+                    --bits;
+                    continue;
+                }
+
+                break;
+            }
+
+            value = std::bit_cast<float>(bits);
+            return true;
+        }
+
+        // A literal takes the type of its library, unless the instruction reads it as a condition. That one is a bool
+        // whatever the library, like the condition of Float::Select
+        [[nodiscard]] static constexpr bool LiteralIsFloat(OpCode op, uint64_t operandIdx, std::string_view library) noexcept
+        {
+            return library == "Float" && ReadWidth(op, operandIdx) != sizeof(bool);
+        }
+
+        // The constant pool bits of a literal argument
+        [[nodiscard]] static constexpr uint32_t LiteralBits(const AstArgument& argument, bool isFloat)
+        {
+            const std::string text = (argument.negative ? "-" : "") + std::string(argument.literal);
+
+            if(isFloat)
+            {
+                float value = 0.f;
+                if(!ParseFloat(argument.literal, value))
+                    SyntaxError(argument.name.location, "Malformed float literal -> " + text);
+
+                return std::bit_cast<uint32_t>(argument.negative ? -value : value);
+            }
+
+            int64_t value = 0;
+            if(!ParseInteger(argument.literal, value))
+                SyntaxError(argument.name.location, "Malformed integer literal -> " + text);
+
+            value = argument.negative ? -value : value;
+            if(value < INT32_MIN || value > UINT32_MAX)
+                SyntaxError(argument.name.location, "Malformed integer literal -> " + text);
+
+            return (uint32_t)value;
+        }
+
+        ////////////////////////////////////////////////////////////////
+        // Built in functions
+        // Float, Int, Vec3 and VM. A Vec3 function spells out its result and arguments in groups, 'v' for a field group and
+        // 's' for a float. Groups with their fields next to each other become a single instruction, anything else (SoA
+        // columns, scattered fields) falls back to componentOp once per component
+        struct BuiltInFunction
+        {
+            std::string_view library{};
+            std::string_view name{};
+            OpCode opCode = OpCode::PAR_HALT;
+            bool assigns = false;
+            uint64_t argumentCount = 0U;
+            std::string_view groups;                // Vec3 only, result first
+            OpCode componentOp;                     // Vec3 only, COUNT if the fields have to be next to each other
+        };
+
+        static constexpr BuiltInFunction BuiltInFunctions[] = {
+            { "Float", "++", OpCode::INC_FLOAT, false, 1U },                            // INC_FLOAT [&Scope + Offset]
+            { "Float", "--", OpCode::DEC_FLOAT, false, 1U },                            // DEC_FLOAT [&Scope + Offset]
+            { "Float", "+", OpCode::ADD_FLOAT, true, 2U },                              // ADD_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Float", "-", OpCode::SUB_FLOAT, true, 2U },                              // SUB_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Float", "*", OpCode::MUL_FLOAT, true, 2U },                              // MUL_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Float", ">", OpCode::BIGGER_THAN_FLOAT, true, 2U },                      // BIGGER_THAN_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Float", "<", OpCode::SMALLER_THAN_FLOAT, true, 2U },                     // SMALLER_THAN_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Float", "Min", OpCode::MIN_FLOAT, true, 2U },                            // MIN_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Float", "Max", OpCode::MAX_FLOAT, true, 2U },                            // MAX_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Float", "Select", OpCode::SELECT, true, 3U },                            // SELECT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Int", "++", OpCode::INC_INT, false, 1U },                                // INC_INT [&Scope + Offset]
+            { "Int", "--", OpCode::DEC_INT, false, 1U },                                // DEC_INT [&Scope + Offset]
+            { "Int", "+", OpCode::ADD_INT, true, 2U },                                  // ADD_INT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Int", "-", OpCode::SUB_INT, true, 2U },                                  // SUB_INT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Int", "*", OpCode::MUL_INT, true, 2U },                                  // MUL_INT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Int", "Min", OpCode::MIN_INT, true, 2U },                                // MIN_INT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Int", "Max", OpCode::MAX_INT, true, 2U },                                // MAX_INT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Int", "Select", OpCode::SELECT, true, 3U },                              // SELECT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Vec3", "Add", OpCode::ADD_VEC3, true, 2U, "vvv", OpCode::ADD_FLOAT },    // ADD_VEC3 [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Vec3", "Sub", OpCode::SUB_VEC3, true, 2U, "vvv", OpCode::SUB_FLOAT },    // SUB_VEC3 [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Vec3", "Scale", OpCode::SCALE_VEC3, true, 2U, "vvs", OpCode::MUL_FLOAT }, // SCALE_VEC3 [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Vec3", "Mad", OpCode::MAD_VEC3, true, 3U, "vvsv", OpCode::MAD_FLOAT },   // MAD_VEC3 [&Scope + Offset], [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Vec3", "Dot", OpCode::DOT_VEC3, true, 2U, "svv", OpCode::COUNT },       // DOT_VEC3 [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
+            { "Vec3", "Length", OpCode::LENGTH_VEC3, true, 1U, "sv", OpCode::COUNT },  // LENGTH_VEC3 [&Scope + Offset], [&Scope + Offset]
+            { "VM", "Halt", OpCode::PAR_HALT, false, 0U },                              // PAR_HALT
+            { "VM", "HaltConditional", OpCode::PAR_HALT_CONDITIONAL, false, 1U },       // PAR_HALT_CONDITIONAL [&Scope + Offset]
+            { "VM", "RetireConditional", OpCode::PAR_RETIRE_CONDITIONAL, false, 1U },   // PAR_RETIRE_CONDITIONAL [&Scope + Offset]
+            { "VM", "JumpConditional", OpCode::PAR_JUMP_CONDITIONAL, false, 2U },       // PAR_JUMP_CONDITIONAL [&Scope + Offset], [Label]
+        };
+
+        ////////////////////////////////////////////////////////////////
+        // Resolver
+        // Turns a syntax tree in to instructions: the scope tables, the stages of the entry with their labels, literals and
+        // every library call. Constexpr from end to end, Compile and CompileStatic both run it. Host functions only exist
+        // at runtime, CompileStatic resolves without them
+        class Resolver
+        {
+        public:
+            constexpr Resolver(const Ast& ast, const std::deque<HostFunctionInfo> *pHostFunctions) : m_Ast(ast), m_pHostFunctions(pHostFunctions) {}
+
+            // entry names a worker or pipeline, empty for the first pipeline or else the first worker
+            [[nodiscard]] constexpr Resolution Resolve(std::string_view entry)
+            {
+                const std::vector<const AstWorker*> stages = EntryStages(entry);
+                ResolveScopes();
+
+                ////////////////////////////////////////////////////////////////
+                // Stages run back to back on every work unit, a worker on its own is a single stage.
+                // Every stage has its own labels, a halt only ends its own stage and becomes a jump past its last instruction
+                // NOTE(tomas): stages share the local scope, CheckFusable makes sure no stage reads what the one before left in it
+                std::vector<Instruction>& instructions = m_Resolution.instructions;
+                std::vector<std::pair<uint64_t, uint64_t>> stageRanges{};   // [first instruction, end] of every stage
+
+                for(uint64_t stageIdx = 0U; stageIdx < stages.size(); ++stageIdx)
+                {
+                    const std::span<const AstStatement> statements = m_Ast.Statements(*stages[stageIdx]);
+                    const uint64_t stageBegin = instructions.size();
+
+                    ResolveLabels(statements);
+                    const uint64_t stageEndLabel = m_LabelCount + m_Labels.size();
+
+                    for(const AstStatement& statement : statements)
+                    {
+                        if(!statement.label.empty())
+                        {
+                            instructions.push_back(Instruction{ OpCode::PAR_LABEL, {}, statement.location.line });
+                            ++m_LabelCount;
+                            continue;
+                        }
+
+                        ResolveStatement(statement);
+                    }
+
+                    // The last stage halts for real, the work unit is done either way
+                    if(stageIdx + 1U < stages.size())
+                    {
+                        for(uint64_t idx = stageBegin; idx < instructions.size(); ++idx)
+                        {
+                            Instruction& instruction = instructions[idx];
+
+                            if(instruction.opCode == OpCode::PAR_HALT)
+                            {
+                                AstArgument alwaysTaken{};
+                                alwaysTaken.literal = "1";
+                                instruction.opCode = OpCode::PAR_JUMP_CONDITIONAL;
+                                instruction.operands = { ResolveLiteral(alwaysTaken, false), { CODE_SCOPE, stageEndLabel } };
+                            }
+                            else if(instruction.opCode == OpCode::PAR_HALT_CONDITIONAL)
+                            {
+                                instruction.opCode = OpCode::PAR_JUMP_CONDITIONAL;
+                                instruction.operands.emplace_back(CODE_SCOPE, stageEndLabel);
+                            }
+                        }
+
+                        instructions.push_back(Instruction{ OpCode::PAR_LABEL });
+                        ++m_LabelCount;
+                    }
+
+                    stageRanges.emplace_back(stageBegin, instructions.size());
+                }
+
+                CheckFusable(instructions, stageRanges, stages, m_Resolution.symbols);
+
+                ////////////////////////////////////////////////////////////////
+                // Add halt to the end
+                instructions.push_back(Instruction{ OpCode::PAR_HALT });
+                return std::move(m_Resolution);
+            }
+
+        private:
+            // [x, y, z] of a field group
+            typedef std::array<std::pair<uint64_t, uint64_t>, 3> Group;
+
+            static constexpr std::array<std::string_view, 3> ScopeNames = { "GlobalScope", "WorkScope", "LocalScope" };
+            static constexpr std::array<std::string_view, 4> ReductionNames = { "Sum", "Min", "Max", "Count" };
+
+            // The workers to compile in order, the stages of the entry pipeline or the entry worker on its own
+            [[nodiscard]] constexpr std::vector<const AstWorker*> EntryStages(std::string_view entry) const
+            {
+                // [name, declaration] sorted by name. A name declared twice is reported where it comes back first
+                std::vector<std::pair<std::string_view, uint64_t>> workers{};
+                for(uint64_t idx = 0U; idx < m_Ast.workers.size(); ++idx)
+                    workers.emplace_back(m_Ast.workers[idx].name, idx);
+
+                std::sort(workers.begin(), workers.end());
+
+                uint64_t twice = UINT64_MAX;
+                for(uint64_t idx = 1U; idx < workers.size(); ++idx)
+                    if(workers[idx].first == workers[idx - 1U].first)
+                        twice = std::min(twice, workers[idx].second);
+
+                if(twice != UINT64_MAX)
+                    SyntaxError(m_Ast.workers[twice].location, "Worker declared twice -> " + std::string(m_Ast.workers[twice].name));
+
+                const auto FindWorker = [this, &workers](std::string_view name) -> const AstWorker* {
+                    auto it = std::lower_bound(workers.begin(), workers.end(), std::make_pair(name, (uint64_t)0U));
+                    return it != workers.end() && it->first == name ? &m_Ast.workers[it->second] : nullptr;
+                };
+
+                const AstPipeline* pPipeline = entry.empty() && !m_Ast.pipelines.empty() ? &m_Ast.pipelines[0] : nullptr;
+                for(const AstPipeline& pipeline : m_Ast.pipelines)
+                {
+                    if(FindWorker(pipeline.name))
+                        SyntaxError(pipeline.location, "Pipeline has the name of a worker -> " + std::string(pipeline.name));
+
+                    if(!entry.empty() && pipeline.name == entry)
+                        pPipeline = &pipeline;
+                }
+
+                std::vector<const AstWorker*> stages{};
+
+                if(pPipeline)
+                {
+                    for(const AstStage& stage : m_Ast.Stages(*pPipeline))
+                    {
+                        const AstWorker* pWorker = FindWorker(stage.name);
+                        if(!pWorker)
+                            SyntaxError(stage.location, "Unknown worker in pipeline -> " + std::string(stage.name));
+
+                        stages.push_back(pWorker);
+                    }
+
+                    return stages;
+                }
+
+                if(entry.empty())
+                {
+                    if(m_Ast.workers.empty())
+                        throw std::runtime_error("Worker function missing...");
+
+                    stages.push_back(&m_Ast.workers[0]);
+                    return stages;
+                }
+
+                const AstWorker* pWorker = FindWorker(entry);
+                if(!pWorker)
+                    throw std::runtime_error(("Unknown worker or pipeline -> " + std::string(entry)).c_str());
+
+                stages.push_back(pWorker);
+                return stages;
+            }
+
+            [[nodiscard]] static constexpr uint64_t ScopeIndex(std::string_view name) noexcept
+            {
+                uint64_t scopeIdx = 0U;
+                while (scopeIdx < ScopeNames.size() && ScopeNames[scopeIdx] != name)
+                    ++scopeIdx;
+
+                return scopeIdx;
+            }
+
+            // Checks the scope declarations in order and builds the symbol table
+            constexpr void ResolveScopes()
+            {
+                std::vector<Symbol>& symbols = m_Resolution.symbols;
+
+                // Every field up front to find the first one declared twice, it is reported in order with everything else
+                for(const AstScope& scope : m_Ast.scopes)
+                {
+                    const uint64_t scopeIdx = ScopeIndex(scope.name);
+                    if(scopeIdx < ScopeNames.size())
+                        for(const AstField& field : m_Ast.Fields(scope))
+                            symbols.push_back(Symbol{ field.name, scopeIdx, field.offset, field.reduction, symbols.size() });
+                }
+
+                std::sort(symbols.begin(), symbols.end());
+
+                uint64_t twice = UINT64_MAX;
+                for(uint64_t idx = 1U; idx < symbols.size(); ++idx)
+                    if(symbols[idx].name.base == symbols[idx - 1U].name.base && symbols[idx].name.member == symbols[idx - 1U].name.member && symbols[idx].scope == symbols[idx - 1U].scope)
+                        twice = std::min(twice, symbols[idx].order);
+
+                std::array<bool, 3> found{};
+                uint64_t order = 0U;
+
+                for(const AstScope& scope : m_Ast.scopes)
+                {
+                    const uint64_t scopeIdx = ScopeIndex(scope.name);
+
+                    if(scopeIdx == ScopeNames.size())
+                        SyntaxError(scope.location, "Unknown scope -> " + std::string(scope.name));
+
+                    if(found[scopeIdx])
+                        SyntaxError(scope.location, "Scope declared twice -> " + std::string(scope.name));
+
+                    // [ WorkScope[SoA] ] declares one column per field, the field index is the column index
+                    if(scope.structOfArrays && scopeIdx != WORK_SCOPE)
+                        SyntaxError(scope.location, "Only the work scope can be declared as SoA -> " + std::string(scope.name));
+
+                    uint64_t& scopeSize = m_Resolution.scopeSizes[scopeIdx];
+                    scopeSize = scope.size;
+                    found[scopeIdx] = true;
+
+                    if(scopeIdx == WORK_SCOPE)
+                        m_Resolution.structOfArrays = scope.structOfArrays;
+
+                    for(const AstField& field : m_Ast.Fields(scope))
+                    {
+                        if(scope.structOfArrays)
+                        {
+                            if(field.offset >= PAR_MAX_COLUMNS)
+                                SyntaxError(field.name.location, "Work scope column out of range -> " + field.name.Full());
+
+                            scopeSize = std::max<uint64_t>(scopeSize, field.offset + 1U);
+                        }
+
+                        if(order++ == twice)
+                            SyntaxError(field.name.location, "Field declared twice -> " + field.name.Full());
+
+                        if(!field.reduction.empty())
+                        {
+                            if(std::find(ReductionNames.begin(), ReductionNames.end(), field.reduction) == ReductionNames.end())
+                                SyntaxError(field.name.location, "Unknown reduction, expected Sum, Min, Max or Count -> " + std::string(field.reduction));
+
+                            if(scopeIdx != GLOBAL_SCOPE)
+                                SyntaxError(field.name.location, "Only global fields can be reduced -> " + field.name.Full());
+                        }
+                    }
+                }
+
+                for(uint64_t scopeIdx = 0U; scopeIdx < found.size(); ++scopeIdx)
+                    if(!found[scopeIdx])
+                        throw std::runtime_error(("Missing scope -> " + std::string(ScopeNames[scopeIdx])).c_str());
+
+                // The local scope is as big as declared, or as big as its fields need
+                m_Resolution.localScopeSize = m_Resolution.scopeSizes[LOCAL_SCOPE];
+                for(const Symbol& symbol : symbols)
+                    if(symbol.scope == LOCAL_SCOPE)
+                        m_Resolution.localScopeSize = std::max<uint64_t>(m_Resolution.localScopeSize, symbol.offset + sizeof(float));
+            }
+
+            // Label table of a stage, up front so jumps can refer to labels further down. Indices carry on from earlier stages
+            constexpr void ResolveLabels(std::span<const AstStatement> statements)
+            {
+                std::vector<const AstStatement*> declared{};
+
+                m_Labels.clear();
+                for(const AstStatement& statement : statements)
+                {
+                    if(statement.label.empty())
+                        continue;
+
+                    m_Labels.emplace_back(statement.label, m_LabelCount + declared.size());
+                    declared.push_back(&statement);
+                }
+
+                std::sort(m_Labels.begin(), m_Labels.end());
+
+                uint64_t twice = UINT64_MAX;
+                for(uint64_t idx = 1U; idx < m_Labels.size(); ++idx)
+                    if(m_Labels[idx].first == m_Labels[idx - 1U].first)
+                        twice = std::min(twice, m_Labels[idx].second - m_LabelCount);
+
+                if(twice != UINT64_MAX)
+                    SyntaxError(declared[twice]->location, "Label declared twice -> " + std::string(declared[twice]->label));
+            }
+
+            // pos.x -> [scope, offset], from the first scope that declares it in Global, Work, Local order
+            [[nodiscard]] constexpr std::pair<uint64_t, uint64_t> ResolveName(const AstName& name) const
+            {
+                const std::vector<Symbol>& symbols = m_Resolution.symbols;
+
+                auto it = std::lower_bound(symbols.begin(), symbols.end(), Symbol{ name });
+                if(it == symbols.end() || it->name.base != name.base || it->name.member != name.member)
+                    SyntaxError(name.location, "Failed to resolve variable scope and offset... " + name.Full());
+
+                // SoA fields live at the start of their own column scope
+                if(it->scope == WORK_SCOPE && m_Resolution.structOfArrays)
+                    return std::make_pair(COLUMN_SCOPE + it->offset, 0U);
+
+                // Reduced globals accumulate in to a private copy, same offset
+                if(!it->reduction.empty())
+                    return std::make_pair(REDUCTION_SCOPE, it->offset);
+
+                return std::make_pair(it->scope, it->offset);
+            }
+
+            // Field group pos -> pos.x, pos.y, pos.z, the members of the first scope that groups under that name
+            [[nodiscard]] constexpr Group ResolveGroup(const AstName& group) const
+            {
+                if(!group.member.empty())
+                    SyntaxError(group.location, "Expected a field group but found a field -> " + group.Full());
+
+                const std::vector<Symbol>& symbols = m_Resolution.symbols;
+                std::vector<const Symbol*> members{};
+
+                for(auto it = std::lower_bound(symbols.begin(), symbols.end(), Symbol{ AstName{ group.base } }); it != symbols.end() && it->name.base == group.base; ++it)
+                {
+                    if(it->name.member.empty() || (!members.empty() && it->scope > members[0]->scope))
+                        continue;
+
+                    if(!members.empty() && it->scope < members[0]->scope)
+                        members.clear();
+
+                    members.push_back(&*it);
+                }
+
+                if(members.empty())
+                    SyntaxError(group.location, "Failed to resolve field group... " + std::string(group.base));
+
+                if(members.size() != 3U)
+                    SyntaxError(group.location, "Vec3:: takes field groups of 3 fields -> " + std::string(group.base));
+
+                // x, y and z as declared
+                std::sort(members.begin(), members.end(), [](const Symbol* pA, const Symbol* pB) { return pA->order < pB->order; });
+
+                Group components{};
+                for(uint64_t idx = 0U; idx < 3U; ++idx)
+                    components[idx] = ResolveName(AstName{ group.base, members[idx]->name.member, group.location });
+
+                return components;
+            }
+
+            // Literals go in to the constant pool, every distinct value once
+            [[nodiscard]] constexpr std::pair<uint64_t, uint64_t> ResolveLiteral(const AstArgument& argument, bool isFloat)
+            {
+                const uint32_t bits = LiteralBits(argument, isFloat);
+
+                auto it = std::lower_bound(m_ConstantOffsets.begin(), m_ConstantOffsets.end(), std::make_pair(bits, (uint64_t)0U));
+                if(it == m_ConstantOffsets.end() || it->first != bits)
+                {
+                    it = m_ConstantOffsets.insert(it, std::make_pair(bits, m_Resolution.constants.size() * sizeof(uint32_t)));
+                    m_Resolution.constants.push_back(bits);
+                }
+
+                return std::make_pair(CONSTANT_SCOPE, it->second);
+            }
+
+            [[nodiscard]] constexpr std::pair<uint64_t, uint64_t> ResolveOperand(const AstArgument& argument, bool isFloat)
+            {
+                return argument.literal.empty() ? ResolveName(argument.name) : ResolveLiteral(argument, isFloat);
+            }
+
+            [[nodiscard]] static constexpr std::string FunctionName(const AstStatement& statement)
+            {
+                return std::string(statement.library) + "::" + std::string(statement.function);
+            }
+
+            // Where a function that returns a value puts it
+            [[nodiscard]] constexpr std::pair<uint64_t, uint64_t> ResolveTarget(const AstStatement& statement) const
+            {
+                if(!statement.assigns)
+                    SyntaxError(statement.location, FunctionName(statement) + " returns a value that has to be assigned");
+
+                return ResolveName(statement.target);
+            }
+
+            constexpr void ResolveStatement(const AstStatement& statement)
+            {
+                bool knownLibrary = false;
+
+                for(const BuiltInFunction& function : BuiltInFunctions)
+                {
+                    if(function.library != statement.library)
+                        continue;
+
+                    knownLibrary = true;
+                    if(function.name != statement.function)
+                        continue;
+
+                    if(!function.groups.empty())
+                        ResolveGroups(statement, function);
+                    else if(function.opCode == OpCode::PAR_JUMP_CONDITIONAL)
+                        ResolveJump(statement);
+                    else
+                        ResolveBuiltIn(statement, function);
+
+                    return;
+                }
+
+                // TODO(tomas): add some debug functionality: Breakpoint, Reset local scope. Profiling lives behind PAR_PROFILE
+                if(m_pHostFunctions)
+                {
+                    for(uint64_t functionIdx = 0U; functionIdx < m_pHostFunctions->size(); ++functionIdx)
+                    {
+                        const HostFunctionInfo& info = (*m_pHostFunctions)[functionIdx];
+                        if(info.library != statement.library)
+                            continue;
+
+                        knownLibrary = true;
+                        if(info.name == statement.function)
+                            return ResolveCall(statement, info, functionIdx);
+                    }
+                }
+
+                if(!knownLibrary)
+                    SyntaxError(statement.location, "Unknown library -> " + std::string(statement.library));
+
+                SyntaxError(statement.location, "Unknown function -> " + FunctionName(statement));
+            }
+
+            // Float, Int and VM, every argument is an operand as it is
+            constexpr void ResolveBuiltIn(const AstStatement& statement, const BuiltInFunction& function)
+            {
+                const std::span<const AstArgument> arguments = m_Ast.Arguments(statement);
+                Instruction instruction{ function.opCode, {}, statement.location.line };
+
+                if(arguments.size() != function.argumentCount)
+                    SyntaxError(statement.location, FunctionName(statement) + " takes " + ToDecimal(function.argumentCount) + " arguments");
+
+                if(function.assigns)
+                    instruction.operands.push_back(ResolveTarget(statement));
+                else if(statement.assigns)
+                    SyntaxError(statement.location, FunctionName(statement) + " does not return a value");
+
+                for(const AstArgument& argument : arguments)
+                    instruction.operands.push_back(ResolveOperand(argument, LiteralIsFloat(instruction.opCode, instruction.operands.size(), statement.library)));
+
+                if(Modifies(function.opCode) && !arguments[0].literal.empty())
+                    SyntaxError(statement.location, "A literal can't be modified");
+
+                m_Resolution.instructions.push_back(std::move(instruction));
+            }
+
+            // PAR_JUMP_CONDITIONAL [&Scope + Offset], [Label]
+            constexpr void ResolveJump(const AstStatement& statement)
+            {
+                const std::span<const AstArgument> arguments = m_Ast.Arguments(statement);
+                Instruction instruction{ OpCode::PAR_JUMP_CONDITIONAL, {}, statement.location.line };
+
+                if(arguments.size() != 2U)
+                    SyntaxError(statement.location, "VM::JumpConditional takes 2 arguments");
+
+                if(statement.assigns)
+                    SyntaxError(statement.location, "VM::JumpConditional does not return a value");
+
+                const AstArgument& condition = arguments[0];
+                const AstArgument& label = arguments[1];
+                instruction.operands.push_back(ResolveOperand(condition, false));
+
+                auto it = label.literal.empty() && label.name.member.empty() ? std::lower_bound(m_Labels.begin(), m_Labels.end(), std::make_pair(label.name.base, (uint64_t)0U)) : m_Labels.end();
+                if(it == m_Labels.end() || it->first != label.name.base)
+                    SyntaxError(label.name.location, "Unknown label -> " + (label.literal.empty() ? label.name.Full() : std::string(label.literal)));
+
+                // Every work unit has to reach the end of the worker, so no loops
+                if(it->second < m_LabelCount)
+                    SyntaxError(label.name.location, "Jumps only go forward, label is above the jump -> " + std::string(it->first));
+
+                instruction.operands.emplace_back(CODE_SCOPE, it->second);
+                m_Resolution.instructions.push_back(std::move(instruction));
+            }
+
+            // Vec3, a single instruction on the first field of every group or one instruction per component
+            constexpr void ResolveGroups(const AstStatement& statement, const BuiltInFunction& function)
+            {
+                const std::span<const AstArgument> arguments = m_Ast.Arguments(statement);
+                const std::string name = FunctionName(statement);
+
+                if(arguments.size() != function.argumentCount)
+                    SyntaxError(statement.location, name + " takes " + ToDecimal(function.argumentCount) + " arguments");
+
+                if(!statement.assigns)
+                    SyntaxError(statement.location, name + " returns a value that has to be assigned");
+
+                // Every operand by component, a float is the same for all three
+                std::vector<Group> operands{};
+                bool packed = true;
+
+                const auto PushGroup = [&operands, &packed](const Group& group) {
+                    packed &= group[0].first < COLUMN_SCOPE &&
+                              group[1] == std::make_pair(group[0].first, group[0].second + sizeof(float)) &&
+                              group[2] == std::make_pair(group[0].first, group[0].second + 2U * sizeof(float));
+                    operands.push_back(group);
+                };
+
+                if(function.groups[0] == 'v')
+                {
+                    PushGroup(ResolveGroup(statement.target));
+                }
+                else
+                {
+                    auto target = ResolveName(statement.target);
+                    operands.push_back(Group{ target, target, target });
+                }
+
+                for(uint64_t argumentIdx = 0U; argumentIdx < arguments.size(); ++argumentIdx)
+                {
+                    const AstArgument& argument = arguments[argumentIdx];
+
+                    if(function.groups[argumentIdx + 1U] == 'v')
+                    {
+                        if(!argument.literal.empty())
+                            SyntaxError(argument.name.location, name + " expects a field group, not a literal");
+
+                        PushGroup(ResolveGroup(argument.name));
+                    }
+                    else
+                    {
+                        auto operand = ResolveOperand(argument, true);
+                        operands.push_back(Group{ operand, operand, operand });
+                    }
+                }
+
+                if(packed)
+                {
+                    Instruction instruction{ function.opCode, {}, statement.location.line };
+                    for(const auto& group : operands)
+                        instruction.operands.push_back(group[0]);
+
+                    m_Resolution.instructions.push_back(std::move(instruction));
+                    return;
+                }
+
+                if(function.componentOp == OpCode::COUNT)
+                    SyntaxError(statement.location, name + " needs the fields of every group next to each other");
+
+                // Component by component, a float argument must not change half way through
+                for(uint64_t idx = 1U; idx < operands.size(); ++idx)
+                    if(operands[idx][0] == operands[idx][1] && std::find(operands[0].begin(), operands[0].end(), operands[idx][0]) != operands[0].end())
+                        SyntaxError(statement.location, name + " writes a field it reads as a float");
+
+                for(uint64_t component = 0U; component < 3U; ++component)
+                {
+                    Instruction instruction{ function.componentOp, {}, statement.location.line };
+                    for(const auto& group : operands)
+                        instruction.operands.push_back(group[component]);
+
+                    m_Resolution.instructions.push_back(std::move(instruction));
+                }
+            }
+
+            // PAR_CALL [Function], [Operand count], [&Scope + Offset]...
+            // NOTE(tomas): host functions are registered at runtime, this never runs at compile time
+            void ResolveCall(const AstStatement& statement, const HostFunctionInfo& info, uint64_t functionIdx)
+            {
+                const std::span<const AstArgument> arguments = m_Ast.Arguments(statement);
+                Instruction instruction{ OpCode::PAR_CALL, {}, statement.location.line };
+
+                if(arguments.size() != info.arguments.size())
+                    SyntaxError(statement.location, FunctionName(statement) + " takes " + std::to_string(info.arguments.size()) + " arguments");
+
+                instruction.operands.emplace_back(HOST_SCOPE, functionIdx);
+                instruction.operands.emplace_back(HOST_SCOPE, info.arguments.size() + (info.returnsValue ? 1U : 0U));
+
+                if(info.returnsValue)
+                    instruction.operands.push_back(ResolveTarget(statement));
+                else if(statement.assigns)
+                    SyntaxError(statement.location, FunctionName(statement) + " does not return a value");
+
+                for(uint64_t argumentIdx = 0U; argumentIdx < arguments.size(); ++argumentIdx)
+                    instruction.operands.push_back(ResolveOperand(arguments[argumentIdx], info.arguments[argumentIdx] == 'f'));
+
+                m_Resolution.instructions.push_back(std::move(instruction));
+            }
+
+            const Ast& m_Ast;
+            const std::deque<HostFunctionInfo> *m_pHostFunctions;
+            Resolution m_Resolution{};
+            std::vector<std::pair<std::string_view, uint64_t>> m_Labels{};      // [name, label index] of the current stage, sorted by name
+            uint64_t m_LabelCount = 0U;                                         // Labels emitted so far
+            std::vector<std::pair<uint32_t, uint64_t>> m_ConstantOffsets{};     // [bits, offset] of every constant, sorted by bits
+        };
+
+        // A static program's bytecode, before CompileStatic copies it in to the binary. Resolved like Compile resolves with
+        // options.optimize off. Run<Program> binds an AoS work scope and has no reduction table to merge, those are errors
+        struct StaticAssembly
+        {
+            Assembly assembly{};
+            uint64_t localScopeSize = 0U;
+        };
+
+        [[nodiscard]] static constexpr StaticAssembly AssembleStatic(std::string_view source)
+        {
+            const Ast ast = Parser(source).Parse();
+            Resolution resolution = Resolver(ast, nullptr).Resolve({});
+
+            for(const AstScope& scope : ast.scopes)
+                if(scope.structOfArrays)
+                    SyntaxError(scope.location, "Static programs take AoS scopes, compile SoA work scopes at runtime -> " + std::string(scope.name));
+
+            for(const Instruction& instruction : resolution.instructions)
+                for(const auto& operand : instruction.operands)
+                    if(operand.first == REDUCTION_SCOPE)
+                        SyntaxError(SourceLocation{ instruction.line, 1U }, "Static programs don't reduce, compile reductions at runtime");
+
+            DropUnusedConstants(resolution.instructions, resolution.constants);
+            return StaticAssembly{ Assemble(resolution.instructions, resolution.constants, {}), resolution.localScopeSize };
+        }
+
+    public:
+        // Makes library::name callable from every script compiled after this. arguments holds one character per argument,
+        // 'f' for a float and 'i' for an integer, that is how literals passed to it are read. Registering a name again
+        // swaps the function and keeps its index, so programs compiled against the old one stay valid. Returns the index
+        static uint64_t RegisterFunction(const std::string& library, const std::string& name, const std::string& arguments, bool returnsValue, HostFunction function)
+        {
+            static constexpr std::string_view builtInLibraries[] = { "Float", "Int", "Vec3", "VM" };
+            if(std::find(std::begin(builtInLibraries), std::end(builtInLibraries), library) != std::end(builtInLibraries))
+                throw std::runtime_error(("Host functions can't go in a built in library -> " + library + "::" + name).c_str());
+
+            if(arguments.find_first_not_of("fi") != std::string::npos)
+                throw std::runtime_error(("Host function arguments are 'f' or 'i' -> " + library + "::" + name).c_str());
+
+            if(!function)
+                throw std::runtime_error(("Host function is empty -> " + library + "::" + name).c_str());
+
+            static std::mutex mutex{};
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto& functions = HostFunctions();
+            for(uint64_t idx = 0U; idx < functions.size(); ++idx)
+            {
+                if(functions[idx].library != library || functions[idx].name != name)
+                    continue;
+
+                if(functions[idx].arguments != arguments || functions[idx].returnsValue != returnsValue)
+                    throw std::runtime_error(("Host function registered again with other arguments -> " + library + "::" + name).c_str());
+
+                functions[idx].function = std::move(function);
+                return idx;
+            }
+
+            functions.push_back(HostFunctionInfo{ library, name, arguments, returnsValue, std::move(function) });
+            return functions.size() - 1U;
+        }
+
+        [[nodiscard]] static Program Compile(const std::string& code, const CompileOptions& options = {})
+        {
+            ////////////////////////////////////////////////////////////////
+            // Parse the source in to a syntax tree, one pass, names are views in to code. Then resolve it like CompileStatic does
+            const Ast ast = Parser(code).Parse();
+            Resolution resolution = Resolver(ast, &HostFunctions()).Resolve(options.entry);
+
+            std::vector<Instruction>& instructions = resolution.instructions;
+            std::vector<uint32_t>& constants = resolution.constants;
+            const uint64_t localScopeSize = resolution.localScopeSize;
+
+            auto scopes = BuildScopes(resolution);
+            std::vector<Reduction> reductions = BuildReductions(instructions, scopes[GLOBAL_SCOPE]);
+
+            ////////////////////////////////////////////////////////////////
+            // Optimize
+            OptimizationReport report{};
+            report.instructionsIn = instructions.size();
+            report.bytesIn = EncodedSize(instructions);
+
+            if(options.optimize)
+            {
+                Optimize(instructions, localScopeSize, options.persistentLocals, report);
+                DropUnusedLabels(instructions);
+            }
+
+            DropUnusedConstants(instructions, constants);
+            Program p = Emit(instructions, constants, reductions, localScopeSize, scopes[WORK_SCOPE].structOfArrays ? scopes[WORK_SCOPE].scopeSize : 0U, options.pDebugTable);
+            p.scratchLocals = options.optimize && !options.persistentLocals;
+
+            report.instructionsOut = instructions.size();
+            report.bytesOut = p.codeSize;
+
+            if(options.pReport)
+                *options.pReport = report;
+
+            if(options.pScopes)
+                *options.pScopes = scopes;
+
+            return p;
+        }
+
+        // Compiles a script while the C++ around it compiles, the bytecode ends up as a constant in the binary and a
+        // broken script is a compile error. Same front end as Compile, minus SoA work scopes, reductions and host functions.
+        // The result matches Compile with options.optimize off. Run it unrolled with Run<Program>, or through View()
+        //   static constexpr auto program = ParVm::Compiler::CompileStatic<"...">();
+        template<StaticSource Source>
+        [[nodiscard]] static consteval auto CompileStatic()
+        {
+            // Once to size the program, the vectors can't outlive the evaluation
+            constexpr uint64_t size = AssembleStatic(Source.View()).assembly.bytes.size();
+            const StaticAssembly result = AssembleStatic(Source.View());
+
+            StaticProgram<size> program{};
+            std::copy(result.assembly.bytes.begin(), result.assembly.bytes.end(), program.bytes.begin());
+            program.codeSize = result.assembly.codeSize;
+            program.localScopeSize = result.localScopeSize;
+            program.offsetSize = result.assembly.offsetSize;
+            return program;
+        }
+
+        ////////////////////////////////////////////////////////////////
+        // Specialization
+        // Bakes the current value of every global the program never writes in to the constant pool and folds whatever
+        // ends up depending on constants only. Works on the bytecode, regenerating after the globals change skips parsing.
+        // NOTE(tomas): the specialized program is only valid for as long as those globals keep their values
+        [[nodiscard]] static Program Specialize(const Program *pProgram, const void *pGlobalScope, OptimizationReport *pReport = nullptr)
+        {
+            std::vector<Instruction> instructions = Disassemble(pProgram);
+
+            OptimizationReport report{};
+            report.instructionsIn = instructions.size();
+            report.bytesIn = pProgram->codeSize;
+
+            ////////////////////////////////////////////////////////////////
+            // Constant pool, the program's own constants keep their offsets
+            std::vector<uint32_t> constants(pProgram->ConstantsSize() / sizeof(uint32_t));
+            std::memcpy(constants.data(), pProgram->Constants(), constants.size() * sizeof(uint32_t));
+
+            std::unordered_map<uint32_t, uint64_t> constantOffsets{};
+            for(uint64_t idx = constants.size(); idx-- > 0U;)
+                constantOffsets[constants[idx]] = idx * sizeof(uint32_t);
+
+            const auto Constant = [&constants, &constantOffsets](uint32_t bits) -> std::pair<uint64_t, uint64_t> {
+                auto [it, inserted] = constantOffsets.emplace(bits, constants.size() * sizeof(uint32_t));
+                if(inserted)
+                    constants.push_back(bits);
+
+                return std::make_pair(CONSTANT_SCOPE, it->second);
+            };
+
+            const auto ConstantBits = [&constants](const std::pair<uint64_t, uint64_t>& operand) -> uint32_t {
+                return constants[operand.second / sizeof(uint32_t)];
+            };
+
+            ////////////////////////////////////////////////////////////////
+            // Globals the program writes to have to stay in the global scope
+            std::vector<bool> writtenGlobals{};
+            const auto MarkWritten = [&writtenGlobals](const std::pair<uint64_t, uint64_t>& operand, uint64_t width) {
+                if(operand.first != GLOBAL_SCOPE)
+                    return;
+
+                writtenGlobals.resize(std::max<uint64_t>(writtenGlobals.size(), operand.second + width), false);
+                for(uint64_t b = operand.second; b < operand.second + width; ++b)
+                    writtenGlobals[b] = true;
+            };
+
+            for(const auto& instruction : instructions)
+            {
+                if(Assigns(instruction.opCode) || Modifies(instruction.opCode))
+                    MarkWritten(instruction.operands[0], WriteWidth(instruction.opCode));
+
+                // The bytecode doesn't say which operand of a call is the result
+                if(instruction.opCode == OpCode::PAR_CALL)
+                    for(const auto& operand : instruction.operands)
+                        MarkWritten(operand, sizeof(float));
+            }
+
+            const auto IsReadOnlyGlobal = [&writtenGlobals](const std::pair<uint64_t, uint64_t>& operand, uint64_t width) {
+                if(operand.first != GLOBAL_SCOPE)
+                    return false;
+
+                for(uint64_t b = operand.second; b < operand.second + width && b < writtenGlobals.size(); ++b)
+                    if(writtenGlobals[b])
+                        return false;
+
+                return true;
+            };
+
+            ////////////////////////////////////////////////////////////////
+            // Propagate and fold, front to back. Local scope values known at this point: [offset] -> [bits, width]
+            std::map<uint64_t, std::pair<uint32_t, uint64_t>> knownLocals{};
+
+            const auto Forget = [&knownLocals](const std::pair<uint64_t, uint64_t>& operand, uint64_t width) {
+                if(operand.first != LOCAL_SCOPE)
+                    return;
+
+                for(auto it = knownLocals.begin(); it != knownLocals.end();)
+                {
+                    bool overlaps = it->first < operand.second + width && operand.second < it->first + it->second.second;
+                    it = overlaps ? knownLocals.erase(it) : std::next(it);
+                }
+            };
+
+            std::vector<Instruction> specialized{};
+            specialized.reserve(instructions.size());
+
+            // Set after an unconditional halt or an always taken jump, only a label makes code reachable again
+            bool unreachable = false;
+
+            for(auto instruction : instructions)
+            {
+                const OpCode op = instruction.opCode;
+                const uint64_t firstRead = (Assigns(op) || Modifies(op)) ? 1U : 0U;
+
+                // Labels always stay, jumps refer to them by index. Other paths join here, so nothing is known anymore
+                if(op == OpCode::PAR_LABEL)
+                {
+                    unreachable = false;
+                    knownLocals.clear();
+                }
+                else if(unreachable)
+                {
+                    continue;
+                }
+
+                // The host gets the addresses, every operand stays where it is and any local could have changed
+                if(op == OpCode::PAR_CALL)
+                {
+                    for(const auto& operand : instruction.operands)
+                        Forget(operand, sizeof(float));
+
+                    specialized.push_back(instruction);
+                    continue;
+                }
+
+                bool allConstant = true;
+                for(uint64_t idx = firstRead; idx < instruction.operands.size(); ++idx)
+                {
+                    auto& operand = instruction.operands[idx];
+                    const uint64_t readWidth = ReadWidth(op, idx);
+
+                    if(operand.first == CODE_SCOPE)
+                        continue;
+
+                    // Field groups don't fit a constant, they stay where they are
+                    if(readWidth > sizeof(uint32_t))
+                    {
+                        allConstant = false;
+                        continue;
+                    }
+
+                    if(IsReadOnlyGlobal(operand, readWidth))
+                    {
+                        uint32_t bits = 0U;
+                        std::memcpy(&bits, static_cast<const uint8_t*>(pGlobalScope) + operand.second, readWidth);
+                        operand = Constant(bits);
+                        ++report.specializedOperands;
+                    }
+                    else if(operand.first == LOCAL_SCOPE)
+                    {
+                        auto it = knownLocals.find(operand.second);
+                        if(it != knownLocals.end() && it->second.second >= readWidth)
+                            operand = Constant(it->second.first);
+                    }
+
+                    allConstant &= operand.first == CONSTANT_SCOPE;
+                }
+
+                // Modified operands are read too, they never turn in to constants
+                allConstant &= firstRead < instruction.operands.size() && !Modifies(op);
+
+                if((IsConditionalHalt(op) || op == OpCode::PAR_JUMP_CONDITIONAL) && allConstant)
+                {
+                    uint32_t inputs[4]{};
+                    for(uint64_t idx = 0U; idx < instruction.operands.size(); ++idx)
+                        if(instruction.operands[idx].first == CONSTANT_SCOPE)
+                            inputs[idx] = ConstantBits(instruction.operands[idx]);
+
+                    ++report.constantsFolded;
+
+                    // Never taken, drop it
+                    if(!HaltTaken(op, inputs))
+                        continue;
+
+                    // Always taken, retiring still has to report the unit so it stays. So does the jump, up to its label nothing runs
+                    if(op == OpCode::PAR_JUMP_CONDITIONAL)
+                        unreachable = true;
+                    else if(op != OpCode::PAR_RETIRE_CONDITIONAL)
+                        instruction = Instruction{ OpCode::PAR_HALT, {}, instruction.line };
+                }
+                else if(Assigns(op))
+                {
+                    const auto& destination = instruction.operands[0];
+                    Forget(destination, WriteWidth(op));
+
+                    // The store stays for now, the optimizer drops it when nothing reads it anymore
+                    if(allConstant && destination.first == LOCAL_SCOPE)
+                    {
+                        uint32_t inputs[4]{};
+                        for(uint64_t idx = 1U; idx < instruction.operands.size(); ++idx)
+                            inputs[idx - 1U] = ConstantBits(instruction.operands[idx]);
+
+                        knownLocals[destination.second] = { Fold(op, inputs), WriteWidth(op) };
+                        ++report.constantsFolded;
+                    }
+                }
+                else if(Modifies(op))
+                {
+                    Forget(instruction.operands[0], WriteWidth(op));
+                }
+
+                specialized.push_back(instruction);
+
+                if(instruction.opCode == OpCode::PAR_HALT)
+                    unreachable = true;
+            }
+
+            // Only a program whose locals were already scratch gets them treated as scratch
+            Optimize(specialized, pProgram->localScopeSize, !pProgram->scratchLocals, report);
+            DropUnusedLabels(specialized);
+
+            DropUnusedConstants(specialized, constants);
+            Program p = Emit(specialized, constants, std::vector<Reduction>(pProgram->Reductions(), pProgram->Reductions() + pProgram->reductionCount),
+                             pProgram->localScopeSize, pProgram->workScopeColumns);
+            p.scratchLocals = pProgram->scratchLocals;
+
+            report.instructionsOut = specialized.size();
+            report.bytesOut = p.codeSize;
+
+            if(pReport)
+                *pReport = report;
+
+            return p;
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////
+    // Profiling
+    // Only exists when PAR_PROFILE is defined before including this header, without it the interpreter carries no
+    // trace of it. Point WorkerState::pProfile (or Executor::State().pProfile) at a Profile to record the runs on it.
+    // The instrumented interpreter reads the cycle counter on every dispatch, expect it to run a lot slower.
+    #ifdef PAR_PROFILE
+    [[nodiscard]] inline uint64_t ReadCycleCounter() noexcept
+    {
+        #if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+        #else
+        return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+        #endif
+    }
+
+    // What instrumented runs saw, accumulates over every run it is attached to
+    struct Profile
+    {
+        std::array<uint64_t, (size_t)OpCode::COUNT> opCounts{};
+        std::array<uint64_t, (size_t)OpCode::COUNT> opCycles{};
+        std::vector<uint64_t> pcCounts{};   // Indexed by program counter
+        std::vector<uint64_t> pcCycles{};
+        uint64_t workUnits  = 0U;
+        uint64_t halts      = 0U;           // Conditional halts taken, retires included
+        uint64_t retires    = 0U;
+
+        void Attach(const Program *pProgram)
+        {
+            if(pcCounts.size() < pProgram->codeSize)
+            {
+                pcCounts.resize(pProgram->codeSize, 0U);
+                pcCycles.resize(pProgram->codeSize, 0U);
+            }
+        }
+
+        void Charge(const uint8_t *pCode, uint64_t programCounter, uint64_t cycles) noexcept
+        {
+            // Nothing ran yet
+            if(programCounter >= pcCycles.size())
+                return;
+
+            pcCycles[programCounter] += cycles;
+            opCycles[pCode[programCounter]] += cycles;
+        }
+
+        void Count(const uint8_t *pCode, uint64_t programCounter) noexcept
+        {
+            ++pcCounts[programCounter];
+            ++opCounts[pCode[programCounter]];
+        }
+    };
+
+    // Profile as JSON: totals, then per opcode, per instruction and, given the debug table Compile filled in, per .pars line
+    [[nodiscard]] inline std::string ProfileReport(const Profile &profile, const Program *pProgram, const DebugTable *pDebugTable = nullptr)
+    {
+        uint64_t totalCycles = 0U;
+        for(uint64_t cycles : profile.opCycles)
+            totalCycles += cycles;
+
+        std::string json = "{\n";
+        json += "  \"workUnits\": " + std::to_string(profile.workUnits) + ",\n";
+        json += "  \"haltsTaken\": " + std::to_string(profile.halts) + ",\n";
+        json += "  \"retired\": " + std::to_string(profile.retires) + ",\n";
+        json += "  \"cycles\": " + std::to_string(totalCycles) + ",\n";
+
+        json += "  \"opcodes\": [";
+        const char *pSeparator = "\n";
+        for(uint64_t op = 0U; op < (uint64_t)OpCode::COUNT; ++op)
+        {
+            if(profile.opCounts[op] == 0U && profile.opCycles[op] == 0U)
+                continue;
+
+            json += pSeparator;
+            json += "    { \"opcode\": \"" + std::string(OpCodeNames[op]) + "\", \"count\": " + std::to_string(profile.opCounts[op]) +
+                    ", \"cycles\": " + std::to_string(profile.opCycles[op]) + " }";
+            pSeparator = ",\n";
+        }
+        json += "\n  ],\n";
+
+        // [line] -> [count, cycles]
+        std::map<uint32_t, std::pair<uint64_t, uint64_t>> lines{};
+
+        json += "  \"instructions\": [";
+        pSeparator = "\n";
+        for(uint64_t pc = 0U; pc < std::min<uint64_t>(profile.pcCounts.size(), pProgram->codeSize); ++pc)
+        {
+            if(profile.pcCounts[pc] == 0U && profile.pcCycles[pc] == 0U)
+                continue;
+
+            uint32_t line = pDebugTable ? pDebugTable->LineOf(pc) : 0U;
+            lines[line].first += profile.pcCounts[pc];
+            lines[line].second += profile.pcCycles[pc];
+
+            json += pSeparator;
+            json += "    { \"pc\": " + std::to_string(pc) + ", \"opcode\": \"" + OpCodeNames[pProgram->pCode[pc]] + "\", \"line\": " + std::to_string(line) +
+                    ", \"count\": " + std::to_string(profile.pcCounts[pc]) + ", \"cycles\": " + std::to_string(profile.pcCycles[pc]) + " }";
+            pSeparator = ",\n";
+        }
+        json += "\n  ],\n";
+
+        json += "  \"lines\": [";
+        pSeparator = "\n";
+        if(pDebugTable)
+        {
+            for(const auto& [line, totals] : lines)
+            {
+                json += pSeparator;
+                json += "    { \"line\": " + std::to_string(line) + ", \"count\": " + std::to_string(totals.first) + ", \"cycles\": " + std::to_string(totals.second) + " }";
+                pSeparator = ",\n";
+            }
+        }
+        json += "\n  ]\n}\n";
+
+        return json;
+    }
+    #endif
+
+    ////////////////////////////////////////////////////////////////
+    // Reductions
+    // A run accumulates the reduced globals in to a private copy bound as REDUCTION_SCOPE and merges it in to the global
+    // scope once at the end, threads never write the same global. Sums start at zero, mins and maxes at the global itself.
+
+    // Sizes the private copy and starts every reduction over, returns its base
+    inline uint8_t *ResetReductions(std::vector<uint8_t> &reductionScope, const Reduction *pReductions, uint64_t count, const uint8_t *pGlobalScope)
+    {
+        uint64_t size = 0U;
+        for(uint64_t idx = 0U; idx < count; ++idx)
+            size = std::max<uint64_t>(size, pReductions[idx].offset + sizeof(uint32_t));
+
+        if(reductionScope.size() < size)
+            reductionScope.resize(size);
+
+        for(uint64_t idx = 0U; idx < count; ++idx)
+        {
+            const Reduction &reduction = pReductions[idx];
+            bool sum = reduction.op == ReductionOp::SUM_INT || reduction.op == ReductionOp::SUM_FLOAT;
+
+            // All zero bits are 0 and 0.0f alike
+            if(sum)
+                memset(reductionScope.data() + reduction.offset, 0, sizeof(uint32_t));
+            else
+                memcpy(reductionScope.data() + reduction.offset, pGlobalScope + reduction.offset, sizeof(uint32_t));
+        }
+
+        return reductionScope.data();
+    }
+
+    inline void MergeReductions(const Reduction *pReductions, uint64_t count, uint8_t *pGlobalScope, const uint8_t *pReductionScope) noexcept
+    {
+        for(uint64_t idx = 0U; idx < count; ++idx)
+        {
+            uint8_t *pGlobal = pGlobalScope + pReductions[idx].offset;
+            const uint8_t *pPrivate = pReductionScope + pReductions[idx].offset;
+
+            switch (pReductions[idx].op)
+            {
+                // Wraps the same for signed and unsigned
+                case ReductionOp::SUM_INT:      *(uint32_t*)pGlobal += *(const uint32_t*)pPrivate; break;
+                case ReductionOp::SUM_FLOAT:    *(float*)pGlobal += *(const float*)pPrivate; break;
+                case ReductionOp::MIN_INT:      *(int*)pGlobal = std::min(*(int*)pGlobal, *(const int*)pPrivate); break;
+                case ReductionOp::MIN_FLOAT:    *(float*)pGlobal = std::min(*(float*)pGlobal, *(const float*)pPrivate); break;
+                case ReductionOp::MAX_INT:      *(int*)pGlobal = std::max(*(int*)pGlobal, *(const int*)pPrivate); break;
+                case ReductionOp::MAX_FLOAT:    *(float*)pGlobal = std::max(*(float*)pGlobal, *(const float*)pPrivate); break;
+            }
+        }
+    }
+
+    // Everything a single VM instance mutates while running, one per thread
+    struct WorkerState
+    {
+        uint64_t programCounter = 0U;
+        std::vector<uint8_t> localScope{};
+        std::vector<uint64_t> retired{};    // Work units that took a VM::RetireConditional, appended to and never cleared by a run
+        std::vector<uint8_t> reductionScope{};  // Private copy of the reduced globals, merged in at the end of every run
+
+        // Host calls, only programs that make them touch these
+        uint64_t callBatch = PAR_CALL_BATCH;    // Work units that run up to a call before the host is called for all of them
+        std::vector<uint8_t> batchLocalScopes{};// A local scope per unit of the batch, they live across the calls
+        std::vector<uint64_t> parked{};         // Program counter of the call every unit of the batch waits at
+        std::vector<uint8_t*> callOperands{};
+        std::vector<uint64_t> callUnits{};
+
+        #ifdef PAR_PROFILE
+        Profile *pProfile = nullptr;        // Runs on this state are recorded here when set, scalar interpreter only
+        #endif
+
+        // Grows the local scope to hold at least size bytes, rounded up so it can be cleared in 16 byte stores
+        uint8_t *LocalScope(uint64_t size)
+        {
+            size = (size + 15U) & ~15ULL;
+            if(localScope.size() < size)
+                localScope.resize(size);
+
+            return localScope.data();
+        }
+    };
+
+    // Hands the work units a run retired over to the caller, if it asked for them
+    inline void CollectRetired(WorkerState &state, std::vector<uint64_t> *pRetired)
+    {
+        if(pRetired)
+            pRetired->insert(pRetired->end(), state.retired.begin(), state.retired.end());
+
+        state.retired.clear();
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Field group math, shared by the interpreters. All three components are read before any is written
+    struct Vec3
+    {
+        float x = 0.f, y = 0.f, z = 0.f;
+    };
+
+    [[nodiscard]] inline Vec3 LoadVec3(const uint8_t *p) noexcept { Vec3 v; std::memcpy(&v, p, sizeof(v)); return v; }
+    inline void StoreVec3(uint8_t *p, const Vec3 &v) noexcept { std::memcpy(p, &v, sizeof(v)); }
+    [[nodiscard]] inline float LoadFloat(const uint8_t *p) noexcept { float f; std::memcpy(&f, p, sizeof(f)); return f; }
+
+    inline void AddVec3(uint8_t *pDst, const uint8_t *pA, const uint8_t *pB) noexcept
+    {
+        Vec3 a = LoadVec3(pA), b = LoadVec3(pB);
+        StoreVec3(pDst, { a.x + b.x, a.y + b.y, a.z + b.z });
+    }
+
+    inline void SubVec3(uint8_t *pDst, const uint8_t *pA, const uint8_t *pB) noexcept
+    {
+        Vec3 a = LoadVec3(pA), b = LoadVec3(pB);
+        StoreVec3(pDst, { a.x - b.x, a.y - b.y, a.z - b.z });
+    }
+
+    inline void ScaleVec3(uint8_t *pDst, const uint8_t *pA, const uint8_t *pS) noexcept
+    {
+        Vec3 a = LoadVec3(pA);
+        float s = LoadFloat(pS);
+        StoreVec3(pDst, { a.x * s, a.y * s, a.z * s });
+    }
+
+    inline void MadVec3(uint8_t *pDst, const uint8_t *pA, const uint8_t *pS, const uint8_t *pB) noexcept
+    {
+        Vec3 a = LoadVec3(pA), b = LoadVec3(pB);
+        float s = LoadFloat(pS);
+        StoreVec3(pDst, { a.x * s + b.x, a.y * s + b.y, a.z * s + b.z });
+    }
+
+    inline void DotVec3(uint8_t *pDst, const uint8_t *pA, const uint8_t *pB) noexcept
+    {
+        Vec3 a = LoadVec3(pA), b = LoadVec3(pB);
+        float dot = a.x * b.x + a.y * b.y + a.z * b.z;
+        std::memcpy(pDst, &dot, sizeof(dot));
+    }
+
+    inline void LengthVec3(uint8_t *pDst, const uint8_t *pA) noexcept
+    {
+        Vec3 a = LoadVec3(pA);
+        float length = std::sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
+        std::memcpy(pDst, &length, sizeof(length));
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Interpreter helpers, shared by the byte code interpreters below
+    #define OperandBytes                            (1U + sizeof(OffsetT))
+    #define ScopeOf(OpIdx)                          pCode[programCounter + 1U + (OpIdx) * OperandBytes]
+    #define Address(OpIdx)                          (pScopes[ScopeOf(OpIdx)] + ReadOffset<OffsetT>(pCode + programCounter + 2U + (OpIdx) * OperandBytes))
+    #define Step(OperandCount)                      programCounter += 1U + (OperandCount) * OperandBytes; goto *opLut[*(pCode + programCounter)]
+    #define DeclareOp(OpName, OperandCount, Code)   OpName:{ProfileOp()Code}Step(OperandCount);
+
+    #ifdef PAR_PROFILE
+        // Charges the cycles since the last dispatch to the instruction that ran and counts the one about to run.
+        // A conditional halt jumps to PAR_HALT without moving the program counter, that is how a taken halt shows up,
+        // the time spent halting is charged to the instruction that halted
+        #define ProfileOp() \
+            if(pProfile) { \
+                uint64_t tick = ReadCycleCounter(); \
+                pProfile->Charge(pCode, profilePc, tick - profileTick); \
+                profileTick = tick; \
+                if(!profileHalting && programCounter == profilePc && pCode[programCounter] != (uint8_t)OpCode::PAR_HALT) { \
+                    ++pProfile->halts; \
+                    pProfile->retires += pCode[programCounter] == (uint8_t)OpCode::PAR_RETIRE_CONDITIONAL; \
+                    profileHalting = true; \
+                } \
+                else { \
+                    pProfile->Count(pCode, programCounter); \
+                    profileHalting = false; \
+                    profilePc = programCounter; \
+                } \
+            }
+        #define ProfileEnd() if(pProfile) { pProfile->Charge(pCode, profilePc, ReadCycleCounter() - profileTick); }
+    #else
+        #define ProfileOp()
+        #define ProfileEnd()
+    #endif
+
+    // Runs the work units in [workScopeBegin, workScopeEnd) on the calling thread
+    template<typename OffsetT>
+    inline void RunRangeImpl(const Program *pProgram, WorkerState &state, ScopeBinding binding, uint64_t workScopeBegin, uint64_t workScopeEnd, bool zeroLocalScope)
+    {
+        ////////////////////////////////////////////////////////////////
+        // Setup part Virtual machine
+        uint64_t workUnitIdx = workScopeBegin;
+
+        if(workScopeBegin >= workScopeEnd)
+            return;
+
+        const uint8_t *pCode = pProgram->pCode;
+        const uint64_t localScopeSize = pProgram->localScopeSize;
+        uint64_t programCounter = state.programCounter;
+
+        binding.Advance(workUnitIdx);
+        binding.pScopes[LOCAL_SCOPE] = state.LocalScope(localScopeSize);
+        binding.pScopes[CONSTANT_SCOPE] = pProgram->Constants();
+        auto& pScopes = binding.pScopes;
+
+        ////////////////////////////////////////////////////////////////
+        // Host call batches, see PAR_NEXT_UNIT. Every unit of a batch gets its own local scope.
+        // NOTE(tomas): without zeroLocalScope a unit starts on whatever the unit in its place in the last batch left behind
+        static constexpr uint64_t HaltedUnit = ~0ULL;
+        const bool batched = pProgram->hostCalls != 0U;
+        const uint64_t batchSize = std::max<uint64_t>(state.callBatch, 1U);
+        const uint64_t localStride = (localScopeSize + 15U) & ~15ULL;
+        uint64_t batchBegin = workScopeBegin;
+        uint64_t batchEnd = workScopeEnd;
+        uint64_t boundUnit = workScopeBegin;    // Work unit the binding points at
+        uint64_t resumePc = 0U;                 // Call the units of this sweep continue after
+        bool starting = true;                   // First sweep of a batch, every unit starts at the top
+        uint8_t *pBatchLocals = nullptr;
+        uint64_t *pParked = nullptr;
+
+        if(batched)
+        {
+            const uint64_t batchLocalBytes = std::max<uint64_t>(batchSize * localStride, 16U);
+            if(state.batchLocalScopes.size() < batchLocalBytes)
+                state.batchLocalScopes.resize(batchLocalBytes);
+
+            if(state.parked.size() < batchSize)
+                state.parked.resize(batchSize);
+
+            batchEnd = std::min(workScopeBegin + batchSize, workScopeEnd);
+            pBatchLocals = state.batchLocalScopes.data();
+            pParked = state.parked.data();
+            std::fill_n(pParked, batchEnd - batchBegin, 0U);
+
+            pScopes[LOCAL_SCOPE] = pBatchLocals;
+            programCounter = 0U;
+        }
+
+        // Points the binding at a unit of the batch, units of a batch run out of order
+        const auto BindUnit = [&binding, &boundUnit, pBatchLocals, localStride, &batchBegin](uint64_t unitIdx) noexcept {
+            if(unitIdx > boundUnit)
+                binding.Advance(unitIdx - boundUnit);
+            else
+                binding.Rewind(boundUnit - unitIdx);
+
+            boundUnit = unitIdx;
+            binding.pScopes[LOCAL_SCOPE] = pBatchLocals + (unitIdx - batchBegin) * localStride;
+        };
+
+        if(zeroLocalScope)
+            std::memset(pScopes[LOCAL_SCOPE], 0, localScopeSize);
+
+        #ifdef PAR_PROFILE
+        Profile *pProfile = state.pProfile;
+        uint64_t profilePc = ~0ULL;
+        uint64_t profileTick = 0U;
+        bool profileHalting = false;
+
+        if(pProfile)
+        {
+            pProfile->Attach(pProgram);
+            pProfile->workUnits += workScopeEnd - workScopeBegin;
+            profileTick = ReadCycleCounter();
+        }
+        #endif
+
+        static constexpr void* opLut[] = {
+            &&PAR_HALT,
+            &&INC_FLOAT,
+            &&DEC_FLOAT,
+            &&ADD_FLOAT,
+            &&SUB_FLOAT,
+            &&MUL_FLOAT,
+            &&INC_INT,
+            &&DEC_INT,
+            &&INC_UINT,
+            &&DEC_UINT,
+            &&ADD_INT,
+            &&SUB_INT,
+            &&MUL_INT,
+            &&PAR_HALT_CONDITIONAL,
+            &&BIGGER_THAN_FLOAT,
+            &&SMALLER_THAN_FLOAT,
+            &&MAD_FLOAT,
+            &&HALT_BIGGER_THAN_FLOAT,
+            &&HALT_SMALLER_THAN_FLOAT,
+            &&PAR_RETIRE_CONDITIONAL,
+            &&SELECT,
+            &&MIN_FLOAT,
+            &&MAX_FLOAT,
+            &&MIN_INT,
+            &&MAX_INT,
+            &&PAR_LABEL,
+            &&PAR_JUMP_CONDITIONAL,
+            &&ADD_VEC3,
+            &&SUB_VEC3,
+            &&SCALE_VEC3,
+            &&MAD_VEC3,
+            &&DOT_VEC3,
+            &&LENGTH_VEC3,
+            &&PAR_CALL
+        };
+
+        ////////////////////////////////////////////////////////////////
+        // Start pars Virtual machine
+        goto *opLut[pCode[programCounter]];
+
+        ////////////////////////////////////////////////////////////////
+        // VM Instructions
+        DeclareOp(PAR_HALT, 0, // PAR_HALT
+                if(batched) {
+                    pParked[workUnitIdx - batchBegin] = HaltedUnit;
+                    goto PAR_NEXT_UNIT;
+                }
+
+                ++workUnitIdx;
+                programCounter = 0U;
+
+                if(workUnitIdx >= workScopeEnd) {
+                    // Work is done, leave the PC at the start so the next run is clean
+                    state.programCounter = 0U;
+                    ProfileEnd()
+                    return;
+                }
+                else {
+                    // Advance work unit
+                    binding.Advance(1U);
+
+                    // Zero local scope if needed
+                    if(zeroLocalScope)
+                        std::memset(pScopes[LOCAL_SCOPE], 0, localScopeSize);
+
+                    // Start VM on the new local scope work unit, this skips the Step op
+                    goto *opLut[pCode[programCounter]];
+                });
+
+        DeclareOp(PAR_HALT_CONDITIONAL,     1, { if(*(bool*)Address(0U)) goto *opLut[0]; });
+        DeclareOp(PAR_RETIRE_CONDITIONAL,   1, { if(*(bool*)Address(0U)) { state.retired.push_back(workUnitIdx); goto *opLut[0]; } });
+        DeclareOp(PAR_LABEL,                0, {});
+        DeclareOp(PAR_JUMP_CONDITIONAL,     2, {
+                if(*(bool*)Address(0U)) {
+                    programCounter = ReadOffset<OffsetT>(pCode + programCounter + 2U + OperandBytes);
+                    goto *opLut[pCode[programCounter]];
+                }});
+
+        ////////////////////////////////////////////////////////////////
+        // Branch free selection, the bytes are copied whatever their type
+        DeclareOp(SELECT,                   4, { *(uint32_t*)Address(0U) = *(bool*)Address(1U) ? *(uint32_t*)Address(2U) : *(uint32_t*)Address(3U); });
+
+        ////////////////////////////////////////////////////////////////
+        // Floating point arithmetic instructions
+        DeclareOp(INC_FLOAT,                1, { *(float*)Address(0U) += 1.f; });
+        DeclareOp(DEC_FLOAT,                1, { *(float*)Address(0U) -= 1.f; });
+        DeclareOp(ADD_FLOAT,                3, { *(float*)Address(0U) = *(float*)Address(1U) + *(float*)Address(2U); });
+        DeclareOp(SUB_FLOAT,                3, { *(float*)Address(0U) = *(float*)Address(1U) - *(float*)Address(2U); });
+        DeclareOp(MUL_FLOAT,                3, { *(float*)Address(0U) = *(float*)Address(1U) * *(float*)Address(2U); });
+        DeclareOp(BIGGER_THAN_FLOAT,        3, { *(bool*)Address(0U) = *(float*)Address(1U) > *(float*)Address(2U); });
+        DeclareOp(SMALLER_THAN_FLOAT,       3, { *(bool*)Address(0U) = *(float*)Address(1U) < *(float*)Address(2U); });
+        DeclareOp(MAD_FLOAT,                4, { *(float*)Address(0U) = *(float*)Address(1U) * *(float*)Address(2U) + *(float*)Address(3U); });
+        DeclareOp(MIN_FLOAT,                3, { float a = *(float*)Address(1U); float b = *(float*)Address(2U); *(float*)Address(0U) = a < b ? a : b; });
+        DeclareOp(MAX_FLOAT,                3, { float a = *(float*)Address(1U); float b = *(float*)Address(2U); *(float*)Address(0U) = a > b ? a : b; });
+        DeclareOp(HALT_BIGGER_THAN_FLOAT,   2, { if(*(float*)Address(0U) > *(float*)Address(1U)) goto *opLut[0]; });
+        DeclareOp(HALT_SMALLER_THAN_FLOAT,  2, { if(*(float*)Address(0U) < *(float*)Address(1U)) goto *opLut[0]; });
+
+        ////////////////////////////////////////////////////////////////
+        // Integer arithmetic instructions
+        DeclareOp(INC_INT,                  1, { *(int*)Address(0U) += 1; });
+        DeclareOp(DEC_INT,                  1, { *(int*)Address(0U) -= 1; });
+        DeclareOp(INC_UINT,                 1, { *(unsigned int*)Address(0U) += 1U; });
+        DeclareOp(DEC_UINT,                 1, { *(unsigned int*)Address(0U) -= 1U; });
+        DeclareOp(ADD_INT,                  3, { *(int*)Address(0U) = *(int*)Address(1U) + *(int*)Address(2U); });
+        DeclareOp(SUB_INT,                  3, { *(int*)Address(0U) = *(int*)Address(1U) - *(int*)Address(2U); });
+        DeclareOp(MUL_INT,                  3, { *(int*)Address(0U) = *(int*)Address(1U) * *(int*)Address(2U); });
+        DeclareOp(MIN_INT,                  3, { int a = *(int*)Address(1U); int b = *(int*)Address(2U); *(int*)Address(0U) = a < b ? a : b; });
+        DeclareOp(MAX_INT,                  3, { int a = *(int*)Address(1U); int b = *(int*)Address(2U); *(int*)Address(0U) = a > b ? a : b; });
+
+        ////////////////////////////////////////////////////////////////
+        // Field group instructions
+        DeclareOp(ADD_VEC3,                 3, { AddVec3(Address(0U), Address(1U), Address(2U)); });
+        DeclareOp(SUB_VEC3,                 3, { SubVec3(Address(0U), Address(1U), Address(2U)); });
+        DeclareOp(SCALE_VEC3,               3, { ScaleVec3(Address(0U), Address(1U), Address(2U)); });
+        DeclareOp(MAD_VEC3,                 4, { MadVec3(Address(0U), Address(1U), Address(2U), Address(3U)); });
+        DeclareOp(DOT_VEC3,                 3, { DotVec3(Address(0U), Address(1U), Address(2U)); });
+        DeclareOp(LENGTH_VEC3,              2, { LengthVec3(Address(0U), Address(1U)); });
+
+        ////////////////////////////////////////////////////////////////
+        // Host calls, the unit waits here for the rest of its batch
+        DeclareOp(PAR_CALL,                 2, { pParked[workUnitIdx - batchBegin] = programCounter; goto PAR_NEXT_UNIT; });
+
+        ////////////////////////////////////////////////////////////////
+        // Host call batches
+        // Every unit of the batch runs until it halts or reaches a call. Then the call with the lowest program counter
+        // is made once for all units waiting at it, and only those run on to their next call or halt. Jumps only go
+        // forward, once nobody is left above a call nobody can reach it anymore. Repeats until the whole batch halted
+        PAR_NEXT_UNIT:
+        #ifdef PAR_PROFILE
+        // Another unit takes over, it must not look like the last one halting on the instruction it parked or halted at
+        if(pProfile)
+        {
+            ProfileEnd()
+            profileTick = ReadCycleCounter();
+            profilePc = ~0ULL;
+            profileHalting = false;
+        }
+        #endif
+
+        do { ++workUnitIdx; } while (workUnitIdx < batchEnd && !starting && pParked[workUnitIdx - batchBegin] != resumePc);
+
+        if(workUnitIdx >= batchEnd)
+        {
+            resumePc = HaltedUnit;
+            for(uint64_t idx = 0U; idx < batchEnd - batchBegin; ++idx)
+                resumePc = std::min(resumePc, pParked[idx]);
+
+            if(resumePc == HaltedUnit)
+            {
+                if(batchEnd >= workScopeEnd)
+                {
+                    state.programCounter = 0U;
+                    ProfileEnd()
+                    return;
+                }
+
+                batchBegin = batchEnd;
+                batchEnd = std::min(batchBegin + batchSize, workScopeEnd);
+                std::fill_n(pParked, batchEnd - batchBegin, 0U);
+                starting = true;
+                workUnitIdx = batchBegin;
+            }
+            else
+            {
+                const uint64_t functionIdx = ReadOffset<OffsetT>(pCode + resumePc + 2U);
+                const uint64_t operandCount = ReadOffset<OffsetT>(pCode + resumePc + 2U + OperandBytes);
+
+                state.callUnits.clear();
+                for(uint64_t idx = 0U; idx < batchEnd - batchBegin; ++idx)
+                    if(pParked[idx] == resumePc)
+                        state.callUnits.push_back(batchBegin + idx);
+
+                const uint64_t count = state.callUnits.size();
+                state.callOperands.resize(operandCount * count);
+
+                programCounter = resumePc;
+                for(uint64_t n = 0U; n < count; ++n)
+                {
+                    BindUnit(state.callUnits[n]);
+                    for(uint64_t operandIdx = 0U; operandIdx < operandCount; ++operandIdx)
+                        state.callOperands[operandIdx * count + n] = Address(2U + operandIdx);
+                }
+
+                HostFunctions()[functionIdx].function(HostBatch{ count, operandCount, state.callOperands.data(), state.callUnits.data() });
+
+                starting = false;
+                workUnitIdx = state.callUnits.front();
+            }
+        }
+
+        BindUnit(workUnitIdx);
+
+        if(starting)
+        {
+            programCounter = 0U;
+            if(zeroLocalScope)
+                std::memset(pScopes[LOCAL_SCOPE], 0, localScopeSize);
+        }
+        else
+        {
+            programCounter = resumePc + 1U + (2U + ReadOffset<OffsetT>(pCode + resumePc + 2U + OperandBytes)) * OperandBytes;
+        }
+
+        goto *opLut[pCode[programCounter]];
+    }
+
+    // Only the interpreter above is instrumented
+    #undef ProfileOp
+    #undef ProfileEnd
+    #define ProfileOp()
+
+    inline void RunRange(const Program *pProgram, WorkerState &state, const ScopeBinding &binding, uint64_t workScopeBegin, uint64_t workScopeEnd, bool zeroLocalScope = true)
+    {
+        CheckLocalScope(pProgram, zeroLocalScope);
+
+        // Reductions get a private copy for the run, unless the caller bound one to merge itself
+        if(pProgram->reductionCount != 0U && binding.pScopes[REDUCTION_SCOPE] == nullptr)
+        {
+            ScopeBinding reduced = binding;
+            reduced.pScopes[REDUCTION_SCOPE] = ResetReductions(state.reductionScope, pProgram->Reductions(), pProgram->reductionCount, binding.pScopes[GLOBAL_SCOPE]);
+            RunRange(pProgram, state, reduced, workScopeBegin, workScopeEnd, zeroLocalScope);
+            MergeReductions(pProgram->Reductions(), pProgram->reductionCount, binding.pScopes[GLOBAL_SCOPE], reduced.pScopes[REDUCTION_SCOPE]);
+            return;
+        }
+
+        switch (pProgram->offsetSize)
+        {
+            case sizeof(uint8_t):   RunRangeImpl<uint8_t>(pProgram, state, binding, workScopeBegin, workScopeEnd, zeroLocalScope); break;
+            case sizeof(uint16_t):  RunRangeImpl<uint16_t>(pProgram, state, binding, workScopeBegin, workScopeEnd, zeroLocalScope); break;
+            case sizeof(uint32_t):  RunRangeImpl<uint32_t>(pProgram, state, binding, workScopeBegin, workScopeEnd, zeroLocalScope); break;
+            default: throw std::runtime_error("Unsupported operand offset size...");
+        }
+    }
+
+    inline void RunRange(const Program *pProgram, WorkerState &state, void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeBegin, uint64_t workScopeEnd, bool zeroLocalScope = true)
+    {
+        RunRange(pProgram, state, BindAoS(pProgram, pGlobalScope, pWorkScopes, workScopeSize), workScopeBegin, workScopeEnd, zeroLocalScope);
+    }
+
+    // Runs inline
+    inline void Run(const Program *pProgram, void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount = 1, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        WorkerState state{};
+        RunRange(pProgram, state, pGlobalScope, pWorkScopes, workScopeSize, 0U, workScopeCount, zeroLocalScope);
+        CollectRetired(state, pRetired);
+    }
+
+    // Runs inline over a [ WorkScope[SoA] ], pColumns holds one column per declared field
+    inline void Run(const Program *pProgram, void *pGlobalScope, const Column *pColumns, uint64_t workScopeCount = 1, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        WorkerState state{};
+        RunRange(pProgram, state, BindSoA(pProgram, pGlobalScope, pColumns), 0U, workScopeCount, zeroLocalScope);
+        CollectRetired(state, pRetired);
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Work unit compaction
+    // Units that took a VM::RetireConditional are dead, compaction moves live units over them so later runs only pay
+    // for the live ones. Retired lists may be unsorted and hold duplicates, they are consumed and left empty.
+    // NOTE(tomas): SoA columns are assumed packed, every column moves stride bytes per work unit
+    enum class CompactionMode : uint8_t
+    {
+        SwapRemove, // Moves the last live unit in to every hole, touches only retired units, does not keep order
+        Stream      // Slides every live unit down, keeps order, touches everything after the first retired unit
+    };
+
+    // Copies work unit src over work unit dst in every work scope
+    inline void MoveWorkUnit(const ScopeBinding &binding, uint64_t dst, uint64_t src) noexcept
+    {
+        for(uint32_t s = binding.firstWorkScope; s < binding.lastWorkScope; ++s)
+            std::memcpy(binding.pScopes[s] + dst * binding.strides[s], binding.pScopes[s] + src * binding.strides[s], binding.strides[s]);
+    }
+
+    // Returns the live work unit count, live units end up in [0, count)
+    inline uint64_t Compact(const ScopeBinding &binding, uint64_t workScopeCount, std::vector<uint64_t> &retired, CompactionMode mode = CompactionMode::SwapRemove)
+    {
+        std::sort(retired.begin(), retired.end());
+        retired.erase(std::unique(retired.begin(), retired.end()), retired.end());
+
+        while (!retired.empty() && retired.back() >= workScopeCount)
+            retired.pop_back();
+
+        if(retired.empty())
+            return workScopeCount;
+
+        uint64_t liveCount = workScopeCount;
+
+        if(mode == CompactionMode::SwapRemove)
+        {
+            // Back to front, everything past the current hole is already live
+            for(auto it = retired.rbegin(); it != retired.rend(); ++it)
+            {
+                --liveCount;
+                if(*it != liveCount)
+                    MoveWorkUnit(binding, *it, liveCount);
+            }
+        }
+        else
+        {
+            uint64_t write = retired.front();
+            auto next = retired.begin();
+
+            for(uint64_t read = retired.front(); read < workScopeCount; ++read)
+            {
+                if(next != retired.end() && *next == read)
+                {
+                    ++next;
+                    continue;
+                }
+
+                MoveWorkUnit(binding, write++, read);
+            }
+
+            liveCount = write;
+        }
+
+        retired.clear();
+        return liveCount;
+    }
+
+    inline uint64_t Compact(void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount, std::vector<uint64_t> &retired, CompactionMode mode = CompactionMode::SwapRemove)
+    {
+        return Compact(ScopeBinding::AoS(nullptr, pWorkScopes, workScopeSize), workScopeCount, retired, mode);
+    }
+
+    inline uint64_t Compact(const Column *pColumns, uint64_t columnCount, uint64_t workScopeCount, std::vector<uint64_t> &retired, CompactionMode mode = CompactionMode::SwapRemove)
+    {
+        return Compact(ScopeBinding::SoA(nullptr, pColumns, columnCount), workScopeCount, retired, mode);
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Executor
+    // Keeps a program, its scope binding and worker state alive between calls, so running a frame allocates nothing.
+    #ifndef PAR_BLOCK_BYTES
+        #define PAR_BLOCK_BYTES (128U * 1024U)  // Work scope bytes RunFrames keeps hot at once, sized to sit in L2
+    #endif
+
+    class Executor
+    {
+    public:
+        explicit Executor(const Program *pProgram, uint64_t blockBytes = PAR_BLOCK_BYTES) : m_pProgram(pProgram), m_BlockBytes(std::max<uint64_t>(blockBytes, 1U))
+        {
+            // Sized once up front, running never has to grow it
+            m_State.LocalScope(pProgram->localScopeSize);
+        }
+
+        void Bind(const ScopeBinding &binding, uint64_t workScopeCount) noexcept
+        {
+            m_Binding = binding;
+            m_WorkScopeCount = workScopeCount;
+        }
+
+        void Bind(void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount)
+        {
+            Bind(BindAoS(m_pProgram, pGlobalScope, pWorkScopes, workScopeSize), workScopeCount);
+        }
+
+        void Bind(void *pGlobalScope, const Column *pColumns, uint64_t workScopeCount)
+        {
+            Bind(BindSoA(m_pProgram, pGlobalScope, pColumns), workScopeCount);
+        }
+
+        // One frame over every bound work unit
+        void Run(bool zeroLocalScope = true)
+        {
+            RunRange(m_pProgram, m_State, m_Binding, 0U, m_WorkScopeCount, zeroLocalScope);
+        }
+
+        // frameCount frames over every bound work unit. The work units are cut in to blocks of about blockBytes
+        // and every block runs all frames before the next one is touched, so the block stays in cache between frames.
+        // NOTE(tomas): this reorders work units across frames, the result only matches calling Run frameCount times
+        // when units don't read what other units write to the global scope, counters and the like are fine.
+        // A unit that retires keeps running the remaining frames of its block, its contents are dead either way
+        void RunFrames(uint64_t frameCount, bool zeroLocalScope = true)
+        {
+            if(frameCount == 0U || m_WorkScopeCount == 0U)
+                return;
+
+            uint64_t blockSize = BlockSize();
+
+            for(uint64_t begin = 0U; begin < m_WorkScopeCount; begin += blockSize)
+            {
+                uint64_t end = std::min(begin + blockSize, m_WorkScopeCount);
+
+                for(uint64_t frame = 0U; frame < frameCount; ++frame)
+                    RunRange(m_pProgram, m_State, m_Binding, begin, end, zeroLocalScope);
+            }
+        }
+
+        // Drops every unit retired since the last compaction, returns the live count later runs cover
+        uint64_t Compact(CompactionMode mode = CompactionMode::SwapRemove)
+        {
+            m_WorkScopeCount = ParVm::Compact(m_Binding, m_WorkScopeCount, m_State.retired, mode);
+            return m_WorkScopeCount;
+        }
+
+        [[nodiscard]] uint64_t LiveCount() const noexcept { return m_WorkScopeCount; }
+
+        // Work units per temporal block
+        [[nodiscard]] uint64_t BlockSize() const noexcept
+        {
+            uint64_t unitBytes = 0U;
+            for(uint32_t s = m_Binding.firstWorkScope; s < m_Binding.lastWorkScope; ++s)
+                unitBytes += m_Binding.strides[s];
+
+            return std::max<uint64_t>(m_BlockBytes / std::max<uint64_t>(unitBytes, 1U), 1U);
+        }
+
+        [[nodiscard]] const Program *GetProgram() const noexcept { return m_pProgram; }
+        [[nodiscard]] WorkerState &State() noexcept { return m_State; }
+
+    private:
+        const Program *m_pProgram;
+        uint64_t m_BlockBytes;
+
+        ScopeBinding m_Binding{};
+        uint64_t m_WorkScopeCount = 0U;
+        WorkerState m_State{};
+    };
+
+    ////////////////////////////////////////////////////////////////
+    // Wide interpreter
+    // Decodes every instruction once and applies it to a group of PAR_LANES work units.
+    // Lane loops are kept branch light so the compiler can lower them to SSE/AVX2/AVX-512.
+    #ifndef PAR_LANES
+        #if defined(__AVX512F__)
+            #define PAR_LANES 16
+        #else
+            #define PAR_LANES 8
+        #endif
+    #endif
+
+    static_assert(PAR_LANES > 0 && PAR_LANES <= 32, "PAR_LANES must fit in the 32 bit active mask");
+
+    // Same as WorkerState, with one local scope per lane
+    struct WideWorkerState : WorkerState
+    {
+        std::vector<uint32_t> parked{};     // Lanes waiting at a label, indexed by the label's program counter. All zero between runs
+    };
+
+    #define LaneOperand(Name, OpIdx) \
+        uint8_t *Name = Address(OpIdx); \
+        const uint64_t Name##Stride = laneStrides[ScopeOf(OpIdx)];
+    #define LaneUnary(Type, Expr) \
+        LaneOperand(pDst, 0U) \
+        for(uint32_t lane = 0U; lane < PAR_LANES; ++lane) { \
+            if(activeMask & (1U << lane)) { auto* l = (Type*)(pDst + lane * pDstStride); Expr; } }
+    #define LaneBinary(DstType, SrcType, Op) \
+        LaneOperand(pDst, 0U) LaneOperand(pLhs, 1U) LaneOperand(pRhs, 2U) \
+        if(activeMask == fullMask && pDstStride != 0U) { \
+            for(uint32_t lane = 0U; lane < PAR_LANES; ++lane) \
+                *(DstType*)(pDst + lane * pDstStride) = *(SrcType*)(pLhs + lane * pLhsStride) Op *(SrcType*)(pRhs + lane * pRhsStride); } \
+        else { \
+            for(uint32_t lane = 0U; lane < PAR_LANES; ++lane) \
+                if(activeMask & (1U << lane)) *(DstType*)(pDst + lane * pDstStride) = *(SrcType*)(pLhs + lane * pLhsStride) Op *(SrcType*)(pRhs + lane * pRhsStride); }
+    #define LaneAddress(Name) (Name + lane * Name##Stride)
+    #define LaneLoop(Expr) \
+        for(uint32_t lane = 0U; lane < PAR_LANES; ++lane) \
+            if(activeMask & (1U << lane)) { Expr; }
+    #define LaneMinMax(Type, Op) \
+        LaneOperand(pDst, 0U) LaneOperand(pLhs, 1U) LaneOperand(pRhs, 2U) \
+        for(uint32_t lane = 0U; lane < PAR_LANES; ++lane) { \
+            if(activeMask & (1U << lane)) { \
+                Type l = *(Type*)(pLhs + lane * pLhsStride), r = *(Type*)(pRhs + lane * pRhsStride); \
+                *(Type*)(pDst + lane * pDstStride) = l Op r ? l : r; } }
+    #define LaneHalt(Op) \
+        LaneOperand(pLhs, 0U) LaneOperand(pRhs, 1U) \
+        for(uint32_t lane = 0U; lane < PAR_LANES; ++lane) \
+            if((activeMask & (1U << lane)) && *(float*)(pLhs + lane * pLhsStride) Op *(float*)(pRhs + lane * pRhsStride)) \
+                activeMask &= ~(1U << lane); \
+        if(activeMask == 0U) \
+            goto *opLut[0];
+
+    // Runs the work units in [workScopeBegin, workScopeEnd) on the calling thread, PAR_LANES at a time.
+    // Instructions execute in lock step across lanes, VM::HaltConditional clears the lane from the active mask.
+    // Lanes that take a VM::JumpConditional are parked on their label and join back in once the others get there,
+    // jumps only go forward so the group still walks the program once from top to bottom.
+    // NOTE(tomas): global scope writes happen instruction by instruction for every active lane, not unit by unit
+    template<typename OffsetT>
+    inline void RunWideRangeImpl(const Program *pProgram, WideWorkerState &state, ScopeBinding binding, uint64_t workScopeBegin, uint64_t workScopeEnd, bool zeroLocalScope)
+    {
+        ////////////////////////////////////////////////////////////////
+        // Setup part Virtual machine
+        if(workScopeBegin >= workScopeEnd)
+            return;
+
+        const uint8_t *pCode = pProgram->pCode;
+        const uint64_t localScopeSize = pProgram->localScopeSize;
+        uint64_t programCounter = state.programCounter;
+        uint64_t groupIdx = workScopeBegin;
+
+        binding.Advance(groupIdx);
+        binding.pScopes[LOCAL_SCOPE] = state.LocalScope(localScopeSize * PAR_LANES);
+        binding.pScopes[CONSTANT_SCOPE] = pProgram->Constants();
+        auto& pScopes = binding.pScopes;
+
+        // Distance between two lanes in every scope, the global scope and the constants are shared
+        auto laneStrides = binding.strides;
+        laneStrides[GLOBAL_SCOPE] = 0U;
+        laneStrides[CONSTANT_SCOPE] = 0U;
+        laneStrides[LOCAL_SCOPE] = localScopeSize;
+
+        const auto LaneMask = [](uint64_t remaining) -> uint32_t {
+            return (uint32_t)((1ULL << std::min<uint64_t>(remaining, PAR_LANES)) - 1U);
+        };
+
+        constexpr uint32_t fullMask = (uint32_t)((1ULL << PAR_LANES) - 1U);
+        uint32_t activeMask = LaneMask(workScopeEnd - groupIdx);
+
+        // Every lane parked anywhere
+        uint32_t parkedMask = 0U;
+        if(state.parked.size() < pProgram->codeSize)
+            state.parked.resize(pProgram->codeSize, 0U);
+
+        uint32_t *pParked = state.parked.data();
+
+        if(zeroLocalScope)
+            std::memset(pScopes[LOCAL_SCOPE], 0, localScopeSize * PAR_LANES);
+
+        static constexpr void* opLut[] = {
+            &&PAR_HALT,
+            &&INC_FLOAT,
+            &&DEC_FLOAT,
+            &&ADD_FLOAT,
+            &&SUB_FLOAT,
+            &&MUL_FLOAT,
+            &&INC_INT,
+            &&DEC_INT,
+            &&INC_UINT,
+            &&DEC_UINT,
+            &&ADD_INT,
+            &&SUB_INT,
+            &&MUL_INT,
+            &&PAR_HALT_CONDITIONAL,
+            &&BIGGER_THAN_FLOAT,
+            &&SMALLER_THAN_FLOAT,
+            &&MAD_FLOAT,
+            &&HALT_BIGGER_THAN_FLOAT,
+            &&HALT_SMALLER_THAN_FLOAT,
+            &&PAR_RETIRE_CONDITIONAL,
+            &&SELECT,
+            &&MIN_FLOAT,
+            &&MAX_FLOAT,
+            &&MIN_INT,
+            &&MAX_INT,
+            &&PAR_LABEL,
+            &&PAR_JUMP_CONDITIONAL,
+            &&ADD_VEC3,
+            &&SUB_VEC3,
+            &&SCALE_VEC3,
+            &&MAD_VEC3,
+            &&DOT_VEC3,
+            &&LENGTH_VEC3
+        };
+
+        ////////////////////////////////////////////////////////////////
+        // Start pars Virtual machine
+        goto *opLut[pCode[programCounter]];
+
+        ////////////////////////////////////////////////////////////////
+        // VM Instructions
+        DeclareOp(PAR_HALT, 0, // PAR_HALT
+                // The lanes that got here are done, parked ones carry on from the first label they wait at
+                if(parkedMask != 0U) {
+                    activeMask = 0U;
+                    do { ++programCounter; } while (pParked[programCounter] == 0U);
+                    goto *opLut[pCode[programCounter]];
+                }
+
+                groupIdx += PAR_LANES;
+                programCounter = 0U;
+
+                if(groupIdx >= workScopeEnd) {
+                    state.programCounter = 0U;
+                    return;
+                }
+                else {
+                    // Advance lane group
+                    binding.Advance(PAR_LANES);
+                    activeMask = LaneMask(workScopeEnd - groupIdx);
+
+                    if(zeroLocalScope)
+                        std::memset(pScopes[LOCAL_SCOPE], 0, localScopeSize * PAR_LANES);
+
+                    goto *opLut[pCode[programCounter]];
+                });
+
+        DeclareOp(PAR_HALT_CONDITIONAL, 1, {
+                LaneOperand(pCondition, 0U)
+                for(uint32_t lane = 0U; lane < PAR_LANES; ++lane)
+                    if((activeMask & (1U << lane)) && *(bool*)(pCondition + lane * pConditionStride))
+                        activeMask &= ~(1U << lane);
+
+                // Every lane halted, no point in dispatching the rest of the group
+                if(activeMask == 0U)
+                    goto *opLut[0];
+                });
+
+        DeclareOp(PAR_RETIRE_CONDITIONAL, 1, {
+                LaneOperand(pCondition, 0U)
+                for(uint32_t lane = 0U; lane < PAR_LANES; ++lane)
+                {
+                    if((activeMask & (1U << lane)) && *(bool*)(pCondition + lane * pConditionStride))
+                    {
+                        activeMask &= ~(1U << lane);
+                        state.retired.push_back(groupIdx + lane);
+                    }
+                }
+
+                if(activeMask == 0U)
+                    goto *opLut[0];
+                });
+
+        DeclareOp(PAR_LABEL, 0, {
+                if(parkedMask != 0U) {
+                    activeMask |= pParked[programCounter];
+                    parkedMask &= ~pParked[programCounter];
+                    pParked[programCounter] = 0U;
+                }});
+
+        DeclareOp(PAR_JUMP_CONDITIONAL, 2, {
+                LaneOperand(pCondition, 0U)
+                uint32_t taken = 0U;
+                for(uint32_t lane = 0U; lane < PAR_LANES; ++lane)
+                    if((activeMask & (1U << lane)) && *(bool*)(pCondition + lane * pConditionStride))
+                        taken |= 1U << lane;
+
+                if(taken != 0U) {
+                    uint64_t target = ReadOffset<OffsetT>(pCode + programCounter + 2U + OperandBytes);
+
+                    // The whole group jumps and nobody waits in between, no need to park
+                    if(taken == activeMask && parkedMask == 0U) {
+                        programCounter = target;
+                        goto *opLut[pCode[programCounter]];
+                    }
+
+                    pParked[target] |= taken;
+                    parkedMask |= taken;
+                    activeMask &= ~taken;
+
+                    // Nobody left on this path, PAR_HALT moves on to the first parked label
+                    if(activeMask == 0U)
+                        goto *opLut[0];
+                }});
+
+        ////////////////////////////////////////////////////////////////
+        // Branch free selection
+        DeclareOp(SELECT, 4, {
+                LaneOperand(pDst, 0U) LaneOperand(pCondition, 1U) LaneOperand(pLhs, 2U) LaneOperand(pRhs, 3U)
+                for(uint32_t lane = 0U; lane < PAR_LANES; ++lane)
+                    if(activeMask & (1U << lane))
+                        *(uint32_t*)(pDst + lane * pDstStride) = *(bool*)(pCondition + lane * pConditionStride) ?
+                            *(uint32_t*)(pLhs + lane * pLhsStride) : *(uint32_t*)(pRhs + lane * pRhsStride);
+                });
+
+        ////////////////////////////////////////////////////////////////
+        // Floating point arithmetic instructions
+        DeclareOp(INC_FLOAT,                1, { LaneUnary(float, *l += 1.f) });
+        DeclareOp(DEC_FLOAT,                1, { LaneUnary(float, *l -= 1.f) });
+        DeclareOp(ADD_FLOAT,                3, { LaneBinary(float, float, +) });
+        DeclareOp(SUB_FLOAT,                3, { LaneBinary(float, float, -) });
+        DeclareOp(MUL_FLOAT,                3, { LaneBinary(float, float, *) });
+        DeclareOp(BIGGER_THAN_FLOAT,        3, { LaneBinary(bool, float, >) });
+        DeclareOp(SMALLER_THAN_FLOAT,       3, { LaneBinary(bool, float, <) });
+        DeclareOp(MAD_FLOAT,                4, {
+                LaneOperand(pDst, 0U) LaneOperand(pLhs, 1U) LaneOperand(pRhs, 2U) LaneOperand(pAdd, 3U)
+                for(uint32_t lane = 0U; lane < PAR_LANES; ++lane)
+                    if(activeMask & (1U << lane))
+                        *(float*)(pDst + lane * pDstStride) = *(float*)(pLhs + lane * pLhsStride) * *(float*)(pRhs + lane * pRhsStride) + *(float*)(pAdd + lane * pAddStride);
+                });
+        DeclareOp(MIN_FLOAT,                3, { LaneMinMax(float, <) });
+        DeclareOp(MAX_FLOAT,                3, { LaneMinMax(float, >) });
+        DeclareOp(HALT_BIGGER_THAN_FLOAT,   2, { LaneHalt(>) });
+        DeclareOp(HALT_SMALLER_THAN_FLOAT,  2, { LaneHalt(<) });
+
+        ////////////////////////////////////////////////////////////////
+        // Integer arithmetic instructions
+        DeclareOp(INC_INT,                  1, { LaneUnary(int, *l += 1) });
+        DeclareOp(DEC_INT,                  1, { LaneUnary(int, *l -= 1) });
+        DeclareOp(INC_UINT,                 1, { LaneUnary(unsigned int, *l += 1U) });
+        DeclareOp(DEC_UINT,                 1, { LaneUnary(unsigned int, *l -= 1U) });
+        DeclareOp(ADD_INT,                  3, { LaneBinary(int, int, +) });
+        DeclareOp(SUB_INT,                  3, { LaneBinary(int, int, -) });
+        DeclareOp(MUL_INT,                  3, { LaneBinary(int, int, *) });
+        DeclareOp(MIN_INT,                  3, { LaneMinMax(int, <) });
+        DeclareOp(MAX_INT,                  3, { LaneMinMax(int, >) });
+
+        ////////////////////////////////////////////////////////////////
+        // Field group instructions
+        DeclareOp(ADD_VEC3,                 3, { LaneOperand(pDst, 0U) LaneOperand(pA, 1U) LaneOperand(pB, 2U) LaneLoop(AddVec3(LaneAddress(pDst), LaneAddress(pA), LaneAddress(pB))) });
+        DeclareOp(SUB_VEC3,                 3, { LaneOperand(pDst, 0U) LaneOperand(pA, 1U) LaneOperand(pB, 2U) LaneLoop(SubVec3(LaneAddress(pDst), LaneAddress(pA), LaneAddress(pB))) });
+        DeclareOp(SCALE_VEC3,               3, { LaneOperand(pDst, 0U) LaneOperand(pA, 1U) LaneOperand(pS, 2U) LaneLoop(ScaleVec3(LaneAddress(pDst), LaneAddress(pA), LaneAddress(pS))) });
+        DeclareOp(MAD_VEC3,                 4, { LaneOperand(pDst, 0U) LaneOperand(pA, 1U) LaneOperand(pS, 2U) LaneOperand(pB, 3U) LaneLoop(MadVec3(LaneAddress(pDst), LaneAddress(pA), LaneAddress(pS), LaneAddress(pB))) });
+        DeclareOp(DOT_VEC3,                 3, { LaneOperand(pDst, 0U) LaneOperand(pA, 1U) LaneOperand(pB, 2U) LaneLoop(DotVec3(LaneAddress(pDst), LaneAddress(pA), LaneAddress(pB))) });
+        DeclareOp(LENGTH_VEC3,              2, { LaneOperand(pDst, 0U) LaneOperand(pA, 1U) LaneLoop(LengthVec3(LaneAddress(pDst), LaneAddress(pA))) });
+    }
+
+    inline void RunWideRange(const Program *pProgram, WideWorkerState &state, const ScopeBinding &binding, uint64_t workScopeBegin, uint64_t workScopeEnd, bool zeroLocalScope = true)
+    {
+        CheckLocalScope(pProgram, zeroLocalScope);
+
+        // Host calls already batch the work units, those programs run on the scalar interpreter
+        if(pProgram->hostCalls != 0U)
+        {
+            RunRange(pProgram, state, binding, workScopeBegin, workScopeEnd, zeroLocalScope);
+            return;
+        }
+
+        if(pProgram->reductionCount != 0U && binding.pScopes[REDUCTION_SCOPE] == nullptr)
+        {
+            ScopeBinding reduced = binding;
+            reduced.pScopes[REDUCTION_SCOPE] = ResetReductions(state.reductionScope, pProgram->Reductions(), pProgram->reductionCount, binding.pScopes[GLOBAL_SCOPE]);
+            RunWideRange(pProgram, state, reduced, workScopeBegin, workScopeEnd, zeroLocalScope);
+            MergeReductions(pProgram->Reductions(), pProgram->reductionCount, binding.pScopes[GLOBAL_SCOPE], reduced.pScopes[REDUCTION_SCOPE]);
+            return;
+        }
+
+        switch (pProgram->offsetSize)
+        {
+            case sizeof(uint8_t):   RunWideRangeImpl<uint8_t>(pProgram, state, binding, workScopeBegin, workScopeEnd, zeroLocalScope); break;
+            case sizeof(uint16_t):  RunWideRangeImpl<uint16_t>(pProgram, state, binding, workScopeBegin, workScopeEnd, zeroLocalScope); break;
+            case sizeof(uint32_t):  RunWideRangeImpl<uint32_t>(pProgram, state, binding, workScopeBegin, workScopeEnd, zeroLocalScope); break;
+            default: throw std::runtime_error("Unsupported operand offset size...");
+        }
+    }
+
+    // Runs inline, PAR_LANES work units per dispatch
+    inline void RunWide(const Program *pProgram, void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount = 1, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        WideWorkerState state{};
+        RunWideRange(pProgram, state, BindAoS(pProgram, pGlobalScope, pWorkScopes, workScopeSize), 0U, workScopeCount, zeroLocalScope);
+        CollectRetired(state, pRetired);
+    }
+
+    // Runs inline over a [ WorkScope[SoA] ], PAR_LANES work units per dispatch
+    inline void RunWide(const Program *pProgram, void *pGlobalScope, const Column *pColumns, uint64_t workScopeCount = 1, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        WideWorkerState state{};
+        RunWideRange(pProgram, state, BindSoA(pProgram, pGlobalScope, pColumns), 0U, workScopeCount, zeroLocalScope);
+        CollectRetired(state, pRetired);
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Direct threaded interpreter
+    // The program is decoded once in to fixed width instructions. Every run binds it to a stream of
+    // handler addresses and operand addresses, an operand is resolved with a single multiply add:
+    //      address = base + workUnitIdx * stride
+    // where the stride is 0 for the global and local scopes. The stream only depends on the scope binding,
+    // so it's cached on the worker state and rebuilt only when the program or the binding changes.
+    struct DecodedProgram
+    {
+        std::vector<Instruction> instructions{};
+        std::vector<uint8_t> constants{};   // Copy of the constant pool, the base of CONSTANT_SCOPE
+        std::vector<Reduction> reductions{};
+        uint64_t localScopeSize     = 0U;
+        uint64_t workScopeColumns   = 0U;
+        bool scratchLocals          = false;
+    };
+
+    [[nodiscard]] inline DecodedProgram Decode(const Program *pProgram)
+    {
+        if(pProgram->hostCalls != 0U)
+            throw std::runtime_error("Programs with host calls run on the bytecode interpreters, not the threaded one...");
+
+        DecodedProgram decoded{};
+        decoded.instructions = Disassemble(pProgram);
+        decoded.constants.assign(pProgram->Constants(), pProgram->Constants() + pProgram->ConstantsSize());
+        decoded.reductions.assign(pProgram->Reductions(), pProgram->Reductions() + pProgram->reductionCount);
+        decoded.localScopeSize = pProgram->localScopeSize;
+        decoded.workScopeColumns = pProgram->workScopeColumns;
+        decoded.scratchLocals = pProgram->scratchLocals;
+        return decoded;
+    }
+
+    union ThreadedSlot
+    {
+        const void *pHandler;
+        uint8_t *pBase;
+        uint64_t stride;
+    };
+
+    struct ThreadedWorkerState : WorkerState
+    {
+        std::vector<ThreadedSlot> code{};
+        const DecodedProgram *pBoundProgram = nullptr;
+        std::array<uint8_t*, PAR_MAX_SCOPES> boundScopes{};
+        std::array<uint64_t, PAR_MAX_SCOPES> boundStrides{};
+    };
+
+    inline void RunRange(const DecodedProgram *pProgram, ThreadedWorkerState &state, ScopeBinding binding, uint64_t workScopeBegin, uint64_t workScopeEnd, bool zeroLocalScope = true)
+    {
+        #define ThreadedAddress(OpIdx)  (ip[1U + (OpIdx) * 2U].pBase + workUnitIdx * ip[2U + (OpIdx) * 2U].stride)
+        #define ThreadedOp(OpName, OperandCount, Code) OpName:{Code} ip += 1U + (OperandCount) * 2U; goto *ip->pHandler;
+
+        CheckLocalScope(pProgram, zeroLocalScope);
+
+        if(workScopeBegin >= workScopeEnd)
+            return;
+
+        if(!pProgram->reductions.empty() && binding.pScopes[REDUCTION_SCOPE] == nullptr)
+        {
+            const Reduction *pReductions = pProgram->reductions.data();
+            binding.pScopes[REDUCTION_SCOPE] = ResetReductions(state.reductionScope, pReductions, pProgram->reductions.size(), binding.pScopes[GLOBAL_SCOPE]);
+            RunRange(pProgram, state, binding, workScopeBegin, workScopeEnd, zeroLocalScope);
+            MergeReductions(pReductions, pProgram->reductions.size(), binding.pScopes[GLOBAL_SCOPE], binding.pScopes[REDUCTION_SCOPE]);
+            return;
+        }
+
+        static constexpr void* opLut[] = {
+            &&PAR_HALT,
+            &&INC_FLOAT,
+            &&DEC_FLOAT,
+            &&ADD_FLOAT,
+            &&SUB_FLOAT,
+            &&MUL_FLOAT,
+            &&INC_INT,
+            &&DEC_INT,
+            &&INC_UINT,
+            &&DEC_UINT,
+            &&ADD_INT,
+            &&SUB_INT,
+            &&MUL_INT,
+            &&PAR_HALT_CONDITIONAL,
+            &&BIGGER_THAN_FLOAT,
+            &&SMALLER_THAN_FLOAT,
+            &&MAD_FLOAT,
+            &&HALT_BIGGER_THAN_FLOAT,
+            &&HALT_SMALLER_THAN_FLOAT,
+            &&PAR_RETIRE_CONDITIONAL,
+            &&SELECT,
+            &&MIN_FLOAT,
+            &&MAX_FLOAT,
+            &&MIN_INT,
+            &&MAX_INT,
+            &&PAR_LABEL,
+            &&PAR_JUMP_CONDITIONAL,
+            &&ADD_VEC3,
+            &&SUB_VEC3,
+            &&SCALE_VEC3,
+            &&MAD_VEC3,
+            &&DOT_VEC3,
+            &&LENGTH_VEC3
+        };
+
+        const uint64_t localScopeSize = pProgram->localScopeSize;
+        binding.pScopes[LOCAL_SCOPE] = state.LocalScope(localScopeSize);
+        binding.pScopes[CONSTANT_SCOPE] = const_cast<uint8_t*>(pProgram->constants.data());
+
+        ////////////////////////////////////////////////////////////////
+        // Bind, only when something changed since the last run on this worker
+        if(state.pBoundProgram != pProgram || state.boundScopes != binding.pScopes || state.boundStrides != binding.strides)
+        {
+            state.code.clear();
+
+            // Jump targets hold the label index until every label has a slot, then the slot index
+            std::vector<uint64_t> labelSlots{};
+            std::vector<uint64_t> jumpSlots{};
+
+            for(const auto& instruction : pProgram->instructions)
+            {
+                if(instruction.opCode == OpCode::PAR_LABEL)
+                    labelSlots.push_back(state.code.size());
+
+                state.code.push_back(ThreadedSlot{ .pHandler = opLut[(uint8_t)instruction.opCode] });
+
+                for(const auto& [scope, offset] : instruction.operands)
+                {
+                    if(scope == CODE_SCOPE)
+                    {
+                        state.code.push_back(ThreadedSlot{ .pBase = nullptr });
+                        jumpSlots.push_back(state.code.size());
+                        state.code.push_back(ThreadedSlot{ .stride = offset });
+                        continue;
+                    }
+
+                    bool advances = scope >= binding.firstWorkScope && scope < binding.lastWorkScope;
+                    state.code.push_back(ThreadedSlot{ .pBase = binding.pScopes[scope] + offset });
+                    state.code.push_back(ThreadedSlot{ .stride = advances ? binding.strides[scope] : 0U });
+                }
+            }
+
+            for(uint64_t slot : jumpSlots)
+                state.code[slot].stride = labelSlots[state.code[slot].stride];
+
+            state.pBoundProgram = pProgram;
+            state.boundScopes = binding.pScopes;
+            state.boundStrides = binding.strides;
+        }
+
+        ////////////////////////////////////////////////////////////////
+        // Start pars Virtual machine
+        uint64_t workUnitIdx = workScopeBegin;
+        const ThreadedSlot *pStart = state.code.data();
+        const ThreadedSlot *ip = pStart;
+
+        if(zeroLocalScope)
+            std::memset(binding.pScopes[LOCAL_SCOPE], 0, localScopeSize);
+
+        goto *ip->pHandler;
+
+        ThreadedOp(PAR_HALT, 0,
+                ++workUnitIdx;
+                ip = pStart;
+
+                if(workUnitIdx >= workScopeEnd)
+                    return;
+
+                if(zeroLocalScope)
+                    std::memset(binding.pScopes[LOCAL_SCOPE], 0, localScopeSize);
+
+                goto *ip->pHandler;
+                );
+
+        ThreadedOp(PAR_HALT_CONDITIONAL,        1, { if(*(bool*)ThreadedAddress(0U)) goto PAR_HALT; });
+        ThreadedOp(PAR_RETIRE_CONDITIONAL,      1, { if(*(bool*)ThreadedAddress(0U)) { state.retired.push_back(workUnitIdx); goto PAR_HALT; } });
+        ThreadedOp(PAR_LABEL,                   0, {});
+        ThreadedOp(PAR_JUMP_CONDITIONAL,        2, { if(*(bool*)ThreadedAddress(0U)) { ip = pStart + ip[4U].stride; goto *ip->pHandler; } });
+        ThreadedOp(SELECT,                      4, { *(uint32_t*)ThreadedAddress(0U) = *(bool*)ThreadedAddress(1U) ? *(uint32_t*)ThreadedAddress(2U) : *(uint32_t*)ThreadedAddress(3U); });
+
+        ThreadedOp(INC_FLOAT,                   1, { *(float*)ThreadedAddress(0U) += 1.f; });
+        ThreadedOp(DEC_FLOAT,                   1, { *(float*)ThreadedAddress(0U) -= 1.f; });
+        ThreadedOp(ADD_FLOAT,                   3, { *(float*)ThreadedAddress(0U) = *(float*)ThreadedAddress(1U) + *(float*)ThreadedAddress(2U); });
+        ThreadedOp(SUB_FLOAT,                   3, { *(float*)ThreadedAddress(0U) = *(float*)ThreadedAddress(1U) - *(float*)ThreadedAddress(2U); });
+        ThreadedOp(MUL_FLOAT,                   3, { *(float*)ThreadedAddress(0U) = *(float*)ThreadedAddress(1U) * *(float*)ThreadedAddress(2U); });
+        ThreadedOp(BIGGER_THAN_FLOAT,           3, { *(bool*)ThreadedAddress(0U) = *(float*)ThreadedAddress(1U) > *(float*)ThreadedAddress(2U); });
+        ThreadedOp(SMALLER_THAN_FLOAT,          3, { *(bool*)ThreadedAddress(0U) = *(float*)ThreadedAddress(1U) < *(float*)ThreadedAddress(2U); });
+        ThreadedOp(MAD_FLOAT,                   4, { *(float*)ThreadedAddress(0U) = *(float*)ThreadedAddress(1U) * *(float*)ThreadedAddress(2U) + *(float*)ThreadedAddress(3U); });
+        ThreadedOp(MIN_FLOAT,                   3, { float a = *(float*)ThreadedAddress(1U); float b = *(float*)ThreadedAddress(2U); *(float*)ThreadedAddress(0U) = a < b ? a : b; });
+        ThreadedOp(MAX_FLOAT,                   3, { float a = *(float*)ThreadedAddress(1U); float b = *(float*)ThreadedAddress(2U); *(float*)ThreadedAddress(0U) = a > b ? a : b; });
+        ThreadedOp(HALT_BIGGER_THAN_FLOAT,      2, { if(*(float*)ThreadedAddress(0U) > *(float*)ThreadedAddress(1U)) goto PAR_HALT; });
+        ThreadedOp(HALT_SMALLER_THAN_FLOAT,     2, { if(*(float*)ThreadedAddress(0U) < *(float*)ThreadedAddress(1U)) goto PAR_HALT; });
+
+        ThreadedOp(INC_INT,                     1, { *(int*)ThreadedAddress(0U) += 1; });
+        ThreadedOp(DEC_INT,                     1, { *(int*)ThreadedAddress(0U) -= 1; });
+        ThreadedOp(INC_UINT,                    1, { *(unsigned int*)ThreadedAddress(0U) += 1U; });
+        ThreadedOp(DEC_UINT,                    1, { *(unsigned int*)ThreadedAddress(0U) -= 1U; });
+        ThreadedOp(ADD_INT,                     3, { *(int*)ThreadedAddress(0U) = *(int*)ThreadedAddress(1U) + *(int*)ThreadedAddress(2U); });
+        ThreadedOp(SUB_INT,                     3, { *(int*)ThreadedAddress(0U) = *(int*)ThreadedAddress(1U) - *(int*)ThreadedAddress(2U); });
+        ThreadedOp(MUL_INT,                     3, { *(int*)ThreadedAddress(0U) = *(int*)ThreadedAddress(1U) * *(int*)ThreadedAddress(2U); });
+        ThreadedOp(MIN_INT,                     3, { int a = *(int*)ThreadedAddress(1U); int b = *(int*)ThreadedAddress(2U); *(int*)ThreadedAddress(0U) = a < b ? a : b; });
+        ThreadedOp(MAX_INT,                     3, { int a = *(int*)ThreadedAddress(1U); int b = *(int*)ThreadedAddress(2U); *(int*)ThreadedAddress(0U) = a > b ? a : b; });
+
+        ThreadedOp(ADD_VEC3,                    3, { AddVec3(ThreadedAddress(0U), ThreadedAddress(1U), ThreadedAddress(2U)); });
+        ThreadedOp(SUB_VEC3,                    3, { SubVec3(ThreadedAddress(0U), ThreadedAddress(1U), ThreadedAddress(2U)); });
+        ThreadedOp(SCALE_VEC3,                  3, { ScaleVec3(ThreadedAddress(0U), ThreadedAddress(1U), ThreadedAddress(2U)); });
+        ThreadedOp(MAD_VEC3,                    4, { MadVec3(ThreadedAddress(0U), ThreadedAddress(1U), ThreadedAddress(2U), ThreadedAddress(3U)); });
+        ThreadedOp(DOT_VEC3,                    3, { DotVec3(ThreadedAddress(0U), ThreadedAddress(1U), ThreadedAddress(2U)); });
+        ThreadedOp(LENGTH_VEC3,                 2, { LengthVec3(ThreadedAddress(0U), ThreadedAddress(1U)); });
+    }
+
+    // Runs inline
+    inline void Run(const DecodedProgram *pProgram, void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount = 1, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        ThreadedWorkerState state{};
+        RunRange(pProgram, state, BindAoS(pProgram, pGlobalScope, pWorkScopes, workScopeSize), 0U, workScopeCount, zeroLocalScope);
+        CollectRetired(state, pRetired);
+    }
+
+    // Runs inline over a [ WorkScope[SoA] ]
+    inline void Run(const DecodedProgram *pProgram, void *pGlobalScope, const Column *pColumns, uint64_t workScopeCount = 1, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
     {
-    private:
-        [[nodiscard]] static std::string GetOperandString(const std::string &function, uint64_t operandIdx = 0) noexcept
+        ThreadedWorkerState state{};
+        RunRange(pProgram, state, BindSoA(pProgram, pGlobalScope, pColumns), 0U, workScopeCount, zeroLocalScope);
+        CollectRetired(state, pRetired);
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Unrolled interpreter
+    // Run<Program> takes a program from Compiler::CompileStatic as a template argument and expands its bytecode in to
+    // straight line C++ while compiling. Nothing is dispatched, every operand is a fixed offset in to its scope and every
+    // literal is an immediate. Labels cut the program in to blocks, a taken jump skips the blocks above its label.
+    namespace Unrolled
+    {
+        enum class Flow : uint8_t
         {
-            // NOTE(tomas): consider switching over to regex for extraction
-            // Trim
-            int64_t functionStart = function.find('(');
-            std::string trimmed = function.substr(functionStart + 1);
-            trimmed = trimmed.substr(0, trimmed.size() - 1);
+            Next,
+            Jumped,
+            Halted
+        };
 
-            // Extract
-            int64_t operandBeg = 0;
-            for(int comIdx = 0; comIdx < operandIdx; ++comIdx)
-                operandBeg = trimmed.find(',', operandBeg + 1);
+        struct Context
+        {
+            uint8_t *pScopes[CONSTANT_SCOPE] = {};      // Global, work and local, constants are immediates
+            uint64_t workUnitIdx = 0U;
+            uint64_t resumeBlock = 0U;                  // Blocks above it were jumped over
+            std::vector<uint64_t> *pRetired = nullptr;
+        };
 
-            int64_t endComma = trimmed.find(',', operandBeg + 1);
+        template<auto P>
+        [[nodiscard]] constexpr uint64_t OperandStride() noexcept { return 1U + P.offsetSize; }
 
-            if(endComma != -1)
-                trimmed = trimmed.substr(operandBeg, endComma - operandBeg);
-            else
-                trimmed = trimmed.substr(operandBeg);
+        template<auto P>
+        [[nodiscard]] constexpr uint64_t ScopeAt(uint64_t pc, uint64_t operandIdx) noexcept { return P.bytes[pc + 1U + operandIdx * OperandStride<P>()]; }
 
-            if (operandBeg != 0)
-                trimmed = trimmed.substr(1);
+        template<auto P>
+        [[nodiscard]] constexpr uint64_t OffsetAt(uint64_t pc, uint64_t operandIdx) noexcept
+        {
+            uint64_t offset = 0U;
+            for(uint64_t b = 0U; b < P.offsetSize; ++b)
+                offset |= (uint64_t)P.bytes[pc + 2U + operandIdx * OperandStride<P>() + b] << (b * 8U);
 
-            return trimmed;
+            return offset;
         }
 
-        [[nodiscard]] static std::string Sanitize(const std::string& code)
+        // Instructions, and blocks: one at the top and one at every label
+        template<auto P>
+        [[nodiscard]] constexpr std::pair<uint64_t, uint64_t> Counts() noexcept
         {
-            ////////////////////////////////////////////////////////////////
-            // Sanitize code
-            std::string sanitizedCode = code;
+            uint64_t instructions = 0U;
+            uint64_t blocks = 1U;
+            for(uint64_t pc = 0U; pc < P.codeSize; pc += 1U + OpOperandCount[P.bytes[pc]] * OperandStride<P>())
+            {
+                ++instructions;
+                blocks += P.bytes[pc] == (uint8_t)OpCode::PAR_LABEL;
+            }
 
-            // Remove comments
-            uint64_t currentIndex = 0U;
-            while (true)
+            return { instructions, blocks };
+        }
+
+        template<auto P>
+        struct Layout
+        {
+            static constexpr uint64_t InstructionCount = Counts<P>().first;
+            static constexpr uint64_t BlockCount = Counts<P>().second;
+
+            std::array<uint64_t, InstructionCount> counters{};      // Program counter of every instruction
+            std::array<uint64_t, BlockCount + 1U> blockStarts{};    // First instruction of every block, the last one ends them
+
+            // Block a label starts
+            [[nodiscard]] constexpr uint64_t BlockOf(uint64_t labelCounter) const noexcept
             {
-                currentIndex = sanitizedCode.find("//", currentIndex + 1U);
+                uint64_t block = 1U;
+                while (block < BlockCount && counters[blockStarts[block]] != labelCounter)
+                    ++block;
 
-                // If no more comment, end
-                if (currentIndex == -1)
-                    break;
+                return block;
+            }
+        };
 
-                // Otherwise, find line break and set everything to spaces untill there
-                uint64_t lineBreak = sanitizedCode.find('\n', currentIndex);
+        template<auto P>
+        inline constexpr Layout<P> LayoutOf = [] {
+            Layout<P> layout{};
+            uint64_t block = 1U;
+            uint64_t pc = 0U;
 
-                if (lineBreak == -1)
-                    throw std::exception("Invalid line endings...");
+            for(uint64_t idx = 0U; idx < Layout<P>::InstructionCount; ++idx)
+            {
+                if(P.bytes[pc] == (uint8_t)OpCode::PAR_LABEL)
+                    layout.blockStarts[block++] = idx;
 
-                for (int i = currentIndex; i < lineBreak; ++i)
-                    sanitizedCode[i] = ' ';
+                layout.counters[idx] = pc;
+                pc += 1U + OpOperandCount[P.bytes[pc]] * OperandStride<P>();
             }
 
-            // Remove whitespace
-            sanitizedCode.erase(std::remove_if(sanitizedCode.begin(), sanitizedCode.end(), std::isspace), sanitizedCode.end());
+            layout.blockStarts[Layout<P>::BlockCount] = Layout<P>::InstructionCount;
+            return layout;
+        }();
+
+        // Literals are read out of the constant pool while compiling
+        template<auto P, typename T>
+        [[nodiscard]] constexpr T ConstantAt(uint64_t offset) noexcept
+        {
+            const uint64_t base = Program::ConstantsOffset(P.codeSize) + offset;
+
+            if constexpr (std::is_same_v<T, bool>)
+            {
+                return P.bytes[base] != 0U;
+            }
+            else
+            {
+                std::array<uint8_t, sizeof(T)> bytes{};
+                for(uint64_t b = 0U; b < sizeof(T); ++b)
+                    bytes[b] = P.bytes[base + b];
 
-            return sanitizedCode;
+                return std::bit_cast<T>(bytes);
+            }
         }
 
-        [[nodiscard]] static std::array<Scope, 3> FindScopes(const std::string& sanitizedCode)
+        // Instructions of a straight line can read a field as an int and as a float, so every access goes through memcpy
+        // or the compiler would be free to reorder them
+        template<auto P, uint64_t PC, uint64_t OperandIdx, typename T>
+        [[nodiscard]] inline T Read(const Context &context) noexcept
         {
-            ////////////////////////////////////////////////////////////////
-            // Find scopes
-            const auto FindScope = [&sanitizedCode](const std::string &scopeIdentifier) -> Scope {
-                Scope scope{};
+            if constexpr (ScopeAt<P>(PC, OperandIdx) == CONSTANT_SCOPE)
+            {
+                constexpr T value = ConstantAt<P, T>(OffsetAt<P>(PC, OperandIdx));
+                return value;
+            }
+            else if constexpr (std::is_same_v<T, bool>)
+            {
+                return context.pScopes[ScopeAt<P>(PC, OperandIdx)][OffsetAt<P>(PC, OperandIdx)] != 0U;
+            }
+            else
+            {
+                T value{};
+                std::memcpy(&value, context.pScopes[ScopeAt<P>(PC, OperandIdx)] + OffsetAt<P>(PC, OperandIdx), sizeof(T));
+                return value;
+            }
+        }
 
-                ////////////////////////////////////////////////////////////////
-                // Get Scope start and end
-                int64_t scopeStart = sanitizedCode.find(scopeIdentifier);
+        template<auto P, uint64_t PC, uint64_t OperandIdx, typename T>
+        inline void Write(const Context &context, T value) noexcept
+        {
+            static_assert(ScopeAt<P>(PC, OperandIdx) < CONSTANT_SCOPE, "Run<Program> only writes the global, work and local scopes");
+            std::memcpy(context.pScopes[ScopeAt<P>(PC, OperandIdx)] + OffsetAt<P>(PC, OperandIdx), &value, sizeof(T));
+        }
 
-                if (scopeStart == -1)
-                    throw std::exception(("Missing scope -> " + scopeIdentifier).c_str());
+        // A field group, never a literal
+        template<auto P, uint64_t PC, uint64_t OperandIdx>
+        [[nodiscard]] inline uint8_t *Group(const Context &context) noexcept
+        {
+            static_assert(ScopeAt<P>(PC, OperandIdx) < CONSTANT_SCOPE, "Run<Program> only finds field groups in the global, work and local scopes");
+            return context.pScopes[ScopeAt<P>(PC, OperandIdx)] + OffsetAt<P>(PC, OperandIdx);
+        }
 
-                ////////////////////////////////////////////////////////////////
-                // Get scope size
-                int64_t scopeSizeStart = sanitizedCode.find('[', scopeStart);
-                int64_t scopeSizeEnd = sanitizedCode.find("]]", scopeStart);
+        #define UnrolledRead(Type, OpIdx)           Read<P, PC, OpIdx, Type>(context)
+        #define UnrolledWrite(Type, OpIdx, Value)   Write<P, PC, OpIdx, Type>(context, Value)
+        #define UnrolledGroup(OpIdx)                Group<P, PC, OpIdx>(context)
 
-                if (scopeSizeStart == -1 || scopeSizeEnd == -1)
-                    throw std::exception(
-                            ("Malformed scope, missing size specifier for scope -> " + scopeIdentifier).c_str());
+        // The instruction at PC, same semantics as the scalar interpreter
+        template<auto P, uint64_t PC>
+        [[nodiscard]] inline Flow Execute(Context &context) noexcept
+        {
+            constexpr OpCode op = (OpCode)P.bytes[PC];
 
-                int64_t scopeSize = std::stoi(
-                        sanitizedCode.substr(scopeSizeStart + 1U, scopeSizeEnd - scopeSizeStart));
+            if constexpr (op == OpCode::PAR_HALT)
+            {
+                return Flow::Halted;
+            }
+            else if constexpr (op == OpCode::PAR_HALT_CONDITIONAL)
+            {
+                return UnrolledRead(bool, 0U) ? Flow::Halted : Flow::Next;
+            }
+            else if constexpr (op == OpCode::PAR_RETIRE_CONDITIONAL)
+            {
+                if(!UnrolledRead(bool, 0U))
+                    return Flow::Next;
 
-                ////////////////////////////////////////////////////////////////
-                // Get scope identifiers
-                int64_t identifierStart = scopeSizeEnd + 2;
-                int64_t identifierEnd = sanitizedCode.find("};", identifierStart);
+                if(context.pRetired)
+                    context.pRetired->push_back(context.workUnitIdx);
 
-                if (sanitizedCode[identifierStart] != '{')
-                    throw std::exception(("Malformed scope field, missing { for scope -> " + scopeIdentifier).c_str());
+                return Flow::Halted;
+            }
+            else if constexpr (op == OpCode::PAR_JUMP_CONDITIONAL)
+            {
+                if(!UnrolledRead(bool, 0U))
+                    return Flow::Next;
 
-                auto scopeFields = sanitizedCode.substr(identifierStart + 1u, (identifierEnd - identifierStart) - 1U);
+                context.resumeBlock = LayoutOf<P>.BlockOf(OffsetAt<P>(PC, 1U));
+                return Flow::Jumped;
+            }
+            else
+            {
+                if constexpr (op == OpCode::PAR_LABEL)                  {}
+                else if constexpr (op == OpCode::SELECT)                UnrolledWrite(uint32_t, 0U, UnrolledRead(bool, 1U) ? UnrolledRead(uint32_t, 2U) : UnrolledRead(uint32_t, 3U));
+                else if constexpr (op == OpCode::INC_FLOAT)             UnrolledWrite(float, 0U, UnrolledRead(float, 0U) + 1.f);
+                else if constexpr (op == OpCode::DEC_FLOAT)             UnrolledWrite(float, 0U, UnrolledRead(float, 0U) - 1.f);
+                else if constexpr (op == OpCode::ADD_FLOAT)             UnrolledWrite(float, 0U, UnrolledRead(float, 1U) + UnrolledRead(float, 2U));
+                else if constexpr (op == OpCode::SUB_FLOAT)             UnrolledWrite(float, 0U, UnrolledRead(float, 1U) - UnrolledRead(float, 2U));
+                else if constexpr (op == OpCode::MUL_FLOAT)             UnrolledWrite(float, 0U, UnrolledRead(float, 1U) * UnrolledRead(float, 2U));
+                else if constexpr (op == OpCode::MAD_FLOAT)             UnrolledWrite(float, 0U, UnrolledRead(float, 1U) * UnrolledRead(float, 2U) + UnrolledRead(float, 3U));
+                else if constexpr (op == OpCode::BIGGER_THAN_FLOAT)     UnrolledWrite(bool, 0U, UnrolledRead(float, 1U) > UnrolledRead(float, 2U));
+                else if constexpr (op == OpCode::SMALLER_THAN_FLOAT)    UnrolledWrite(bool, 0U, UnrolledRead(float, 1U) < UnrolledRead(float, 2U));
+                else if constexpr (op == OpCode::MIN_FLOAT)             { float a = UnrolledRead(float, 1U); float b = UnrolledRead(float, 2U); UnrolledWrite(float, 0U, a < b ? a : b); }
+                else if constexpr (op == OpCode::MAX_FLOAT)             { float a = UnrolledRead(float, 1U); float b = UnrolledRead(float, 2U); UnrolledWrite(float, 0U, a > b ? a : b); }
+                else if constexpr (op == OpCode::INC_INT)               UnrolledWrite(int, 0U, UnrolledRead(int, 0U) + 1);
+                else if constexpr (op == OpCode::DEC_INT)               UnrolledWrite(int, 0U, UnrolledRead(int, 0U) - 1);
+                else if constexpr (op == OpCode::ADD_INT)               UnrolledWrite(int, 0U, UnrolledRead(int, 1U) + UnrolledRead(int, 2U));
+                else if constexpr (op == OpCode::SUB_INT)               UnrolledWrite(int, 0U, UnrolledRead(int, 1U) - UnrolledRead(int, 2U));
+                else if constexpr (op == OpCode::MUL_INT)               UnrolledWrite(int, 0U, UnrolledRead(int, 1U) * UnrolledRead(int, 2U));
+                else if constexpr (op == OpCode::MIN_INT)               { int a = UnrolledRead(int, 1U); int b = UnrolledRead(int, 2U); UnrolledWrite(int, 0U, a < b ? a : b); }
+                else if constexpr (op == OpCode::MAX_INT)               { int a = UnrolledRead(int, 1U); int b = UnrolledRead(int, 2U); UnrolledWrite(int, 0U, a > b ? a : b); }
+                else if constexpr (op == OpCode::ADD_VEC3)              AddVec3(UnrolledGroup(0U), UnrolledGroup(1U), UnrolledGroup(2U));
+                else if constexpr (op == OpCode::SUB_VEC3)              SubVec3(UnrolledGroup(0U), UnrolledGroup(1U), UnrolledGroup(2U));
+                else if constexpr (op == OpCode::SCALE_VEC3)            { Vec3 a = LoadVec3(UnrolledGroup(1U)); float s = UnrolledRead(float, 2U); StoreVec3(UnrolledGroup(0U), { a.x * s, a.y * s, a.z * s }); }
+                else if constexpr (op == OpCode::MAD_VEC3)              { Vec3 a = LoadVec3(UnrolledGroup(1U)), b = LoadVec3(UnrolledGroup(3U)); float s = UnrolledRead(float, 2U); StoreVec3(UnrolledGroup(0U), { a.x * s + b.x, a.y * s + b.y, a.z * s + b.z }); }
+                else if constexpr (op == OpCode::DOT_VEC3)              DotVec3(UnrolledGroup(0U), UnrolledGroup(1U), UnrolledGroup(2U));
+                else if constexpr (op == OpCode::LENGTH_VEC3)           LengthVec3(UnrolledGroup(0U), UnrolledGroup(1U));
+                else static_assert(op == OpCode::PAR_LABEL, "Run<Program> only runs what Compiler::CompileStatic emits");
 
-                // Extract name and offset from a given field string, ie: "[0]->GlobalCounter;"
-                const auto ExtractField = [](
-                        const std::string &fieldString) -> std::vector<std::pair<std::string, uint64_t>>
-                {
-                    std::pair<std::string, uint64_t> current{};
-                    std::vector<std::pair<std::string, uint64_t>> out{};
+                return Flow::Next;
+            }
+        }
 
-                    // Get name
-                    int64_t identifierArrow = fieldString.find('>');
+        #undef UnrolledRead
+        #undef UnrolledWrite
+        #undef UnrolledGroup
 
-                    // Is this an array identifier?
-                    int64_t arrayIdentifier = fieldString.find('[', identifierArrow);
+        // Runs the instructions of a block until one halts or jumps, false once the work unit halted
+        template<auto P, uint64_t Block>
+        [[nodiscard]] inline bool RunBlock(Context &context) noexcept
+        {
+            if(context.resumeBlock > Block)
+                return true;
 
-                    if (arrayIdentifier != -1)
-                    {
-                        // This is a complex field, we need to extract an array of identifiers
-                        auto offsets = fieldString.substr(1U, fieldString.find(']') - 1U);
-                        auto subFieldNames = fieldString.substr(arrayIdentifier + 1,
-                                                                (fieldString.find("];") - arrayIdentifier) - 1);
-                        auto primaryFieldName = fieldString.substr(identifierArrow + 1,
-                                                                   (fieldString.find('[', identifierArrow) -
-                                                                    identifierArrow) - 1);
-
-                        std::string previous{};
-
-                        // Process this complex field and populate the out vector
-                        while (previous != offsets)
-                        {
-                            int64_t offsetComma = offsets.find(',');
-                            int64_t subfieldComma = subFieldNames.find(',');
+            constexpr uint64_t begin = LayoutOf<P>.blockStarts[Block];
+            constexpr uint64_t end = LayoutOf<P>.blockStarts[Block + 1U];
 
-                            current.first = primaryFieldName + "." + subFieldNames.substr(0U, subfieldComma);
-                            current.second = std::stoi(offsets.substr(0U, offsetComma));
+            return [&context]<uint64_t... Idx>(std::integer_sequence<uint64_t, Idx...>) {
+                Flow flow = Flow::Next;
+                (((flow = Execute<P, LayoutOf<P>.counters[begin + Idx]>(context)) == Flow::Next) && ...);
+                return flow != Flow::Halted;
+            }(std::make_integer_sequence<uint64_t, end - begin>{});
+        }
 
-                            // Shitty way to stop the loop xd
-                            previous = offsets;
+        template<auto P>
+        inline void RunBlocks(Context &context) noexcept
+        {
+            [&context]<uint64_t... Block>(std::integer_sequence<uint64_t, Block...>) {
+                (void)(RunBlock<P, Block>(context) && ...);
+            }(std::make_integer_sequence<uint64_t, Layout<P>::BlockCount>{});
+        }
+    }
 
-                            // Set up next iteration
-                            offsets = offsets.substr(offsetComma + 1);
-                            subFieldNames = subFieldNames.substr(subfieldComma + 1);
+    // Runs a static program over an AoS work scope, like Run does with a Program
+    template<auto P>
+    inline void Run(void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount = 1, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        // The local scope lives on the stack, its size is known while compiling
+        alignas(16) uint8_t localScope[std::max<uint64_t>(P.localScopeSize, 16U)] = {};
 
-                            out.push_back(current);
-                            current = {};
-                        }
-                    }
-                    else
-                    {
-                        // This is a simple field, we just get the information and head out
-                        current.first = fieldString.substr(identifierArrow + 1U,
-                                                           (fieldString.size() - identifierArrow) - 2);
+        Unrolled::Context context{};
+        context.pScopes[GLOBAL_SCOPE] = static_cast<uint8_t*>(pGlobalScope);
+        context.pScopes[LOCAL_SCOPE] = localScope;
+        context.pRetired = pRetired;
 
-                        // Get offset
-                        int64_t sizeClosingBracket = fieldString.find(']');
-                        current.second = std::stoi(fieldString.substr(1U, sizeClosingBracket - 1U));
+        for(uint64_t workUnitIdx = 0U; workUnitIdx < workScopeCount; ++workUnitIdx)
+        {
+            if(zeroLocalScope)
+                std::memset(localScope, 0, P.localScopeSize);
 
-                        out.push_back(current);
-                    }
+            context.pScopes[WORK_SCOPE] = static_cast<uint8_t*>(pWorkScopes) + workUnitIdx * workScopeSize;
+            context.workUnitIdx = workUnitIdx;
+            context.resumeBlock = 0U;
+            Unrolled::RunBlocks<P>(context);
+        }
+    }
 
-                    return out;
-                };
+    ////////////////////////////////////////////////////////////////
+    // Work stealing thread pool
+    // Every worker owns a deque, pops from its front and steals from the back of the others.
+    // Workers stay alive for the lifetime of the pool so dispatching a frame costs no thread creation.
+    class ThreadPool
+    {
+    public:
+        typedef std::function<void(uint32_t workerIdx)> Task;
 
-                // Perform extraction
-                while (!scopeFields.empty())
-                {
-                    uint64_t semiColon = scopeFields.find(';');
-                    auto fieldString = scopeFields.substr(0U, semiColon + 1);
-                    auto fields = ExtractField(fieldString);
+        explicit ThreadPool(uint32_t workerCount = std::max(1U, std::thread::hardware_concurrency()))
+            : m_Queues(workerCount), m_States(workerCount)
+        {
+            m_Workers.reserve(workerCount);
+            for(uint32_t idx = 0; idx < workerCount; ++idx)
+                m_Workers.emplace_back([this, idx]() { WorkerLoop(idx); });
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard lock(m_SleepMutex);
+                m_Quit = true;
+            }
 
-                    for (auto &f : fields)
-                        scope.m_ScopeOffsetResolver.insert(f);
+            m_WakeCondition.notify_all();
 
-                    scopeFields = scopeFields.substr(semiColon + 1);
-                }
+            for(auto& w : m_Workers)
+                w.join();
+        }
 
-                scope.scopeSize = scopeSize;
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
 
-                return scope;
-            };
+        [[nodiscard]] uint32_t WorkerCount() const noexcept { return static_cast<uint32_t>(m_Workers.size()); }
 
-            return std::array<Scope, 3>{ FindScope("GlobalScope"), FindScope("WorkScope"), FindScope("LocalScope") };
-        }
+        // A WorkerState per worker that lives as long as the pool, a task may use the one of the worker running it.
+        // Its scopes keep their size from task to task, see RunAsync
+        [[nodiscard]] WorkerState &State(uint32_t workerIdx) noexcept { return m_States[workerIdx]; }
 
-        [[nodiscard]] static std::vector<std::string> ExtractInstructions(const std::string& code)
+        // Queues a task, round robin over the worker queues
+        void Submit(Task task)
         {
-            std::string sanitizedCode = code;
+            uint32_t queueIdx = m_NextQueue.fetch_add(1U, std::memory_order_relaxed) % m_Queues.size();
+
+            // Count the task before it becomes visible so a fast worker can't finish it first
+            {
+                std::lock_guard lock(m_SleepMutex);
+                ++m_PendingTasks;
+                m_QueuedTasks.fetch_add(1U, std::memory_order_relaxed);
+            }
 
-            // After the scopes are found, we're ready to compile
-            // First we find the start of the worker function
-            int64_t workerStart = sanitizedCode.find("Worker");
+            {
+                std::lock_guard lock(m_Queues[queueIdx].mutex);
+                m_Queues[queueIdx].tasks.push_back(std::move(task));
+            }
 
-            if(workerStart == -1)
-                throw std::exception("Worker function missing...");
+            m_WakeCondition.notify_one();
+        }
 
-            // Clip sanitizedCode
-            sanitizedCode = sanitizedCode.substr(workerStart);
+        // Blocks until every submitted task has completed
+        void Wait()
+        {
+            std::unique_lock lock(m_SleepMutex);
+            m_DoneCondition.wait(lock, [this]() { return m_PendingTasks == 0U; });
+        }
 
-            // Find code start and code end
-            int64_t codeStart  = sanitizedCode.find('{');
-            int64_t codeEnd    = sanitizedCode.find("};");
+    private:
+        struct alignas(64) WorkQueue
+        {
+            std::mutex mutex{};
+            std::deque<Task> tasks{};
+        };
 
-            if(codeStart == -1)
-                throw std::exception("Opening { missing");
+        [[nodiscard]] bool TryPop(uint32_t workerIdx, Task &task)
+        {
+            // Own queue first, front to back
+            {
+                auto& own = m_Queues[workerIdx];
+                std::lock_guard lock(own.mutex);
+                if(!own.tasks.empty())
+                {
+                    task = std::move(own.tasks.front());
+                    own.tasks.pop_front();
+                    m_QueuedTasks.fetch_sub(1U, std::memory_order_relaxed);
+                    return true;
+                }
+            }
 
-            if(codeEnd == -1)
-                throw std::exception("Closing }; missing");
+            // Steal from the back of everyone else
+            for(uint64_t offset = 1U; offset < m_Queues.size(); ++offset)
+            {
+                auto& victim = m_Queues[(workerIdx + offset) % m_Queues.size()];
+                std::lock_guard lock(victim.mutex);
+                if(!victim.tasks.empty())
+                {
+                    task = std::move(victim.tasks.back());
+                    victim.tasks.pop_back();
+                    m_QueuedTasks.fetch_sub(1U, std::memory_order_relaxed);
+                    return true;
+                }
+            }
 
-            sanitizedCode = sanitizedCode.substr(codeStart + 1U, codeEnd - codeStart);
+            return false;
+        }
 
-            // Split code in to lines
-            std::vector<std::string> lines{};
+        void WorkerLoop(uint32_t workerIdx)
+        {
+            Task task{};
 
             while (true)
             {
-                uint64_t instructionEnd = sanitizedCode.find(';');
+                if(TryPop(workerIdx, task))
+                {
+                    task(workerIdx);
+                    task = nullptr;
 
-                if(instructionEnd == -1)
-                    break;
+                    std::lock_guard lock(m_SleepMutex);
+                    if(--m_PendingTasks == 0U)
+                        m_DoneCondition.notify_all();
+
+                    continue;
+                }
+
+                std::unique_lock lock(m_SleepMutex);
+                m_WakeCondition.wait(lock, [this]() { return m_Quit || m_QueuedTasks.load(std::memory_order_relaxed) > 0U; });
 
-                lines.push_back(sanitizedCode.substr(0, instructionEnd));
-                sanitizedCode = sanitizedCode.substr(instructionEnd + 1);
+                if(m_Quit)
+                    return;
             }
+        }
+
+        std::vector<WorkQueue> m_Queues;
+        std::vector<WorkerState> m_States;
+        std::vector<std::thread> m_Workers{};
+        std::atomic<uint32_t> m_NextQueue{ 0U };
+
+        std::mutex m_SleepMutex{};
+        std::condition_variable m_WakeCondition{};
+        std::condition_variable m_DoneCondition{};
+        std::atomic<uint64_t> m_QueuedTasks{ 0U };
+        uint64_t m_PendingTasks = 0U;
+        bool m_Quit = false;
+    };
+
+    // Splits the work scopes in to chunks and runs them on the pool, every worker gets its own WorkerState.
+    // Every chunk reduces in to its own private copy, they're merged in chunk order once all chunks are done, so
+    // reductions come out the same for any worker count.
+    // NOTE(tomas): other writes to the global scope are not synchronized between workers
+    inline void RunParallel(ThreadPool &pool, const Program *pProgram, const ScopeBinding &binding, uint64_t workScopeCount = 1, uint64_t chunkSize = 4096, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        if(workScopeCount <= 0U)
+            return;
+
+        chunkSize = std::max<uint64_t>(chunkSize, 1U);
 
-            return lines;
+        // Small dispatches are not worth the wake up
+        if(workScopeCount <= chunkSize || pool.WorkerCount() <= 1U)
+        {
+            WorkerState state{};
+            RunRange(pProgram, state, binding, 0U, workScopeCount, zeroLocalScope);
+            CollectRetired(state, pRetired);
+            return;
+        }
+
+        std::vector<WorkerState> states(pool.WorkerCount());
+
+        const uint64_t chunkCount = (workScopeCount + chunkSize - 1U) / chunkSize;
+        const bool reduces = pProgram->reductionCount != 0U && binding.pScopes[REDUCTION_SCOPE] == nullptr;
+        std::vector<std::vector<uint8_t>> chunkReductions(reduces ? chunkCount : 0U);
+
+        for(uint64_t chunkIdx = 0U; chunkIdx < chunkCount; ++chunkIdx)
+        {
+            uint64_t begin = chunkIdx * chunkSize;
+            uint64_t end = std::min(begin + chunkSize, workScopeCount);
+
+            uint8_t *pReductionScope = binding.pScopes[REDUCTION_SCOPE];
+            if(reduces)
+                pReductionScope = ResetReductions(chunkReductions[chunkIdx], pProgram->Reductions(), pProgram->reductionCount, binding.pScopes[GLOBAL_SCOPE]);
+
+            pool.Submit([=, &states, &binding](uint32_t workerIdx) {
+                ScopeBinding chunkBinding = binding;
+                chunkBinding.pScopes[REDUCTION_SCOPE] = pReductionScope;
+                RunRange(pProgram, states[workerIdx], chunkBinding, begin, end, zeroLocalScope);
+            });
         }
 
+        pool.Wait();
+
+        for(const auto& reductionScope : chunkReductions)
+            MergeReductions(pProgram->Reductions(), pProgram->reductionCount, binding.pScopes[GLOBAL_SCOPE], reductionScope.data());
+
+        // NOTE(tomas): retired units come back grouped per worker, not in order
+        for(auto& state : states)
+            CollectRetired(state, pRetired);
+    }
+
+    inline void RunParallel(ThreadPool &pool, const Program *pProgram, void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount = 1, uint64_t chunkSize = 4096, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        RunParallel(pool, pProgram, BindAoS(pProgram, pGlobalScope, pWorkScopes, workScopeSize), workScopeCount, chunkSize, zeroLocalScope, pRetired);
+    }
+
+    inline void RunParallel(ThreadPool &pool, const Program *pProgram, void *pGlobalScope, const Column *pColumns, uint64_t workScopeCount = 1, uint64_t chunkSize = 4096, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        RunParallel(pool, pProgram, BindSoA(pProgram, pGlobalScope, pColumns), workScopeCount, chunkSize, zeroLocalScope, pRetired);
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Asynchronous runs
+    // RunAsync cuts the work scopes in to chunks like RunParallel, queues them on the pool and returns straight away.
+    // The RunHandle waits on just that run, any number of runs can be in flight on one pool.
+    // Chunks run on the WorkerStates the pool keeps per worker and the run itself comes from a free list, a run of
+    // a program whose scopes were seen before allocates nothing but its queue entries
+    class RunHandle
+    {
     public:
-        #define OperandPush(OP_IDX)\
-        auto [opl, opr] = SOResolver(GetOperandString(function, OP_IDX));\
-        program.push_back(opl); \
-        program.push_back(opr); \
-
-        #define AssignmentPush()\
-        int64_t assignmentEnd = function.find('=');\
-        std::string name = function.substr(0, assignmentEnd);\
-        auto [opl, opr] = SOResolver(name);\
-        program.push_back(opl);\
-        program.push_back(opr);\
-
-        #define CompilerResolver(OP_CODE, ASSIGNS, OPERAND_COUNT)\
-        [&SOResolver, &program](const std::string& function) {\
-        program.push_back(OP_CODE);\
-        if constexpr (ASSIGNS) { AssignmentPush() }\
-        if constexpr (OPERAND_COUNT > 0) { for(int idx = 0; idx < OPERAND_COUNT; ++idx) { OperandPush(idx) } }\
-        }\
-
-        [[nodiscard]] static Program Compile(const std::string& code)
+        // Everything the chunks of one run share, owned by the handle. The handle waits before it lets go of it
+        struct AsyncRun
         {
-            ////////////////////////////////////////////////////////////////
-            // Cleanup code and extract the primary working data
-            auto sanitizedCode = Sanitize(code);
-            auto scopes = FindScopes(sanitizedCode);
-            auto lines = ExtractInstructions(sanitizedCode);
+            ThreadPool *pPool = nullptr;
+            const Program *pProgram = nullptr;
+            ScopeBinding binding{};
+            ScopeBinding source{};              // Every chunk copies its units over from here first, when copySource
+            bool copySource = false;
+            bool zeroLocalScope = true;
+            uint64_t workScopeCount = 0U;
+            uint64_t chunkSize = 0U;
 
-            std::vector<uint8_t> program{};
+            // Per chunk, merged and handed back in chunk order by Wait
+            std::vector<std::vector<uint8_t>> chunkReductions{};
+            std::vector<std::vector<uint64_t>> chunkRetired{};
 
-            ////////////////////////////////////////////////////////////////
-            // Scope and Offset resolver
-            const auto SOResolver = [&scopes](const std::string& variableName) -> std::pair<uint64_t, uint64_t>
+            std::atomic<uint64_t> remaining{ 0U };
+            std::mutex mutex{};
+            std::condition_variable doneCondition{};
+        };
+
+        // Finished runs go back on a free list and keep their per chunk vectors for the next one
+        struct Recycle
+        {
+            void operator()(AsyncRun *pRun) const
             {
-                int64_t scope = 0;
-                for(auto& s : scopes)
-                {
-                    auto it = s.m_ScopeOffsetResolver.find(variableName);
-                    if(it != s.m_ScopeOffsetResolver.end())
-                        return std::make_pair(scope, it->second);
+                std::lock_guard lock(FreeMutex());
+                FreeRuns().emplace_back(pRun);
+            }
+        };
 
-                    ++scope;
+        typedef std::unique_ptr<AsyncRun, Recycle> RunPtr;
+
+        [[nodiscard]] static RunPtr Acquire()
+        {
+            {
+                std::lock_guard lock(FreeMutex());
+                auto& freeRuns = FreeRuns();
+                if(!freeRuns.empty())
+                {
+                    RunPtr pRun(freeRuns.back().release());
+                    freeRuns.pop_back();
+                    return pRun;
                 }
+            }
 
-                throw std::exception((std::string("Failed to resolve variable scope and offset... ") + variableName).c_str());
-            };
+            return RunPtr(new AsyncRun{});
+        }
 
-            ////////////////////////////////////////////////////////////////
-            // Function resolvers
-            typedef std::function<void(const std::string&)> Resolver;
-            std::unordered_map<std::string, std::unordered_map<std::string, Resolver>> resolvers {};
-
-            // Float arithmetic ///////////////////////////////////////////
-            resolvers["Float"]["::++"]  = CompilerResolver(1, false, 1);    // INC_FLOAT [&Scope + Offset]
-            resolvers["Float"]["::--"]  = CompilerResolver(2, false, 1);    // DEC_FLOAT [&Scope + Offset]
-            resolvers["Float"]["::+"]   = CompilerResolver(3, true, 2);     // ADD_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
-            resolvers["Float"]["::-"]   = CompilerResolver(4, true, 2);     // SUB_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
-            resolvers["Float"]["::*"]   = CompilerResolver(5, true, 2);     // MUL_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
-            resolvers["Float"]["::>"]   = CompilerResolver(14, true, 2);    // BIGGER_THAN_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
-            resolvers["Float"]["::<"]   = CompilerResolver(15, true, 2);    // SMALLER_THAN_FLOAT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
-
-            // Integer arithmetic /////////////////////////////////////////
-            resolvers["Int"]["::++"]   = CompilerResolver(6, false, 1);     // INC_INT [&Scope + Offset]
-            resolvers["Int"]["::--"]   = CompilerResolver(7, false, 1);     // DEC_INT [&Scope + Offset]
-            resolvers["Int"]["::+"]    = CompilerResolver(10, true, 2);     // ADD_INT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
-            resolvers["Int"]["::-"]    = CompilerResolver(11, true, 2);     // SUB_INT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
-            resolvers["Int"]["::*"]    = CompilerResolver(12, true, 2);     // MUL_INT [&Scope + Offset], [&Scope + Offset], [&Scope + Offset]
-
-            // Vm Instructions ////////////////////////////////////////////
-            resolvers["VM"]["::Halt"]  = CompilerResolver(0, false, 0);             // PAR_HALT
-            resolvers["VM"]["::HaltConditional"] = CompilerResolver(13, false, 1);  // PAR_HALT_CONDITIONAL [&Scope + Offset]
-
-            // TODO(tomas): add some debug functionality: Breakpoint, Log ProgramCounter, Reset local scope
+        RunHandle() = default;
+        explicit RunHandle(RunPtr pRun) noexcept : m_pRun(std::move(pRun)) {}
 
-            ////////////////////////////////////////////////////////////////
-            // Decode and assemble instructions in to bytecode
-            for(const auto& line : lines)
+        RunHandle(RunHandle&&) noexcept = default;
+        RunHandle& operator=(RunHandle &&other)
+        {
+            if(this != &other)
             {
-                // Get start of function scope
-                int64_t scopeStart = line.find('=');
-                scopeStart = (scopeStart == -1) ? 0 : scopeStart + 1;
+                Wait();
+                m_pRun = std::move(other.m_pRun);
+            }
+
+            return *this;
+        }
 
-                // Get end of function scope
-                int64_t scopeEnd = line.find("::");
-                if(scopeEnd == -1)
-                    throw std::exception("Failed to resolve function scope...");
+        RunHandle(const RunHandle&) = delete;
+        RunHandle& operator=(const RunHandle&) = delete;
 
-                // Get end of function name
-                int64_t fnEnd = line.find('(');
+        // Same as a std::future from std::async, dropping the handle waits for the run
+        ~RunHandle() { Wait(); }
 
-                std::string scope = line.substr(scopeStart, scopeEnd - scopeStart);
-                std::string fName = line.substr(scopeEnd, fnEnd - scopeEnd);
+        // Whether there is a run left to wait for
+        [[nodiscard]] bool Valid() const noexcept { return m_pRun != nullptr; }
 
-                // Find the correct resolver
-                if(resolvers.contains(scope))
-                {
-                    auto[key, funResolvers] = *resolvers.find(scope);
-                    auto it = funResolvers.find(fName);
+        // Doesn't block. A run that is done still needs a Wait to merge its reductions
+        [[nodiscard]] bool Done() const noexcept { return !m_pRun || m_pRun->remaining.load(std::memory_order_acquire) == 0U; }
 
-                    if(it != funResolvers.end())
-                        it->second(line);
-                }
+        // Blocks until every chunk finished, merges the reductions in chunk order and hands back the retired units.
+        // The handle is empty afterwards
+        void Wait(std::vector<uint64_t> *pRetired = nullptr)
+        {
+            if(!m_pRun)
+                return;
+
+            RunPtr pRun = std::move(m_pRun);
+
+            // The last chunk counts down under the lock, once the waiter sees zero no chunk touches the run anymore
+            {
+                std::unique_lock lock(pRun->mutex);
+                pRun->doneCondition.wait(lock, [&pRun]() { return pRun->remaining.load(std::memory_order_acquire) == 0U; });
             }
 
-            ////////////////////////////////////////////////////////////////
-            // Add halt to the end
-            program.push_back(0);
+            for(const auto& reductionScope : pRun->chunkReductions)
+                MergeReductions(pRun->pProgram->Reductions(), pRun->pProgram->reductionCount, pRun->binding.pScopes[GLOBAL_SCOPE], reductionScope.data());
 
-            ////////////////////////////////////////////////////////////////
-            // Write out program
-            Program p{};
-            p.programCounter = 0;
-            p.programSize = program.size();
-            p.pCode = static_cast<uint8_t*>(malloc(program.size()));
-            std::memcpy(p.pCode, program.data(), program.size());
-            return p;
+            for(const auto& retired : pRun->chunkRetired)
+                if(pRetired)
+                    pRetired->insert(pRetired->end(), retired.begin(), retired.end());
+        }
+
+    private:
+        static std::mutex &FreeMutex()
+        {
+            static std::mutex mutex{};
+            return mutex;
         }
+
+        static std::vector<std::unique_ptr<AsyncRun>> &FreeRuns()
+        {
+            static std::vector<std::unique_ptr<AsyncRun>> runs{};
+            return runs;
+        }
+
+        RunPtr m_pRun{};
     };
 
-    // Runs inline
-    void Run(Program *pProgram, void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount = 1, bool zeroLocalScope = true)
+    // Queues the work scopes on the pool in chunks and returns without waiting. When pSource is set every chunk first
+    // copies its units over from pSource, same layout as binding, see FramePipeline.
+    // NOTE(tomas): ThreadPool::Wait waits for these runs too, RunParallel on the same pool blocks until they're done
+    [[nodiscard]] inline RunHandle RunAsync(ThreadPool &pool, const Program *pProgram, const ScopeBinding &binding, uint64_t workScopeCount = 1, uint64_t chunkSize = 4096, bool zeroLocalScope = true, const ScopeBinding *pSource = nullptr)
     {
-        ////////////////////////////////////////////////////////////////
-        // Boilerplate helpers
-        #define LOCAL_SCOPE_SIZE 256
+        if(workScopeCount <= 0U)
+            return RunHandle{};
 
-        #define WORK_SCOPE      1
-        #define LOCAL_SCOPE     2
+        CheckLocalScope(pProgram, zeroLocalScope);
 
-        #define Step(StepCount)                 pProgram->programCounter += StepCount; goto *opLut[*(pProgram->pCode + (pProgram->programCounter))]
-        #define Operand(OpOffset)               pProgram->pCode[pProgram->programCounter + (OpOffset + 1)]
-        #define DeclareOp(OpName, Size, Code)   OpName:{Code}Step(Size);
+        chunkSize = std::max<uint64_t>(chunkSize, 1U);
+        const uint64_t chunkCount = (workScopeCount + chunkSize - 1U) / chunkSize;
 
-        ////////////////////////////////////////////////////////////////
-        // Setup part Virtual machine
-        uint64_t workUnitIdx = 0U;
+        RunHandle::RunPtr pRun = RunHandle::Acquire();
+        pRun->pPool = &pool;
+        pRun->pProgram = pProgram;
+        pRun->binding = binding;
+        pRun->copySource = pSource != nullptr;
+        pRun->source = pSource ? *pSource : ScopeBinding{};
+        pRun->zeroLocalScope = zeroLocalScope;
+        pRun->workScopeCount = workScopeCount;
+        pRun->chunkSize = chunkSize;
+        pRun->remaining.store(chunkCount, std::memory_order_relaxed);
 
-        if(workScopeCount <= 0U)
-            return;
+        pRun->chunkRetired.resize(chunkCount);
+        for(auto& retired : pRun->chunkRetired)
+            retired.clear();
 
-        std::array<uint8_t*, 3> pScopes
-        {
-            static_cast<uint8_t*>(pGlobalScope),
-            static_cast<uint8_t*>(pWorkScopes),
-            new uint8_t [LOCAL_SCOPE_SIZE]
-        };
+        // Every chunk reduces in to its own copy, same as RunParallel
+        const bool reduces = pProgram->reductionCount != 0U && binding.pScopes[REDUCTION_SCOPE] == nullptr;
+        pRun->chunkReductions.resize(reduces ? chunkCount : 0U);
+        for(auto& reductionScope : pRun->chunkReductions)
+            ResetReductions(reductionScope, pProgram->Reductions(), pProgram->reductionCount, binding.pScopes[GLOBAL_SCOPE]);
 
-        if(zeroLocalScope)
-            std::memset(pScopes[LOCAL_SCOPE], 0, LOCAL_SCOPE_SIZE);
+        // The handle outlives every chunk, a plain pointer and an index fit a std::function without a heap allocation
+        RunHandle::AsyncRun *pShared = pRun.get();
+        for(uint64_t chunkIdx = 0U; chunkIdx < chunkCount; ++chunkIdx)
+        {
+            pool.Submit([pShared, chunkIdx](uint32_t workerIdx) {
+                RunHandle::AsyncRun &run = *pShared;
+                const uint64_t begin = chunkIdx * run.chunkSize;
+                const uint64_t end = std::min(begin + run.chunkSize, run.workScopeCount);
 
-        static constexpr void* opLut[] = {
-            &&PAR_HALT,
-            &&INC_FLOAT,
-            &&DEC_FLOAT,
-            &&ADD_FLOAT,
-            &&SUB_FLOAT,
-            &&MUL_FLOAT,
-            &&INC_INT,
-            &&DEC_INT,
-            &&INC_UINT,
-            &&DEC_UINT,
-            &&ADD_INT,
-            &&SUB_INT,
-            &&MUL_INT,
-            &&PAR_HALT_CONDITIONAL,
-            &&BIGGER_THAN_FLOAT,
-            &&SMALLER_THAN_FLOAT
-        };
+                // Copied right before it runs, the units are still in cache when the script gets to them
+                if(run.copySource)
+                    for(uint32_t s = run.binding.firstWorkScope; s < run.binding.lastWorkScope; ++s)
+                        std::memcpy(run.binding.pScopes[s] + begin * run.binding.strides[s], run.source.pScopes[s] + begin * run.source.strides[s], (end - begin) * run.binding.strides[s]);
 
-        ////////////////////////////////////////////////////////////////
-        // Start pars Virtual machine
-        goto *opLut[pProgram->pCode[pProgram->programCounter]];
+                ScopeBinding chunkBinding = run.binding;
+                if(!run.chunkReductions.empty())
+                    chunkBinding.pScopes[REDUCTION_SCOPE] = run.chunkReductions[chunkIdx].data();
 
-        ////////////////////////////////////////////////////////////////
-        // VM Instructions
-        DeclareOp(PAR_HALT, 1, // PAR_HALT
-                ++workUnitIdx;
-                if(workUnitIdx >= workScopeCount) {
-                    // Work is done, cleanup memory and exit VM
-                    delete pScopes[LOCAL_SCOPE];
-                    return;
+                // The worker's state is shared by every run on the pool, its retired units belong to this chunk
+                WorkerState &state = run.pPool->State(workerIdx);
+                RunRange(run.pProgram, state, chunkBinding, begin, end, run.zeroLocalScope);
+                if(!state.retired.empty())
+                {
+                    std::swap(run.chunkRetired[chunkIdx], state.retired);
+                    state.retired.clear();
                 }
-                else {
-                    // Reset the PC to 0 and advance work unit
-                    pProgram->programCounter = 0U;
-                    pScopes[WORK_SCOPE] = static_cast<uint8_t*>(pWorkScopes) + (workUnitIdx * workScopeSize);
 
-                    // Zero local scope if needed
-                    if(zeroLocalScope)
-                        std::memset(pScopes[LOCAL_SCOPE], 0, LOCAL_SCOPE_SIZE);
-
-                    // Start VM on the new local scope work unit, this skips the Step op
-                    goto *opLut[pProgram->pCode[pProgram->programCounter]];
-                });
+                std::lock_guard lock(run.mutex);
+                if(run.remaining.fetch_sub(1U, std::memory_order_acq_rel) == 1U)
+                    run.doneCondition.notify_all();
+            });
+        }
 
-        DeclareOp(PAR_HALT_CONDITIONAL,     3, { auto* l = (bool*)(pScopes[Operand(0U)] + Operand(1U)); if(*l) goto *opLut[0]; });
+        return RunHandle(std::move(pRun));
+    }
 
-        ////////////////////////////////////////////////////////////////
-        // Floating point arithmetic instructions
-        DeclareOp(INC_FLOAT,            3,{ auto* l = (float*)(pScopes[Operand(0U)] + Operand(1U)); *l += 1.f; }); // INC_FLOAT_CONTENT &Scope + offset
-        DeclareOp(DEC_FLOAT,            3,{ auto* l = (float*)(pScopes[Operand(0U)] + Operand(1U)); *l -= 1.f; }); // DEC_FLOAT_CONTENT &Scope + offset
-        DeclareOp(ADD_FLOAT,            7,{ auto* l = (float*)(pScopes[Operand(0U)] + Operand(1U)); *l = *((float*)((pScopes[Operand(2U)] + Operand(3U)))) + *((float*)((pScopes[Operand(4U)] + Operand(5U)))); }); // ADD_FLOAT &Scope + offset, &Scope + offset
-        DeclareOp(SUB_FLOAT,            7,{ auto* l = (float*)(pScopes[Operand(0U)] + Operand(1U)); *l = *((float*)((pScopes[Operand(2U)] + Operand(3U)))) - *((float*)((pScopes[Operand(4U)] + Operand(5U)))); }); // SUB_FLOAT &Scope + offset, &Scope + offset
-        DeclareOp(MUL_FLOAT,            7,{ auto* l = (float*)(pScopes[Operand(0U)] + Operand(1U)); *l = *((float*)((pScopes[Operand(2U)] + Operand(3U)))) * *((float*)((pScopes[Operand(4U)] + Operand(5U)))); }); // MUL_FLOAT &Scope + offset, &Scope + offset, &Scope + offset
-        DeclareOp(BIGGER_THAN_FLOAT,    7,{ auto* l = (bool*)(pScopes[Operand(0U)] + Operand(1U)); *l = *((float*)((pScopes[Operand(2U)] + Operand(3U)))) > *((float*)((pScopes[Operand(4U)] + Operand(5U)))); });
-        DeclareOp(SMALLER_THAN_FLOAT,   7,{ auto* l = (bool*)(pScopes[Operand(0U)] + Operand(1U)); *l = *((float*)((pScopes[Operand(2U)] + Operand(3U)))) < *((float*)((pScopes[Operand(4U)] + Operand(5U)))); });
+    [[nodiscard]] inline RunHandle RunAsync(ThreadPool &pool, const Program *pProgram, void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount = 1, uint64_t chunkSize = 4096, bool zeroLocalScope = true)
+    {
+        return RunAsync(pool, pProgram, BindAoS(pProgram, pGlobalScope, pWorkScopes, workScopeSize), workScopeCount, chunkSize, zeroLocalScope);
+    }
 
-        ////////////////////////////////////////////////////////////////
-        // Integer arithmetic instructions
-        DeclareOp(INC_INT,              3,{ auto* l = (int*)(pScopes[Operand(0U)] + Operand(1U)); *l += 1; }); // INC_INT_CONTENT &Scope + offset
-        DeclareOp(DEC_INT,              3,{ auto* l = (int*)(pScopes[Operand(0U)] + Operand(1U)); *l -= 1; }); // DEC_INT_CONTENT &Scope + offset
-        DeclareOp(INC_UINT,             3,{ auto* l = (unsigned int*)(pScopes[Operand(0U)] + Operand(1U)); *l += 1U; }); // INC_UINT_CONTENT &Scope + offset
-        DeclareOp(DEC_UINT,             3,{ auto* l = (unsigned int*)(pScopes[Operand(0U)] + Operand(1U)); *l -= 1U; }); // DEC_UINT_CONTENT &Scope + offset
-        DeclareOp(ADD_INT,              7,{ auto* l = (int*)(pScopes[Operand(0U)] + Operand(1U)); *l = *((int*)((pScopes[Operand(2U)] + Operand(3U)))) + *((int*)((pScopes[Operand(4U)] + Operand(5U)))); }); // ADD_INT &Scope + offset, &Scope + offset
-        DeclareOp(SUB_INT,              7,{ auto* l = (int*)(pScopes[Operand(0U)] + Operand(1U)); *l = *((int*)((pScopes[Operand(2U)] + Operand(3U)))) - *((int*)((pScopes[Operand(4U)] + Operand(5U)))); }); // SUB_INT &Scope + offset, &Scope + offset
-        DeclareOp(MUL_INT,              7,{ auto* l = (int*)(pScopes[Operand(0U)] + Operand(1U)); *l = *((int*)((pScopes[Operand(2U)] + Operand(3U)))) * *((int*)((pScopes[Operand(4U)] + Operand(5U)))); }); // MUL_FLOAT &Scope + offset, &Scope + offset, &Scope + offset
+    [[nodiscard]] inline RunHandle RunAsync(ThreadPool &pool, const Program *pProgram, void *pGlobalScope, const Column *pColumns, uint64_t workScopeCount = 1, uint64_t chunkSize = 4096, bool zeroLocalScope = true)
+    {
+        return RunAsync(pool, pProgram, BindSoA(pProgram, pGlobalScope, pColumns), workScopeCount, chunkSize, zeroLocalScope);
     }
+
+    // Double buffered work scopes, simulating frame N+1 overlaps the host reading frame N.
+    // The host reads the front buffer, the last finished frame, while the next frame runs on the back buffer.
+    // Every chunk copies its units from front to back right before running them in place.
+    // NOTE(tomas): that copy is not free. A frame reads every work scope byte of the front buffer and writes every byte
+    // of the back buffer on top of what the script touches, roughly twice the memory traffic of running in place.
+    // It pays off when the host's reads of frame N would otherwise stall frame N+1, not for scripts bound by bandwidth
+    //      pipeline.Kick();                // Frame N+1 starts on the back buffer
+    //      Render(pipeline.Front());       // Frame N
+    //      pipeline.Flip();                // Waits for N+1, it becomes the front
+    // NOTE(tomas): both buffers share the global scope, the host shouldn't touch it while a frame is in flight
+    class FramePipeline
+    {
+    public:
+        // Two bindings with the same layout, the first one holds the starting frame
+        FramePipeline(ThreadPool &pool, const Program *pProgram, const ScopeBinding &front, const ScopeBinding &back, uint64_t workScopeCount, uint64_t chunkSize = 4096)
+            : m_Pool(pool), m_pProgram(pProgram), m_Buffers{ front, back }, m_WorkScopeCount(workScopeCount), m_ChunkSize(chunkSize) {}
+
+        FramePipeline(ThreadPool &pool, const Program *pProgram, void *pGlobalScope, void *pFrontWorkScopes, void *pBackWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount, uint64_t chunkSize = 4096)
+            : FramePipeline(pool, pProgram, BindAoS(pProgram, pGlobalScope, pFrontWorkScopes, workScopeSize), BindAoS(pProgram, pGlobalScope, pBackWorkScopes, workScopeSize), workScopeCount, chunkSize) {}
+
+        FramePipeline(const FramePipeline&) = delete;
+        FramePipeline& operator=(const FramePipeline&) = delete;
+
+        // Starts the next frame on the back buffer, flips the one in flight first
+        void Kick(bool zeroLocalScope = true)
+        {
+            Flip();
+            m_Frame = RunAsync(m_Pool, m_pProgram, m_Buffers[m_Front ^ 1U], m_WorkScopeCount, m_ChunkSize, zeroLocalScope, &m_Buffers[m_Front]);
+        }
+
+        // Waits for the frame in flight and makes it the front buffer, does nothing when there is none.
+        // Retired units are indices in to the new front buffer
+        void Flip(std::vector<uint64_t> *pRetired = nullptr)
+        {
+            if(!m_Frame.Valid())
+                return;
+
+            m_Frame.Wait(pRetired);
+            m_Front ^= 1U;
+        }
+
+        [[nodiscard]] bool InFlight() const noexcept { return m_Frame.Valid(); }
+
+        // The last finished frame, AoS work units start at Front().pScopes[WORK_SCOPE]
+        [[nodiscard]] const ScopeBinding &Front() const noexcept { return m_Buffers[m_Front]; }
+
+    private:
+        ThreadPool &m_Pool;
+        const Program *m_pProgram;
+        std::array<ScopeBinding, 2> m_Buffers;
+        uint64_t m_WorkScopeCount;
+        uint64_t m_ChunkSize;
+
+        uint32_t m_Front = 0U;
+        RunHandle m_Frame{};
+    };
 };
 
 #endif // !PAR_SCRIPT_H
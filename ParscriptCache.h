@@ -0,0 +1,407 @@
+#ifndef PAR_SCRIPT_CACHE_H
+#define PAR_SCRIPT_CACHE_H
+
+#include "Parscript.h"
+
+#include <cstdio>
+#include <string_view>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// Serialized programs
+// A .parc file is a FileHeader followed by the bytecode, a field table and the field names:
+//
+//      [FileHeader][bytecode][FieldRecord * fieldCount][names]
+//
+// Everything is read in place from a memory mapping, loading a cached program costs an mmap and a header check.
+// NOTE(tomas): the format is native endian, the cache is meant to live next to the binary that wrote it
+namespace ParVm::Cache
+{
+    #define PAR_FILE_MAGIC      0x53524150U // "PARS"
+    #define PAR_FILE_VERSION    7U
+
+    struct FileHeader
+    {
+        uint32_t magic              = PAR_FILE_MAGIC;
+        uint32_t version            = PAR_FILE_VERSION;
+        uint64_t sourceHash         = 0U;
+        uint64_t fileSize           = 0U;
+
+        uint64_t programSize        = 0U;
+        uint64_t codeSize           = 0U;
+        uint64_t workScopeColumns   = 0U;
+        uint64_t localScopeSize     = 0U;
+        uint64_t hostCalls          = 0U;
+        uint64_t reductionCount     = 0U;
+        uint64_t globalScopeSize    = 0U;
+        uint64_t workScopeSize      = 0U;
+        uint64_t offsetSize         = 0U;
+        uint64_t scratchLocals      = 0U;
+
+        uint64_t codeOffset         = 0U;
+        uint64_t fieldOffset        = 0U;
+        uint64_t fieldCount         = 0U;
+        uint64_t namesOffset        = 0U;
+    };
+
+    // A named field and where the compiler resolved it to, same [Scope, Offset] the bytecode uses
+    struct FieldRecord
+    {
+        uint32_t nameOffset = 0U;
+        uint32_t nameLength = 0U;
+        uint64_t scope      = 0U;
+        uint64_t offset     = 0U;
+    };
+
+    // FNV-1a, the cache key of a source file
+    [[nodiscard]] inline uint64_t HashSource(std::string_view source, uint64_t hash = 0xCBF29CE484222325ULL) noexcept
+    {
+        for(char c : source)
+        {
+            hash ^= (uint8_t)c;
+            hash *= 0x100000001B3ULL;
+        }
+
+        return hash;
+    }
+
+    // Folds a value in to a running hash byte by byte, parts that happen to be equal don't cancel out like a xor would
+    [[nodiscard]] inline uint64_t HashCombine(uint64_t hash, uint64_t part) noexcept
+    {
+        char bytes[sizeof(part)]{};
+        std::memcpy(bytes, &part, sizeof(part));
+        return HashSource(std::string_view(bytes, sizeof(bytes)), hash);
+    }
+
+    // Programs refer to host functions by index, a cache entry is only valid for the same registrations in the same order
+    [[nodiscard]] inline uint64_t HashHostFunctions()
+    {
+        std::string signature{};
+        for(const auto& info : HostFunctions())
+            signature += info.library + "::" + info.name + "(" + info.arguments + (info.returnsValue ? ")=;" : ");");
+
+        return signature.empty() ? 0U : HashSource(signature);
+    }
+
+    [[nodiscard]] inline std::vector<uint8_t> Serialize(const Program &program, const std::array<Scope, 3> &scopes, uint64_t sourceHash)
+    {
+        std::vector<FieldRecord> fields{};
+        std::string names{};
+
+        for(uint64_t scopeIdx = 0U; scopeIdx < scopes.size(); ++scopeIdx)
+        {
+            for(const auto& [name, offset] : scopes[scopeIdx].m_ScopeOffsetResolver)
+            {
+                FieldRecord record{};
+                record.nameOffset = (uint32_t)names.size();
+                record.nameLength = (uint32_t)name.size();
+                record.scope = scopes[scopeIdx].structOfArrays ? COLUMN_SCOPE + offset : scopeIdx;
+                record.offset = scopes[scopeIdx].structOfArrays ? 0U : offset;
+
+                names += name;
+                fields.push_back(record);
+            }
+        }
+
+        FileHeader header{};
+        header.sourceHash = sourceHash;
+        header.programSize = program.programSize;
+        header.codeSize = program.codeSize;
+        header.workScopeColumns = program.workScopeColumns;
+        header.localScopeSize = program.localScopeSize;
+        header.hostCalls = program.hostCalls;
+        header.reductionCount = program.reductionCount;
+        header.globalScopeSize = scopes[GLOBAL_SCOPE].scopeSize;
+        header.workScopeSize = scopes[WORK_SCOPE].scopeSize;
+        header.offsetSize = program.offsetSize;
+        header.scratchLocals = program.scratchLocals;
+
+        // Keep the field table 8 byte aligned, the bytecode itself has no alignment needs
+        header.codeOffset = sizeof(FileHeader);
+        header.fieldOffset = (header.codeOffset + program.programSize + 7U) & ~7ULL;
+        header.fieldCount = fields.size();
+        header.namesOffset = header.fieldOffset + fields.size() * sizeof(FieldRecord);
+        header.fileSize = header.namesOffset + names.size();
+
+        std::vector<uint8_t> file(header.fileSize, 0U);
+        std::memcpy(file.data(), &header, sizeof(header));
+        std::memcpy(file.data() + header.codeOffset, program.pCode, program.programSize);
+        if(!fields.empty())
+            std::memcpy(file.data() + header.fieldOffset, fields.data(), fields.size() * sizeof(FieldRecord));
+        std::memcpy(file.data() + header.namesOffset, names.data(), names.size());
+
+        return file;
+    }
+
+    // Writes to a temporary file first and renames it in place, readers never see a half written program.
+    // Every writer gets its own temporary, processes and threads filling the same entry never share one
+    inline void WriteFile(const std::string &path, const std::vector<uint8_t> &bytes)
+    {
+        static std::atomic<uint64_t> s_WriteCount{ 0U };
+
+        #if defined(_WIN32)
+        uint64_t processId = GetCurrentProcessId();
+        #else
+        uint64_t processId = (uint64_t)getpid();
+        #endif
+
+        std::string temporary = path + "." + std::to_string(processId) + "." + std::to_string(s_WriteCount.fetch_add(1U, std::memory_order_relaxed)) + ".tmp";
+
+        // Exclusive, a leftover of a crashed writer with the same pid is never written through
+        FILE *pFile = std::fopen(temporary.c_str(), "wbx");
+        if(!pFile)
+            throw std::runtime_error(("Failed to open program file for writing -> " + temporary).c_str());
+
+        bool written = std::fwrite(bytes.data(), 1U, bytes.size(), pFile) == bytes.size();
+        written &= std::fclose(pFile) == 0;
+
+        if(!written)
+        {
+            std::remove(temporary.c_str());
+            throw std::runtime_error(("Failed to write program file -> " + temporary).c_str());
+        }
+
+        #if defined(_WIN32)
+        bool renamed = MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+        #else
+        bool renamed = std::rename(temporary.c_str(), path.c_str()) == 0;
+        #endif
+
+        if(!renamed)
+        {
+            std::remove(temporary.c_str());
+            throw std::runtime_error(("Failed to move program file in place -> " + path).c_str());
+        }
+    }
+
+    // Read only memory mapping of a whole file
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+        ~MappedFile() { Close(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+        MappedFile& operator=(MappedFile&& other) noexcept
+        {
+            if(this != &other)
+            {
+                Close();
+                std::swap(m_pData, other.m_pData);
+                std::swap(m_Size, other.m_Size);
+            }
+
+            return *this;
+        }
+
+        // Returns false when the file is missing or can't be mapped
+        bool Open(const std::string &path)
+        {
+            Close();
+
+            #if defined(_WIN32)
+            HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if(file == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER size{};
+            GetFileSizeEx(file, &size);
+
+            HANDLE mapping = size.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+            CloseHandle(file);
+
+            if(!mapping)
+                return false;
+
+            m_pData = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+            m_Size = m_pData ? (uint64_t)size.QuadPart : 0U;
+            #else
+            int fd = open(path.c_str(), O_RDONLY);
+            if(fd < 0)
+                return false;
+
+            struct stat info{};
+            if(fstat(fd, &info) != 0 || info.st_size <= 0)
+            {
+                close(fd);
+                return false;
+            }
+
+            void *pMapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+
+            if(pMapping == MAP_FAILED)
+                return false;
+
+            m_pData = static_cast<const uint8_t*>(pMapping);
+            m_Size = (uint64_t)info.st_size;
+            #endif
+
+            return m_pData != nullptr;
+        }
+
+        void Close() noexcept
+        {
+            if(m_pData)
+            {
+                #if defined(_WIN32)
+                UnmapViewOfFile(m_pData);
+                #else
+                munmap(const_cast<uint8_t*>(m_pData), m_Size);
+                #endif
+            }
+
+            m_pData = nullptr;
+            m_Size = 0U;
+        }
+
+        [[nodiscard]] const uint8_t *Data() const noexcept { return m_pData; }
+        [[nodiscard]] uint64_t Size() const noexcept { return m_Size; }
+
+    private:
+        const uint8_t *m_pData = nullptr;
+        uint64_t m_Size = 0U;
+    };
+
+    // A program that lives inside a mapped .parc file, program.pCode points in to the mapping and must not be freed
+    class MappedProgram
+    {
+    public:
+        Program program{};
+
+        [[nodiscard]] explicit operator bool() const noexcept { return m_pHeader != nullptr; }
+        [[nodiscard]] const FileHeader &Header() const noexcept { return *m_pHeader; }
+
+        // Maps a .parc file, fails on a missing file, a format mismatch or, if one is given, a source hash mismatch
+        bool Open(const std::string &path, const uint64_t *pExpectedHash = nullptr)
+        {
+            m_pHeader = nullptr;
+            program = {};
+
+            if(!m_File.Open(path) || m_File.Size() < sizeof(FileHeader))
+                return false;
+
+            const auto *pHeader = reinterpret_cast<const FileHeader*>(m_File.Data());
+
+            if(pHeader->magic != PAR_FILE_MAGIC || pHeader->version != PAR_FILE_VERSION || pHeader->fileSize != m_File.Size())
+                return false;
+
+            if(pExpectedHash && pHeader->sourceHash != *pExpectedHash)
+                return false;
+
+            // Operands are read as 1, 2 or 4 byte offsets, anything else would decode the bytecode at the wrong width
+            if(pHeader->offsetSize != 1U && pHeader->offsetSize != 2U && pHeader->offsetSize != 4U)
+                return false;
+
+            if(pHeader->codeOffset + pHeader->programSize > pHeader->fileSize || pHeader->codeSize > pHeader->programSize ||
+               pHeader->namesOffset > pHeader->fileSize ||
+               pHeader->fieldOffset + pHeader->fieldCount * sizeof(FieldRecord) > pHeader->namesOffset)
+                return false;
+
+            m_pHeader = pHeader;
+            program.programSize = pHeader->programSize;
+            program.codeSize = pHeader->codeSize;
+            program.workScopeColumns = pHeader->workScopeColumns;
+            program.localScopeSize = pHeader->localScopeSize;
+            program.hostCalls = pHeader->hostCalls;
+            program.reductionCount = pHeader->reductionCount;
+            program.offsetSize = (uint8_t)pHeader->offsetSize;
+            program.scratchLocals = pHeader->scratchLocals != 0U;
+            program.pCode = const_cast<uint8_t*>(m_File.Data() + pHeader->codeOffset);
+            return true;
+        }
+
+        // Looks a field up by name, ie: "pos.x", returns false when the program has no such field
+        bool FindField(std::string_view name, std::pair<uint64_t, uint64_t> &out) const
+        {
+            if(!m_pHeader)
+                return false;
+
+            const auto *pFields = reinterpret_cast<const FieldRecord*>(m_File.Data() + m_pHeader->fieldOffset);
+            const char *pNames = reinterpret_cast<const char*>(m_File.Data() + m_pHeader->namesOffset);
+
+            for(uint64_t idx = 0U; idx < m_pHeader->fieldCount; ++idx)
+            {
+                if(std::string_view(pNames + pFields[idx].nameOffset, pFields[idx].nameLength) == name)
+                {
+                    out = { pFields[idx].scope, pFields[idx].offset };
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+    private:
+        MappedFile m_File{};
+        const FileHeader *m_pHeader = nullptr;
+    };
+
+    // Compiled programs on disk, keyed by the hash of their source
+    class ProgramCache
+    {
+    public:
+        explicit ProgramCache(std::string directory, CompileOptions options = {})
+            : m_Directory(std::move(directory)), m_Options(options) {}
+
+        [[nodiscard]] std::string PathFor(uint64_t sourceHash) const
+        {
+            char name[32]{};
+            std::snprintf(name, sizeof(name), "%016llx.parc", (unsigned long long)sourceHash);
+            return m_Directory.empty() ? std::string(name) : m_Directory + "/" + name;
+        }
+
+        // Maps the cached program for source, compiling and writing it out first on a miss
+        [[nodiscard]] MappedProgram Load(const std::string &source)
+        {
+            // Unoptimized builds of the same source get their own entry, so do builds with persistent locals, builds of
+            // another worker or pipeline and builds against other host functions
+            uint64_t hash = HashSource(source);
+            hash = HashCombine(hash, HashHostFunctions());
+            hash = HashCombine(hash, m_Options.optimize);
+            hash = HashCombine(hash, m_Options.persistentLocals);
+            hash = HashSource(m_Options.entry, HashCombine(hash, m_Options.entry.size()));
+            std::string path = PathFor(hash);
+
+            MappedProgram mapped{};
+            if(mapped.Open(path, &hash))
+                return mapped;
+
+            std::array<Scope, 3> scopes{};
+            CompileOptions options = m_Options;
+            options.pScopes = &scopes;
+
+            Program program = Compiler::Compile(source, options);
+            std::unique_ptr<uint8_t, decltype(&free)> code(program.pCode, &free);
+            auto bytes = Serialize(program, scopes, hash);
+            code.reset();
+
+            WriteFile(path, bytes);
+
+            if(!mapped.Open(path, &hash))
+                throw std::runtime_error(("Failed to map freshly written program -> " + path).c_str());
+
+            return mapped;
+        }
+
+    private:
+        std::string m_Directory;
+        CompileOptions m_Options;
+    };
+}
+
+#endif // !PAR_SCRIPT_CACHE_H
@@ -0,0 +1,446 @@
+#ifndef PAR_SCRIPT_JIT_H
+#define PAR_SCRIPT_JIT_H
+
+#include "Parscript.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+    #include <sys/mman.h>
+    #define PAR_JIT_SUPPORTED 1
+#else
+    #define PAR_JIT_SUPPORTED 0
+#endif
+
+// x86-64 backend, turns the bytecode of a Program in to native code, labels become plain jump targets.
+// Scope bases stay in registers for the whole run and operands become displacements:
+//      rdi -> GlobalScope, rsi -> WorkScope of the current unit, rdx -> LocalScope
+//      rcx -> workScopeSize, r8 -> work units left
+// Constants are copied behind the code and read rip relative.
+// Anything the backend can't handle (SoA programs, non SysV targets) compiles to an empty
+// NativeProgram and Jit::Run falls back to the interpreter.
+namespace ParVm::Jit
+{
+    // void Fn(uint8_t *pGlobalScope, uint8_t *pWorkScopes, uint8_t *pLocalScope, uint64_t workScopeSize, uint64_t workScopeCount)
+    typedef void (*NativeFunction)(uint8_t*, uint8_t*, uint8_t*, uint64_t, uint64_t);
+
+    class NativeProgram
+    {
+    public:
+        NativeProgram() = default;
+        NativeProgram(void *pMemory, uint64_t size) : m_pMemory(pMemory), m_Size(size) {}
+
+        ~NativeProgram() { Release(); }
+
+        NativeProgram(const NativeProgram&) = delete;
+        NativeProgram& operator=(const NativeProgram&) = delete;
+
+        NativeProgram(NativeProgram&& other) noexcept { *this = std::move(other); }
+        NativeProgram& operator=(NativeProgram&& other) noexcept
+        {
+            if(this != &other)
+            {
+                Release();
+                std::swap(m_pMemory, other.m_pMemory);
+                std::swap(m_Size, other.m_Size);
+            }
+
+            return *this;
+        }
+
+        [[nodiscard]] explicit operator bool() const noexcept { return m_pMemory != nullptr; }
+        [[nodiscard]] uint64_t Size() const noexcept { return m_Size; }
+        [[nodiscard]] NativeFunction Function() const noexcept { return reinterpret_cast<NativeFunction>(m_pMemory); }
+
+    private:
+        void Release() noexcept
+        {
+            #if PAR_JIT_SUPPORTED
+            if(m_pMemory)
+                munmap(m_pMemory, m_Size);
+            #endif
+
+            m_pMemory = nullptr;
+            m_Size = 0U;
+        }
+
+        void *m_pMemory = nullptr;
+        uint64_t m_Size = 0U;
+    };
+
+    class Assembler
+    {
+    public:
+        // A rip relative displacement that has to point at a constant once the pool is placed
+        struct ConstantFixup
+        {
+            uint64_t at         = 0U;   // Where the displacement lives
+            uint64_t offset     = 0U;   // Offset in to CONSTANT_SCOPE
+            uint64_t trailing   = 0U;   // Immediate bytes between the displacement and the end of the instruction
+        };
+
+        std::vector<uint8_t> code{};
+        std::vector<ConstantFixup> constantFixups{};
+
+        void Emit(std::initializer_list<uint8_t> bytes) { code.insert(code.end(), bytes); }
+        void Emit32(uint32_t value) { for(int b = 0; b < 4; ++b) code.push_back((uint8_t)(value >> (b * 8))); }
+
+        // ModRM + displacement for [scopeRegister + offset], reg is the 3 bit register field
+        void Memory(uint8_t reg, uint64_t scope, uint64_t offset)
+        {
+            // [rip + disp32], patched once the code size is known
+            if(scope == CONSTANT_SCOPE)
+            {
+                code.push_back((uint8_t)((reg << 3U) | 5U));
+                constantFixups.push_back(ConstantFixup{ code.size(), offset, 0U });
+                Emit32(0U);
+                return;
+            }
+
+            static constexpr uint8_t scopeRegisters[] = { 7U /* rdi */, 6U /* rsi */, 2U /* rdx */ };
+            uint8_t base = scopeRegisters[scope];
+
+            if(offset < 128U)
+            {
+                code.push_back((uint8_t)(0x40U | (reg << 3U) | base));
+                code.push_back((uint8_t)offset);
+            }
+            else
+            {
+                code.push_back((uint8_t)(0x80U | (reg << 3U) | base));
+                Emit32((uint32_t)offset);
+            }
+        }
+
+        // Instruction with an opcode prefix and a memory operand
+        void Op(std::initializer_list<uint8_t> opcode, uint8_t reg, const std::pair<uint64_t, uint64_t>& operand)
+        {
+            Emit(opcode);
+            Memory(reg, operand.first, operand.second);
+        }
+
+        // 32 bit relative jump, returns where the displacement has to be patched
+        uint64_t Jump(std::initializer_list<uint8_t> opcode)
+        {
+            Emit(opcode);
+            Emit32(0U);
+            return code.size() - 4U;
+        }
+
+        void Patch(uint64_t at, uint64_t target)
+        {
+            int32_t rel = (int32_t)((int64_t)target - (int64_t)(at + 4U));
+            std::memcpy(code.data() + at, &rel, sizeof(rel));
+        }
+    };
+
+    // The native code always starts every work unit on a zeroed local scope
+    [[nodiscard]] inline NativeProgram Compile(const Program *pProgram)
+    {
+        #if PAR_JIT_SUPPORTED
+        #define MOVSS_LOAD(Reg, Operand)    a.Op({ 0xF3, 0x0F, 0x10 }, Reg, Operand)
+        #define MOVSS_STORE(Reg, Operand)   a.Op({ 0xF3, 0x0F, 0x11 }, Reg, Operand)
+        #define FLOAT_OP(OpByte, Reg, Operand) a.Op({ 0xF3, 0x0F, OpByte }, Reg, Operand)
+
+        if(pProgram->workScopeColumns != 0U)
+            return {};
+
+        ////////////////////////////////////////////////////////////////
+        // Decode bytecode
+        std::vector<Instruction> instructions = Disassemble(pProgram);
+        uint64_t localFootprint = 0U;
+
+        for(const auto& instruction : instructions)
+        {
+            for(const auto& [scope, offset] : instruction.operands)
+            {
+                if(scope == CODE_SCOPE)
+                    continue;
+
+                // SoA columns and host calls (HOST_SCOPE) stay on the interpreter
+                if((scope > LOCAL_SCOPE && scope != CONSTANT_SCOPE) || offset > INT32_MAX)
+                    return {};
+
+                // Assume every operand could be a field group, the local scope itself is the upper bound
+                if(scope == LOCAL_SCOPE)
+                    localFootprint = std::max<uint64_t>(localFootprint, offset + 3U * sizeof(float));
+            }
+        }
+
+        localFootprint = std::min<uint64_t>(localFootprint, pProgram->localScopeSize);
+
+        ////////////////////////////////////////////////////////////////
+        // Emit
+        Assembler a{};
+        std::vector<uint64_t> haltJumps{};
+        std::vector<uint64_t> labelTargets{};
+        std::vector<std::pair<uint64_t, uint64_t>> labelJumps{};    // [displacement] -> [label index]
+
+        // test r8, r8; jz done
+        a.Emit({ 0x4D, 0x85, 0xC0 });
+        uint64_t emptyJump = a.Jump({ 0x0F, 0x84 });
+
+        uint64_t loopStart = a.code.size();
+
+        // Only the part of the local scope the program touches needs zeroing: xorps xmm7, xmm7; movups [rdx + n], xmm7
+        if(localFootprint > 0U)
+        {
+            a.Emit({ 0x0F, 0x57, 0xFF });
+            for(uint64_t offset = 0U; offset < localFootprint; offset += 16U)
+                a.Op({ 0x0F, 0x11 }, 7U, { LOCAL_SCOPE, offset });
+        }
+
+        const auto FloatBinary = [&a](uint8_t opByte, const Instruction& in) {
+            MOVSS_LOAD(0U, in.operands[1]);
+            FLOAT_OP(opByte, 0U, in.operands[2]);
+            MOVSS_STORE(0U, in.operands[0]);
+        };
+
+        const auto IntBinary = [&a](std::initializer_list<uint8_t> opcode, const Instruction& in) {
+            a.Op({ 0x8B }, 0U, in.operands[1]);     // mov eax, [lhs]
+            a.Op(opcode, 0U, in.operands[2]);       // op eax, [rhs]
+            a.Op({ 0x89 }, 0U, in.operands[0]);     // mov [dst], eax
+        };
+
+        // x += 1.0f or x += -1.0f
+        const auto FloatStep = [&a](uint32_t bits, const Instruction& in) {
+            a.Emit({ 0xB8 }); a.Emit32(bits);           // mov eax, bits
+            a.Emit({ 0x66, 0x0F, 0x6E, 0xC8 });         // movd xmm1, eax
+            MOVSS_LOAD(0U, in.operands[0]);
+            a.Emit({ 0xF3, 0x0F, 0x58, 0xC1 });         // addss xmm0, xmm1
+            MOVSS_STORE(0U, in.operands[0]);
+        };
+
+        // cmp byte [cond], 0, ZF=0 when the condition holds
+        const auto TestCondition = [&a](const std::pair<uint64_t, uint64_t>& condition) {
+            a.Op({ 0x80 }, 7U, condition); a.Emit({ 0x00 });
+            if(condition.first == CONSTANT_SCOPE)
+                a.constantFixups.back().trailing = 1U;
+        };
+
+        // mov eax, [lhs]; cmp eax, [rhs]; cmovcc eax, [rhs]; mov [dst], eax
+        const auto IntMinMax = [&a](uint8_t cmovByte, const Instruction& in) {
+            a.Op({ 0x8B }, 0U, in.operands[1]);
+            a.Op({ 0x3B }, 0U, in.operands[2]);
+            a.Op({ 0x0F, cmovByte }, 0U, in.operands[2]);
+            a.Op({ 0x89 }, 0U, in.operands[0]);
+        };
+
+        // Component idx of a field group
+        const auto Component = [](const std::pair<uint64_t, uint64_t>& operand, uint64_t idx) {
+            return std::make_pair(operand.first, operand.second + idx * sizeof(float));
+        };
+
+        // xmm0..2 = group, or group = xmm0..2
+        const auto LoadVec3 = [&a, &Component](const std::pair<uint64_t, uint64_t>& group) {
+            for(uint8_t idx = 0U; idx < 3U; ++idx)
+                MOVSS_LOAD(idx, Component(group, idx));
+        };
+
+        const auto StoreVec3 = [&a, &Component](const std::pair<uint64_t, uint64_t>& group) {
+            for(uint8_t idx = 0U; idx < 3U; ++idx)
+                MOVSS_STORE(idx, Component(group, idx));
+        };
+
+        // op xmm0..2, [group]
+        const auto Vec3Op = [&a, &Component](uint8_t opByte, const std::pair<uint64_t, uint64_t>& group) {
+            for(uint8_t idx = 0U; idx < 3U; ++idx)
+                FLOAT_OP(opByte, idx, Component(group, idx));
+        };
+
+        // op xmm0..2, xmm3
+        const auto Vec3ByScalar = [&a](uint8_t opByte) {
+            for(uint8_t idx = 0U; idx < 3U; ++idx)
+                a.Emit({ 0xF3, 0x0F, opByte, (uint8_t)(0xC0U | (idx << 3U) | 3U) });
+        };
+
+        // Sets ZF=0,CF=0 when lhs > rhs, NaNs compare false like they do in C++
+        const auto CompareAbove = [&a](const std::pair<uint64_t, uint64_t>& lhs, const std::pair<uint64_t, uint64_t>& rhs) {
+            MOVSS_LOAD(0U, lhs);
+            a.Op({ 0x0F, 0x2F }, 0U, rhs);          // comiss xmm0, [rhs]
+        };
+
+        for(uint64_t idx = 0U; idx < instructions.size(); ++idx)
+        {
+            const auto& in = instructions[idx];
+
+            switch (in.opCode)
+            {
+                case OpCode::PAR_HALT:
+                    // The trailing halt falls through in to the loop step
+                    if(idx + 1U != instructions.size())
+                        haltJumps.push_back(a.Jump({ 0xE9 }));
+                    break;
+
+                case OpCode::PAR_HALT_CONDITIONAL:
+                    TestCondition(in.operands[0]);
+                    haltJumps.push_back(a.Jump({ 0x0F, 0x85 }));            // jne next
+                    break;
+
+                case OpCode::PAR_LABEL:
+                    labelTargets.push_back(a.code.size());
+                    break;
+
+                case OpCode::PAR_JUMP_CONDITIONAL:
+                    TestCondition(in.operands[0]);
+                    labelJumps.emplace_back(a.Jump({ 0x0F, 0x85 }), in.operands[1].second);  // jne label
+                    break;
+
+                // mov eax, [b]; cmp byte [c], 0; cmovne eax, [a]; mov [d], eax
+                case OpCode::SELECT:
+                    a.Op({ 0x8B }, 0U, in.operands[3]);
+                    TestCondition(in.operands[1]);
+                    a.Op({ 0x0F, 0x45 }, 0U, in.operands[2]);
+                    a.Op({ 0x89 }, 0U, in.operands[0]);
+                    break;
+
+                case OpCode::INC_FLOAT:             FloatStep(0x3F800000U, in); break;
+                case OpCode::DEC_FLOAT:             FloatStep(0xBF800000U, in); break;
+                case OpCode::ADD_FLOAT:             FloatBinary(0x58, in); break;
+                case OpCode::SUB_FLOAT:             FloatBinary(0x5C, in); break;
+                case OpCode::MUL_FLOAT:             FloatBinary(0x59, in); break;
+                case OpCode::MIN_FLOAT:             FloatBinary(0x5D, in); break;    // minss, picks rhs on NaN like a < b ? a : b
+                case OpCode::MAX_FLOAT:             FloatBinary(0x5F, in); break;    // maxss
+
+                case OpCode::BIGGER_THAN_FLOAT:
+                case OpCode::SMALLER_THAN_FLOAT:
+                    if(in.opCode == OpCode::BIGGER_THAN_FLOAT)
+                        CompareAbove(in.operands[1], in.operands[2]);
+                    else
+                        CompareAbove(in.operands[2], in.operands[1]);
+
+                    a.Emit({ 0x0F, 0x97, 0xC0 });           // seta al
+                    a.Op({ 0x88 }, 0U, in.operands[0]);     // mov byte [dst], al
+                    break;
+
+                case OpCode::HALT_BIGGER_THAN_FLOAT:
+                case OpCode::HALT_SMALLER_THAN_FLOAT:
+                    if(in.opCode == OpCode::HALT_BIGGER_THAN_FLOAT)
+                        CompareAbove(in.operands[0], in.operands[1]);
+                    else
+                        CompareAbove(in.operands[1], in.operands[0]);
+
+                    haltJumps.push_back(a.Jump({ 0x0F, 0x87 }));   // ja next
+                    break;
+
+                case OpCode::ADD_VEC3:
+                case OpCode::SUB_VEC3:
+                    LoadVec3(in.operands[1]);
+                    Vec3Op(in.opCode == OpCode::ADD_VEC3 ? 0x58 : 0x5C, in.operands[2]);
+                    StoreVec3(in.operands[0]);
+                    break;
+
+                case OpCode::SCALE_VEC3:
+                case OpCode::MAD_VEC3:
+                    MOVSS_LOAD(3U, in.operands[2]);
+                    LoadVec3(in.operands[1]);
+                    Vec3ByScalar(0x59);                                 // mulss xmm0..2, xmm3
+                    if(in.opCode == OpCode::MAD_VEC3)
+                        Vec3Op(0x58, in.operands[3]);
+                    StoreVec3(in.operands[0]);
+                    break;
+
+                // Summed x, y, z in that order like the interpreter does
+                case OpCode::DOT_VEC3:
+                case OpCode::LENGTH_VEC3:
+                    LoadVec3(in.operands[1]);
+                    if(in.opCode == OpCode::DOT_VEC3)
+                        Vec3Op(0x59, in.operands[2]);
+                    else
+                        for(uint8_t idx = 0U; idx < 3U; ++idx)
+                            a.Emit({ 0xF3, 0x0F, 0x59, (uint8_t)(0xC0U | (idx << 3U) | idx) });   // mulss xmmN, xmmN
+
+                    a.Emit({ 0xF3, 0x0F, 0x58, 0xC1 });                 // addss xmm0, xmm1
+                    a.Emit({ 0xF3, 0x0F, 0x58, 0xC2 });                 // addss xmm0, xmm2
+                    if(in.opCode == OpCode::LENGTH_VEC3)
+                        a.Emit({ 0xF3, 0x0F, 0x51, 0xC0 });             // sqrtss xmm0, xmm0
+                    MOVSS_STORE(0U, in.operands[0]);
+                    break;
+
+                case OpCode::MAD_FLOAT:
+                    MOVSS_LOAD(0U, in.operands[1]);
+                    FLOAT_OP(0x59, 0U, in.operands[2]);
+                    FLOAT_OP(0x58, 0U, in.operands[3]);
+                    MOVSS_STORE(0U, in.operands[0]);
+                    break;
+
+                case OpCode::INC_INT:
+                case OpCode::INC_UINT:              a.Op({ 0xFF }, 0U, in.operands[0]); break;   // inc dword [dst]
+                case OpCode::DEC_INT:
+                case OpCode::DEC_UINT:              a.Op({ 0xFF }, 1U, in.operands[0]); break;   // dec dword [dst]
+                case OpCode::ADD_INT:               IntBinary({ 0x03 }, in); break;
+                case OpCode::SUB_INT:               IntBinary({ 0x2B }, in); break;
+                case OpCode::MUL_INT:               IntBinary({ 0x0F, 0xAF }, in); break;
+                case OpCode::MIN_INT:               IntMinMax(0x4F, in); break;      // cmovg
+                case OpCode::MAX_INT:               IntMinMax(0x4C, in); break;      // cmovl
+
+                // PAR_RETIRE_CONDITIONAL has to report back to the host, those programs stay on the interpreter
+                default:
+                    return {};
+            }
+        }
+
+        // next: add rsi, rcx; dec r8; jnz loop
+        uint64_t next = a.code.size();
+        a.Emit({ 0x48, 0x01, 0xCE });
+        a.Emit({ 0x49, 0xFF, 0xC8 });
+        uint64_t loopJump = a.Jump({ 0x0F, 0x85 });
+        a.Patch(loopJump, loopStart);
+
+        // done: ret
+        a.Patch(emptyJump, a.code.size());
+        a.Emit({ 0xC3 });
+
+        for(auto at : haltJumps)
+            a.Patch(at, next);
+
+        for(const auto& [at, label] : labelJumps)
+            a.Patch(at, labelTargets[label]);
+
+        // Constant pool behind the code, 4 byte aligned
+        if(!a.constantFixups.empty())
+        {
+            while (a.code.size() % sizeof(uint32_t) != 0U)
+                a.Emit({ 0xCC });
+
+            uint64_t pool = a.code.size();
+            a.code.insert(a.code.end(), pProgram->Constants(), pProgram->Constants() + pProgram->ConstantsSize());
+
+            for(const auto& fixup : a.constantFixups)
+                a.Patch(fixup.at, pool + fixup.offset - fixup.trailing);
+        }
+
+        ////////////////////////////////////////////////////////////////
+        // Map executable memory, never writable and executable at the same time
+        void *pMemory = mmap(nullptr, a.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(pMemory == MAP_FAILED)
+            return {};
+
+        std::memcpy(pMemory, a.code.data(), a.code.size());
+
+        if(mprotect(pMemory, a.code.size(), PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(pMemory, a.code.size());
+            return {};
+        }
+
+        return NativeProgram{ pMemory, a.code.size() };
+        #else
+        return {};
+        #endif
+    }
+
+    // Runs the native program when there is one, the interpreter otherwise
+    inline void Run(const NativeProgram &native, const Program *pProgram, void *pGlobalScope, void *pWorkScopes, uint64_t workScopeSize, uint64_t workScopeCount = 1, bool zeroLocalScope = true, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        if(!native || !zeroLocalScope)
+        {
+            ParVm::Run(pProgram, pGlobalScope, pWorkScopes, workScopeSize, workScopeCount, zeroLocalScope, pRetired);
+            return;
+        }
+
+        // WorkerState rounds the local scope up to 16 bytes, so the zeroing stores stay inside it
+        WorkerState state{};
+        native.Function()(static_cast<uint8_t*>(pGlobalScope), static_cast<uint8_t*>(pWorkScopes), state.LocalScope(std::max<uint64_t>(pProgram->localScopeSize, 16U)), workScopeSize, workScopeCount);
+    }
+}
+
+#endif // !PAR_SCRIPT_JIT_H
@@ -0,0 +1,457 @@
+#ifndef PAR_SCRIPT_STREAM_H
+#define PAR_SCRIPT_STREAM_H
+
+#include "Parscript.h"
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/stat.h>
+#endif
+
+#if defined(_MSC_VER)
+    #include <xmmintrin.h>
+    #define PAR_PREFETCH(pAddress) _mm_prefetch(reinterpret_cast<const char*>(pAddress), _MM_HINT_T0)
+#else
+    #define PAR_PREFETCH(pAddress) __builtin_prefetch(pAddress)
+#endif
+
+// Streamed work scopes
+// RunFile runs a program over a file of AoS work units that doesn't have to fit in memory:
+//
+//      [header, options.headerSize bytes][work unit 0][work unit 1]...
+//
+// The units are read in chunks in to a small ring of buffers. A reader thread loads the chunks ahead, a writer thread
+// stores the chunks behind and the calling thread runs the chunk in between, so disk reads, disk writes and the
+// script all overlap and memory use stays at bufferCount chunks however big the file is.
+// Results go back in to the same file or in to a new one, the header is copied over as is.
+// NOTE(tomas): positioned reads over mmap on purpose, page faults would stall the script on every page while a reader
+// thread keeps the script fed, and a separate output file doesn't need the input written back
+namespace ParVm::Stream
+{
+    #ifndef PAR_STREAM_CHUNK_BYTES
+        #define PAR_STREAM_CHUNK_BYTES  (8ULL << 20U)   // Bytes per chunk, rounded down to whole work units
+    #endif
+
+    #ifndef PAR_STREAM_PREFETCH
+        #define PAR_STREAM_PREFETCH     64U             // Work units prefetched ahead of the interpreter
+    #endif
+
+    struct StreamOptions
+    {
+        uint64_t headerSize     = 0U;                       // Bytes in front of the first work unit, never run
+        uint64_t chunkBytes     = PAR_STREAM_CHUNK_BYTES;   // At least one work unit per chunk
+        uint32_t bufferCount    = 3U;                       // Chunk buffers, one reading, one running, one writing
+        uint64_t prefetchUnits  = PAR_STREAM_PREFETCH;      // 0 leaves prefetching to the hardware
+        bool zeroLocalScope     = true;
+
+        // Every chunk runs on the pool through RunParallel when set, on the calling thread otherwise
+        ThreadPool *pPool       = nullptr;
+        uint64_t poolChunkSize  = 4096U;
+    };
+
+    struct StreamStats
+    {
+        uint64_t workUnits      = 0U;
+        uint64_t chunks         = 0U;
+        uint64_t readStalls     = 0U;   // Chunks the script had to wait on the disk for, close to chunks means I/O bound
+    };
+
+    // A file read and written at explicit offsets, safe to use from a reading and a writing thread at once
+    class StreamFile
+    {
+    public:
+        StreamFile() = default;
+        ~StreamFile() { Close(); }
+
+        StreamFile(const StreamFile&) = delete;
+        StreamFile& operator=(const StreamFile&) = delete;
+
+        // Existing files open for reading, or for writing when writable, create makes the file if it isn't there yet.
+        // Nothing is truncated here, the file could be one that is open for reading, see SameFile and Truncate
+        void Open(const std::string &path, bool writable, bool create = false)
+        {
+            Close();
+            m_Path = path;
+
+            #if defined(_WIN32)
+            DWORD access = writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+            m_File = CreateFileA(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, create ? OPEN_ALWAYS : OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if(m_File == INVALID_HANDLE_VALUE)
+                throw std::runtime_error(("Failed to open work scope file -> " + path).c_str());
+            #else
+            int flags = writable ? O_RDWR : O_RDONLY;
+            if(create)
+                flags |= O_CREAT;
+
+            m_File = open(path.c_str(), flags, 0644);
+            if(m_File < 0)
+                throw std::runtime_error(("Failed to open work scope file -> " + path).c_str());
+
+            #if defined(POSIX_FADV_SEQUENTIAL)
+            posix_fadvise(m_File, 0, 0, POSIX_FADV_SEQUENTIAL);
+            #endif
+            #endif
+        }
+
+        void Close() noexcept
+        {
+            #if defined(_WIN32)
+            if(m_File != INVALID_HANDLE_VALUE)
+                CloseHandle(m_File);
+            m_File = INVALID_HANDLE_VALUE;
+            #else
+            if(m_File >= 0)
+                close(m_File);
+            m_File = -1;
+            #endif
+        }
+
+        [[nodiscard]] uint64_t Size() const
+        {
+            #if defined(_WIN32)
+            LARGE_INTEGER size{};
+            if(!GetFileSizeEx(m_File, &size))
+                throw std::runtime_error(("Failed to size work scope file -> " + m_Path).c_str());
+            return (uint64_t)size.QuadPart;
+            #else
+            struct stat info{};
+            if(fstat(m_File, &info) != 0)
+                throw std::runtime_error(("Failed to size work scope file -> " + m_Path).c_str());
+            return (uint64_t)info.st_size;
+            #endif
+        }
+
+        // Whether both are open on the same file, whatever path they were opened through
+        [[nodiscard]] bool SameFile(const StreamFile &other) const
+        {
+            #if defined(_WIN32)
+            BY_HANDLE_FILE_INFORMATION info{}, otherInfo{};
+            if(!GetFileInformationByHandle(m_File, &info) || !GetFileInformationByHandle(other.m_File, &otherInfo))
+                throw std::runtime_error(("Failed to identify work scope file -> " + m_Path).c_str());
+
+            return info.dwVolumeSerialNumber == otherInfo.dwVolumeSerialNumber && info.nFileIndexHigh == otherInfo.nFileIndexHigh &&
+                   info.nFileIndexLow == otherInfo.nFileIndexLow;
+            #else
+            struct stat info{}, otherInfo{};
+            if(fstat(m_File, &info) != 0 || fstat(other.m_File, &otherInfo) != 0)
+                throw std::runtime_error(("Failed to identify work scope file -> " + m_Path).c_str());
+
+            return info.st_dev == otherInfo.st_dev && info.st_ino == otherInfo.st_ino;
+            #endif
+        }
+
+        // Drops everything in the file, it has to be open for writing
+        void Truncate() const
+        {
+            #if defined(_WIN32)
+            LARGE_INTEGER start{};
+            if(!SetFilePointerEx(m_File, start, nullptr, FILE_BEGIN) || !SetEndOfFile(m_File))
+                throw std::runtime_error(("Failed to truncate work scope file -> " + m_Path).c_str());
+            #else
+            if(ftruncate(m_File, 0) != 0)
+                throw std::runtime_error(("Failed to truncate work scope file -> " + m_Path).c_str());
+            #endif
+        }
+
+        void ReadAt(void *pData, uint64_t size, uint64_t offset) const
+        {
+            auto *pBytes = static_cast<uint8_t*>(pData);
+
+            // Reads can come back short, keep going until everything is in
+            while(size > 0U)
+            {
+                #if defined(_WIN32)
+                OVERLAPPED position{};
+                position.Offset = (DWORD)offset;
+                position.OffsetHigh = (DWORD)(offset >> 32U);
+                DWORD done = 0U;
+                if(!ReadFile(m_File, pBytes, (DWORD)std::min<uint64_t>(size, 1ULL << 30U), &done, &position) || done == 0U)
+                    throw std::runtime_error(("Failed to read work scope file -> " + m_Path).c_str());
+                #else
+                ssize_t done = pread(m_File, pBytes, (size_t)std::min<uint64_t>(size, 1ULL << 30U), (off_t)offset);
+                if(done < 0 && errno == EINTR)
+                    continue;
+                if(done <= 0)
+                    throw std::runtime_error(("Failed to read work scope file -> " + m_Path).c_str());
+                #endif
+
+                pBytes += done;
+                offset += (uint64_t)done;
+                size -= (uint64_t)done;
+            }
+        }
+
+        void WriteAt(const void *pData, uint64_t size, uint64_t offset) const
+        {
+            const auto *pBytes = static_cast<const uint8_t*>(pData);
+
+            while(size > 0U)
+            {
+                #if defined(_WIN32)
+                OVERLAPPED position{};
+                position.Offset = (DWORD)offset;
+                position.OffsetHigh = (DWORD)(offset >> 32U);
+                DWORD done = 0U;
+                if(!WriteFile(m_File, pBytes, (DWORD)std::min<uint64_t>(size, 1ULL << 30U), &done, &position) || done == 0U)
+                    throw std::runtime_error(("Failed to write work scope file -> " + m_Path).c_str());
+                #else
+                ssize_t done = pwrite(m_File, pBytes, (size_t)std::min<uint64_t>(size, 1ULL << 30U), (off_t)offset);
+                if(done < 0 && errno == EINTR)
+                    continue;
+                if(done <= 0)
+                    throw std::runtime_error(("Failed to write work scope file -> " + m_Path).c_str());
+                #endif
+
+                pBytes += done;
+                offset += (uint64_t)done;
+                size -= (uint64_t)done;
+            }
+        }
+
+    private:
+        std::string m_Path{};
+
+        #if defined(_WIN32)
+        HANDLE m_File = INVALID_HANDLE_VALUE;
+        #else
+        int m_File = -1;
+        #endif
+    };
+
+    // The buffers chunks rotate through, chunk n always lands in buffer n % bufferCount.
+    // A buffer goes FREE -> LOADED -> DONE -> FREE, the reader, the script and the writer each own one step
+    class ChunkRing
+    {
+    public:
+        enum class State : uint8_t { FREE, LOADED, DONE };
+
+        ChunkRing(uint32_t bufferCount, uint64_t bufferSize)
+            : m_Buffers(bufferCount), m_States(bufferCount, State::FREE)
+        {
+            for(auto& buffer : m_Buffers)
+                buffer.resize(bufferSize);
+        }
+
+        [[nodiscard]] uint8_t *Buffer(uint64_t chunkIdx) noexcept { return m_Buffers[chunkIdx % m_Buffers.size()].data(); }
+
+        // Blocks until the chunk's buffer reaches state, returns false when a stage failed and everyone should stop.
+        // pStalled is set when it had to wait
+        bool Await(uint64_t chunkIdx, State state, bool *pStalled = nullptr)
+        {
+            std::unique_lock lock(m_Mutex);
+            State &current = m_States[chunkIdx % m_States.size()];
+
+            if(pStalled)
+                *pStalled = current != state && !m_pError;
+
+            m_Condition.wait(lock, [&]() { return current == state || m_pError; });
+            return !m_pError;
+        }
+
+        void Advance(uint64_t chunkIdx, State state)
+        {
+            {
+                std::lock_guard lock(m_Mutex);
+                m_States[chunkIdx % m_States.size()] = state;
+            }
+
+            m_Condition.notify_all();
+        }
+
+        // Stops every stage, the first error is the one rethrown
+        void Fail(std::exception_ptr pError)
+        {
+            {
+                std::lock_guard lock(m_Mutex);
+                if(!m_pError)
+                    m_pError = std::move(pError);
+            }
+
+            m_Condition.notify_all();
+        }
+
+        void Rethrow()
+        {
+            if(m_pError)
+                std::rethrow_exception(m_pError);
+        }
+
+    private:
+        std::vector<std::vector<uint8_t>> m_Buffers;
+        std::vector<State> m_States;
+
+        std::mutex m_Mutex{};
+        std::condition_variable m_Condition{};
+        std::exception_ptr m_pError{};
+    };
+
+    // Runs the chunk in sub ranges and touches the next sub range before running the current one, the lines are on
+    // their way in while the interpreter is busy
+    inline void RunChunk(const Program *pProgram, WorkerState &state, const ScopeBinding &binding, uint64_t workScopeSize, uint64_t unitCount, const StreamOptions &options)
+    {
+        // Programs with host calls already run in batches of their own
+        const uint64_t stride = options.prefetchUnits;
+        if(stride == 0U || pProgram->hostCalls != 0U)
+        {
+            RunRange(pProgram, state, binding, 0U, unitCount, options.zeroLocalScope);
+            return;
+        }
+
+        const uint8_t *pUnits = binding.pScopes[WORK_SCOPE];
+        for(uint64_t begin = 0U; begin < unitCount; begin += stride)
+        {
+            uint64_t end = std::min(begin + stride, unitCount);
+            uint64_t prefetchEnd = std::min(end + stride, unitCount) * workScopeSize;
+
+            for(uint64_t byte = end * workScopeSize; byte < prefetchEnd; byte += 64U)
+                PAR_PREFETCH(pUnits + byte);
+
+            RunRange(pProgram, state, binding, begin, end, options.zeroLocalScope);
+        }
+    }
+
+    // Runs the program over every work unit in inputPath and writes them to outputPath, an empty outputPath or the
+    // input path itself writes them back in place. Retired units are indices in to the file, header not counted.
+    // NOTE(tomas): the global scope is only touched from the calling thread, same as Run
+    inline StreamStats RunFile(const Program *pProgram, void *pGlobalScope, const std::string &inputPath, const std::string &outputPath, uint64_t workScopeSize, const StreamOptions &options = {}, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        if(pProgram->workScopeColumns != 0U)
+            throw std::runtime_error("Work scope files hold AoS work units, the program declares a [ WorkScope[SoA] ]...");
+
+        if(workScopeSize == 0U)
+            throw std::runtime_error("Work scope files need a work scope size...");
+
+        StreamFile input{};
+        input.Open(inputPath, false);
+
+        // Sized before the output is opened, nothing done to the output can change it
+        const uint64_t fileSize = input.Size();
+        if(fileSize < options.headerSize || (fileSize - options.headerSize) % workScopeSize != 0U)
+            throw std::runtime_error(("Work scope file doesn't hold whole work units -> " + inputPath).c_str());
+
+        // Another path can still name the input, through a link or another spelling of it. That is an in place run,
+        // only an output that is a different file gets truncated
+        StreamFile output{};
+        output.Open(outputPath.empty() ? inputPath : outputPath, true, !outputPath.empty());
+
+        const bool inPlace = outputPath.empty() || output.SameFile(input);
+        if(!inPlace)
+            output.Truncate();
+
+        StreamStats stats{};
+        stats.workUnits = (fileSize - options.headerSize) / workScopeSize;
+
+        if(!inPlace && options.headerSize != 0U)
+        {
+            std::vector<uint8_t> header(options.headerSize);
+            input.ReadAt(header.data(), header.size(), 0U);
+            output.WriteAt(header.data(), header.size(), 0U);
+        }
+
+        if(stats.workUnits == 0U)
+            return stats;
+
+        const uint64_t chunkUnits = std::min(std::max<uint64_t>(options.chunkBytes / workScopeSize, 1U), stats.workUnits);
+        const uint64_t chunkBytes = chunkUnits * workScopeSize;
+        stats.chunks = (stats.workUnits + chunkUnits - 1U) / chunkUnits;
+
+        const uint64_t chunkCount = stats.chunks;
+        auto UnitsIn = [&](uint64_t chunkIdx) { return std::min(chunkUnits, stats.workUnits - chunkIdx * chunkUnits); };
+        auto OffsetOf = [&](uint64_t chunkIdx) { return options.headerSize + chunkIdx * chunkBytes; };
+
+        ChunkRing ring(std::max(options.bufferCount, 2U), chunkBytes);
+
+        std::thread reader([&]() {
+            try
+            {
+                for(uint64_t chunkIdx = 0U; chunkIdx < chunkCount; ++chunkIdx)
+                {
+                    if(!ring.Await(chunkIdx, ChunkRing::State::FREE))
+                        return;
+
+                    input.ReadAt(ring.Buffer(chunkIdx), UnitsIn(chunkIdx) * workScopeSize, OffsetOf(chunkIdx));
+                    ring.Advance(chunkIdx, ChunkRing::State::LOADED);
+                }
+            }
+            catch(...) { ring.Fail(std::current_exception()); }
+        });
+
+        std::thread writer([&]() {
+            try
+            {
+                for(uint64_t chunkIdx = 0U; chunkIdx < chunkCount; ++chunkIdx)
+                {
+                    if(!ring.Await(chunkIdx, ChunkRing::State::DONE))
+                        return;
+
+                    output.WriteAt(ring.Buffer(chunkIdx), UnitsIn(chunkIdx) * workScopeSize, OffsetOf(chunkIdx));
+                    ring.Advance(chunkIdx, ChunkRing::State::FREE);
+                }
+            }
+            catch(...) { ring.Fail(std::current_exception()); }
+        });
+
+        // Inline the whole file reduces in to one private copy like a single Run, on the pool RunParallel merges per chunk
+        WorkerState state{};
+        const bool reduces = pProgram->reductionCount != 0U && !options.pPool;
+        uint8_t *pReductionScope = reduces ? ResetReductions(state.reductionScope, pProgram->Reductions(), pProgram->reductionCount, static_cast<uint8_t*>(pGlobalScope)) : nullptr;
+
+        std::vector<uint64_t> chunkRetired{};
+
+        try
+        {
+            for(uint64_t chunkIdx = 0U; chunkIdx < chunkCount; ++chunkIdx)
+            {
+                bool stalled = false;
+                if(!ring.Await(chunkIdx, ChunkRing::State::LOADED, &stalled))
+                    break;
+
+                stats.readStalls += stalled;
+
+                ScopeBinding binding = ScopeBinding::AoS(pGlobalScope, ring.Buffer(chunkIdx), workScopeSize);
+                binding.pScopes[REDUCTION_SCOPE] = pReductionScope;
+
+                if(options.pPool)
+                    RunParallel(*options.pPool, pProgram, binding, UnitsIn(chunkIdx), options.poolChunkSize, options.zeroLocalScope, &chunkRetired);
+                else
+                {
+                    RunChunk(pProgram, state, binding, workScopeSize, UnitsIn(chunkIdx), options);
+                    CollectRetired(state, &chunkRetired);
+                }
+
+                // Retired units come back relative to the chunk
+                if(pRetired)
+                    for(uint64_t unitIdx : chunkRetired)
+                        pRetired->push_back(chunkIdx * chunkUnits + unitIdx);
+                chunkRetired.clear();
+
+                ring.Advance(chunkIdx, ChunkRing::State::DONE);
+            }
+        }
+        catch(...) { ring.Fail(std::current_exception()); }
+
+        reader.join();
+        writer.join();
+        ring.Rethrow();
+
+        if(reduces)
+            MergeReductions(pProgram->Reductions(), pProgram->reductionCount, static_cast<uint8_t*>(pGlobalScope), pReductionScope);
+
+        return stats;
+    }
+
+    // Writes the results back in to the file they came from
+    inline StreamStats RunFile(const Program *pProgram, void *pGlobalScope, const std::string &path, uint64_t workScopeSize, const StreamOptions &options = {}, std::vector<uint64_t> *pRetired = nullptr)
+    {
+        return RunFile(pProgram, pGlobalScope, path, std::string{}, workScopeSize, options, pRetired);
+    }
+}
+
+#endif // !PAR_SCRIPT_STREAM_H
@@ -0,0 +1,837 @@
+#include "../Parscript.h"
+#include "../ParscriptJit.h"
+#include "../ParscriptStream.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Interpreter and compiler benchmark over generated scripts and work scopes
+//
+//      Benchmark [--units=N] [--frames=N] [--repeats=N] [--lines=N] [--batch=N] [--csv] [--verify]
+//
+// Every opcode class gets its own generated worker over 8 float fields per work unit, every backend runs it over the
+// same work scope. Reported per class and backend: ns per work unit, instructions per second and the work scope
+// bandwidth, counted as every work unit read and written once per frame. --csv prints the same rows machine readable,
+// diff those between versions. --batch sets the work units per host call of the call workload.
+// Before timing anything every backend runs a few frames and has to leave the same work scopes and globals behind as the
+// scalar interpreter, bit for bit, or the benchmark fails. --verify stops after that check, it's what ctest runs.
+// NOTE(tomas): the generated workers never take a halt, instructions per second counts every instruction of every unit.
+// The branch workload skips part of its instructions on some units, its rate is an upper bound
+
+struct Settings
+{
+    uint64_t units      = 1U << 20U;
+    uint64_t frames     = 10U;
+    uint64_t repeats    = 3U;
+    uint64_t lines      = 100000U;
+    uint64_t batch      = PAR_CALL_BATCH;
+    bool csv            = false;
+    bool verifyOnly     = false;
+};
+
+struct Workload
+{
+    const char *pName;
+    std::string body;
+};
+
+static constexpr uint64_t FieldCount = 8U;
+static constexpr uint64_t WorkScopeSize = FieldCount * sizeof(float);
+
+double Now()
+{
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
+
+// Scope declarations shared by every generated script, f0..f7 in the work scope
+std::string Header(bool structOfArrays)
+{
+    std::string code =
+        "[ GlobalScope[16] ]\n"
+        "{\n"
+        "\t[0] -> One;\n"
+        "\t[4] -> IntOne;\n"
+        "\t[8] -> Huge;\n"
+        "\t[12] -> Counter;\n"
+        "};\n\n";
+
+    code += structOfArrays ? "[ WorkScope[SoA] ]\n{\n" : "[ WorkScope[32] ]\n{\n";
+    for(uint64_t field = 0U; field < FieldCount; ++field)
+        code += "\t[" + std::to_string(structOfArrays ? field : field * sizeof(float)) + "] -> f" + std::to_string(field) + ";\n";
+    // f0..f2 and f3..f5 again as field groups for the vec3 workload
+    code += structOfArrays ? "\t[0,1,2] -> a[x,y,z];\n\t[3,4,5] -> b[x,y,z];\n" : "\t[0,4,8] -> a[x,y,z];\n\t[12,16,20] -> b[x,y,z];\n";
+    code += "};\n\n";
+
+    code +=
+        "[ LocalScope[16] ]\n"
+        "{\n"
+        "\t[0] -> t0;\n"
+        "\t[4] -> t1;\n"
+        "};\n\n";
+
+    return code;
+}
+
+std::string Field(uint64_t idx)
+{
+    return "f" + std::to_string(idx % FieldCount);
+}
+
+// One worker per opcode class, 16 statements each. Multiplying by One and comparing against Huge keeps values
+// finite and away from denormals however many frames run
+std::vector<Workload> Workloads()
+{
+    std::vector<Workload> workloads{};
+
+    std::string body{};
+    for(uint64_t idx = 0U; idx < 16U; ++idx)
+    {
+        static const char* ops[] = { "+", "-", "*" };
+        std::string rhs = idx % 3U == 2U ? "One" : Field(idx + 2U);
+        body += "\t" + Field(idx) + " = Float::" + ops[idx % 3U] + "(" + Field(idx + 1U) + ", " + rhs + ");\n";
+    }
+    workloads.push_back({ "float", body });
+
+    body.clear();
+    for(uint64_t idx = 0U; idx < 8U; ++idx)
+    {
+        body += "\tt0 = Float::*(" + Field(idx + 1U) + ", One);\n";
+        body += "\t" + Field(idx) + " = Float::+(" + Field(idx) + ", t0);\n";
+    }
+    workloads.push_back({ "mad", body });
+
+    body.clear();
+    for(uint64_t idx = 0U; idx < 16U; ++idx)
+    {
+        static const char* ops[] = { "+", "-", "*" };
+        std::string rhs = idx % 3U == 2U ? "IntOne" : Field(idx + 2U);
+        body += "\t" + Field(idx) + " = Int::" + ops[idx % 3U] + "(" + Field(idx + 1U) + ", " + rhs + ");\n";
+    }
+    workloads.push_back({ "int", body });
+
+    body.clear();
+    for(uint64_t idx = 0U; idx < 16U; ++idx)
+        body += std::string("\t") + (idx % 2U ? "Float::--(" : "Float::++(") + Field(idx) + ");\n";
+    workloads.push_back({ "incdec", body });
+
+    body.clear();
+    for(uint64_t idx = 0U; idx < 8U; ++idx)
+    {
+        body += "\tt1 = Float::>(" + Field(idx) + ", Huge);\n";
+        body += "\tVM::HaltConditional(t1);\n";
+    }
+    workloads.push_back({ "halt", body });
+
+    body.clear();
+    for(uint64_t idx = 0U; idx < 4U; ++idx)
+    {
+        body += "\tt1 = Float::<(" + Field(idx) + ", " + Field(idx + 1U) + ");\n";
+        body += "\t" + Field(idx + 2U) + " = Float::Select(t1, " + Field(idx) + ", " + Field(idx + 2U) + ");\n";
+        body += "\t" + Field(idx + 3U) + " = Float::Min(" + Field(idx + 3U) + ", Huge);\n";
+        body += "\t" + Field(idx + 4U) + " = Float::Max(" + Field(idx + 4U) + ", One);\n";
+    }
+    // Constant conditions, a literal condition is a bool even in a Float statement
+    body += "\tf6 = Float::Select(1, f6, Huge);\n";
+    body += "\tf7 = Float::Select(0, Huge, f7);\n";
+    workloads.push_back({ "select", body });
+
+    // Data dependent, lanes of a group diverge
+    body.clear();
+    for(uint64_t idx = 0U; idx < 4U; ++idx)
+    {
+        std::string label = "Skip" + std::to_string(idx);
+        body += "\tt1 = Float::<(" + Field(idx) + ", " + Field(idx + 1U) + ");\n";
+        body += "\tVM::JumpConditional(t1, " + label + ");\n";
+        body += "\t" + Field(idx + 4U) + " = Float::+(" + Field(idx + 4U) + ", One);\n";
+        body += "\t" + Field(idx) + " = Float::-(" + Field(idx) + ", One);\n";
+        body += "<" + label + ">\n";
+    }
+    workloads.push_back({ "branch", body });
+
+    // Whole field group per instruction, the soa backends run the per component fallback. Dot and Length have no
+    // fallback and would not compile there
+    body.clear();
+    for(uint64_t idx = 0U; idx < 4U; ++idx)
+    {
+        body += "\ta = Vec3::Mad(b, One, a);\n";
+        body += "\tb = Vec3::Scale(b, One);\n";
+        body += "\ta = Vec3::Sub(a, b);\n";
+    }
+    workloads.push_back({ "vec3", body });
+
+    // Host calls, Bench::Mul is registered in main. The threaded backend can't run these
+    body.clear();
+    for(uint64_t idx = 0U; idx < 4U; ++idx)
+    {
+        body += "\tt0 = Float::*(" + Field(idx + 1U) + ", One);\n";
+        body += "\t" + Field(idx) + " = Bench::Mul(t0, One);\n";
+    }
+    workloads.push_back({ "call", body });
+
+    // Roughly tankscriptidea.pars
+    body =
+        "\tt1 = Float::>(f7, Huge);\n"
+        "\tVM::HaltConditional(t1);\n"
+        "\tt0 = Float::*(f3, One);\n"
+        "\tf0 = Float::+(f0, t0);\n"
+        "\tt0 = Float::*(f4, One);\n"
+        "\tf1 = Float::+(f1, t0);\n"
+        "\tt0 = Float::*(f5, One);\n"
+        "\tf2 = Float::+(f2, t0);\n"
+        "\tt0 = Float::*(f6, One);\n"
+        "\tf1 = Float::+(f1, t0);\n"
+        "\tf7 = Float::+(f7, One);\n"
+        "\tInt::++(Counter);\n";
+    workloads.push_back({ "mixed", body });
+
+    return workloads;
+}
+
+std::string Script(const Workload &workload, bool structOfArrays)
+{
+    return Header(structOfArrays) + "[ Worker ]()\n{\n" + workload.body + "};\n";
+}
+
+// Three stages over the same fields, compiled fused as the Frame pipeline or one worker at a time. Static as well so
+// Run<Program> runs the field groups and the fused stages too
+static constexpr ParVm::StaticSource StagesSource = R"(
+[ GlobalScope[16] ]{ [0] -> One; [4] -> IntOne; [8] -> Huge; [12] -> Counter; };
+[ WorkScope[32] ]{ [0] -> f0; [4] -> f1; [8] -> f2; [12] -> f3; [16] -> f4; [20] -> f5; [24] -> f6; [28] -> f7; [0,4,8] -> a[x,y,z]; [12,16,20] -> b[x,y,z]; };
+[ LocalScope[16] ]{ [0] -> t0; [4] -> t1; };
+[ Integrate ]()
+{
+    a = Vec3::Mad(a, One, b);
+};
+[ Age ]()
+{
+    f6 = Float::+(f6, One);
+    t0 = Float::>(f6, Huge);
+    VM::HaltConditional(t0);
+    f7 = Float::*(f7, One);
+};
+[ Collide ]()
+{
+    t0 = Float::*(f2, One);     // Age leaves t0 behind, Collide writes it before it reads it
+    f3 = Float::+(f3, t0);
+    f0 = Float::Min(f0, Huge);
+    f1 = Float::Max(f1, f7);
+};
+[ Frame ](Integrate, Age, Collide);
+)";
+
+static constexpr auto StagesProgram = ParVm::Compiler::CompileStatic<StagesSource>();
+
+std::string StagesScript()
+{
+    return std::string(StagesSource.View());
+}
+
+// The mixed workload once more, compiled along with the benchmark for Run<Program>
+static constexpr ParVm::StaticSource MixedSource = R"(
+[ GlobalScope[16] ]{ [0] -> One; [4] -> IntOne; [8] -> Huge; [12] -> Counter; };
+[ WorkScope[32] ]{ [0] -> f0; [4] -> f1; [8] -> f2; [12] -> f3; [16] -> f4; [20] -> f5; [24] -> f6; [28] -> f7; };
+[ LocalScope[16] ]{ [0] -> t0; [4] -> t1; };
+[ Worker ]()
+{
+    t1 = Float::>(f7, Huge);
+    VM::HaltConditional(t1);
+    t0 = Float::*(f3, One);
+    f0 = Float::+(f0, t0);
+    t0 = Float::*(f4, One);
+    f1 = Float::+(f1, t0);
+    t0 = Float::*(f5, One);
+    f2 = Float::+(f2, t0);
+    t0 = Float::*(f6, One);
+    f1 = Float::+(f1, t0);
+    f7 = Float::+(f7, One);
+    Int::++(Counter);
+};
+)";
+
+static constexpr auto MixedProgram = ParVm::Compiler::CompileStatic<MixedSource>();
+
+struct Globals
+{
+    float one       = 1.f;
+    int intOne      = 1;
+    float huge      = 3.0e38f;
+    int counter     = 0;
+};
+
+struct Result
+{
+    double seconds          = 0.0;
+    uint64_t instructions   = 0U;
+};
+
+// Best of settings.repeats, every repeat runs settings.frames frames
+template<typename Fn>
+double Measure(const Settings &settings, Fn &&runFrame)
+{
+    double best = 1e30;
+    for(uint64_t repeat = 0U; repeat < settings.repeats; ++repeat)
+    {
+        double start = Now();
+        for(uint64_t frame = 0U; frame < settings.frames; ++frame)
+            runFrame();
+
+        best = std::min(best, Now() - start);
+    }
+
+    return best;
+}
+
+void Report(const Settings &settings, const char *pWorkload, const char *pBackend, uint64_t instructionsPerUnit, double seconds)
+{
+    double unitRuns = (double)settings.units * (double)settings.frames;
+    double nsPerUnit = seconds * 1e9 / unitRuns;
+    double instructionsPerSecond = unitRuns * (double)instructionsPerUnit / seconds;
+    double bandwidth = unitRuns * 2.0 * WorkScopeSize / seconds / 1e9;
+
+    if(settings.csv)
+        std::printf("run,%s,%s,%llu,%.4f,%.1f,%.3f\n", pWorkload, pBackend, (unsigned long long)instructionsPerUnit, nsPerUnit, instructionsPerSecond / 1e6, bandwidth);
+    else
+        std::printf("%-8s %-12s %8llu %12.3f %14.1f %10.3f\n", pWorkload, pBackend, (unsigned long long)instructionsPerUnit, nsPerUnit, instructionsPerSecond / 1e6, bandwidth);
+}
+
+std::vector<float> InitialWorkScopes(uint64_t units)
+{
+    std::vector<float> initial(units * FieldCount);
+    for(uint64_t idx = 0U; idx < initial.size(); ++idx)
+        initial[idx] = (float)(idx % 97U);
+
+    return initial;
+}
+
+bool WriteWorkScopes(const char *pPath, const std::vector<float> &workScopes)
+{
+    FILE *pFile = std::fopen(pPath, "wb");
+    if(!pFile)
+        return false;
+
+    bool written = std::fwrite(workScopes.data(), sizeof(float), workScopes.size(), pFile) == workScopes.size();
+    return std::fclose(pFile) == 0 && written;
+}
+
+bool ReadWorkScopes(const char *pPath, std::vector<float> &workScopes)
+{
+    FILE *pFile = std::fopen(pPath, "rb");
+    if(!pFile)
+        return false;
+
+    bool read = std::fread(workScopes.data(), sizeof(float), workScopes.size(), pFile) == workScopes.size();
+    std::fclose(pFile);
+    return read;
+}
+
+// What a backend left behind after VerifyFrames frames
+struct Outcome
+{
+    std::vector<float> workScopes{};
+    Globals globals{};
+};
+
+static constexpr uint64_t VerifyFrames = 3U;
+
+template<typename Fn>
+Outcome RunOutcome(const std::vector<float> &initial, Fn &&runFrame)
+{
+    Outcome outcome{ initial, Globals{} };
+    for(uint64_t frame = 0U; frame < VerifyFrames; ++frame)
+        runFrame(outcome.workScopes, outcome.globals);
+
+    return outcome;
+}
+
+// Every backend against the scalar interpreter, returns the number of backends that came out different.
+// NOTE(tomas): the parallel backends write the unreduced Counter from every worker unsynchronized, only their work
+// scopes are compared
+uint64_t Verify(const Settings &settings)
+{
+    ParVm::ThreadPool pool{};
+    const std::vector<float> initial = InitialWorkScopes(settings.units);
+    const uint64_t units = settings.units;
+    uint64_t mismatches = 0U;
+
+    const auto Check = [&](const char *pWorkload, const char *pBackend, const Outcome &expected, const Outcome &actual, bool compareGlobals) {
+        bool same = std::memcmp(expected.workScopes.data(), actual.workScopes.data(), expected.workScopes.size() * sizeof(float)) == 0;
+        same &= !compareGlobals || std::memcmp(&expected.globals, &actual.globals, sizeof(Globals)) == 0;
+
+        if(!same)
+        {
+            ++mismatches;
+            std::printf("MISMATCH %s on %s, differs from the scalar interpreter\n", pWorkload, pBackend);
+        }
+    };
+
+    // Runs a frame on columns, transposed in and out of the array of structs
+    const auto RunColumns = [units](std::vector<float> &workScopes, const auto &runColumns) {
+        std::vector<std::vector<float>> columns(FieldCount, std::vector<float>(units));
+        std::vector<ParVm::Column> soa(FieldCount);
+
+        for(uint64_t field = 0U; field < FieldCount; ++field)
+        {
+            soa[field].pData = columns[field].data();
+            for(uint64_t unit = 0U; unit < units; ++unit)
+                columns[field][unit] = workScopes[unit * FieldCount + field];
+        }
+
+        runColumns(soa.data());
+
+        for(uint64_t field = 0U; field < FieldCount; ++field)
+            for(uint64_t unit = 0U; unit < units; ++unit)
+                workScopes[unit * FieldCount + field] = columns[field][unit];
+    };
+
+    // Kick and Flip every frame, the last front buffer is the outcome
+    const auto RunPipelined = [&](const ParVm::Program *pProgram) {
+        Outcome outcome{ initial, Globals{} };
+        std::vector<float> back(initial.size());
+
+        ParVm::FramePipeline pipeline(pool, pProgram, &outcome.globals, outcome.workScopes.data(), back.data(), WorkScopeSize, units);
+        for(uint64_t frame = 0U; frame < VerifyFrames; ++frame)
+        {
+            pipeline.Kick();
+            pipeline.Flip();
+        }
+
+        const auto *pFront = reinterpret_cast<const float*>(pipeline.Front().pScopes[WORK_SCOPE]);
+        std::vector<float> front(pFront, pFront + initial.size());
+        outcome.workScopes = std::move(front);
+        return outcome;
+    };
+
+    for(const auto& workload : Workloads())
+    {
+        ParVm::Program program = ParVm::Compiler::Compile(Script(workload, false));
+        ParVm::Program soaProgram = ParVm::Compiler::Compile(Script(workload, true));
+
+        const Outcome expected = RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+            ParVm::WorkerState state{};
+            state.callBatch = settings.batch;
+            ParVm::RunRange(&program, state, &globals, workScopes.data(), WorkScopeSize, 0U, units);
+        });
+
+        Check(workload.pName, "wide", expected, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+            ParVm::RunWide(&program, &globals, workScopes.data(), WorkScopeSize, units);
+        }), true);
+
+        if(program.hostCalls == 0U)
+        {
+            ParVm::DecodedProgram decoded = ParVm::Decode(&program);
+            Check(workload.pName, "threaded", expected, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+                ParVm::Run(&decoded, &globals, workScopes.data(), WorkScopeSize, units);
+            }), true);
+        }
+
+        if(ParVm::Jit::NativeProgram native = ParVm::Jit::Compile(&program))
+        {
+            Check(workload.pName, "jit", expected, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+                ParVm::Jit::Run(native, &program, &globals, workScopes.data(), WorkScopeSize, units);
+            }), true);
+        }
+
+        Check(workload.pName, "parallel", expected, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+            ParVm::RunParallel(pool, &program, &globals, workScopes.data(), WorkScopeSize, units, 1000U);
+        }), false);
+
+        Check(workload.pName, "pipeline", expected, RunPipelined(&program), false);
+
+        Check(workload.pName, "soa-scalar", expected, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+            RunColumns(workScopes, [&](const ParVm::Column *pColumns) { ParVm::Run(&soaProgram, &globals, pColumns, units); });
+        }), true);
+
+        Check(workload.pName, "soa-wide", expected, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+            RunColumns(workScopes, [&](const ParVm::Column *pColumns) { ParVm::RunWide(&soaProgram, &globals, pColumns, units); });
+        }), true);
+
+        free(program.pCode);
+        free(soaProgram.pCode);
+    }
+
+    // Fused stages against one scalar pass per stage
+    const std::string stagesCode = StagesScript();
+    ParVm::Program fused = ParVm::Compiler::Compile(stagesCode);
+    std::vector<ParVm::Program> stages{};
+
+    for(const char *pStage : { "Integrate", "Age", "Collide" })
+    {
+        ParVm::CompileOptions options{};
+        options.entry = pStage;
+        stages.push_back(ParVm::Compiler::Compile(stagesCode, options));
+    }
+
+    const Outcome staged = RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+        for(const auto& stage : stages)
+            ParVm::Run(&stage, &globals, workScopes.data(), WorkScopeSize, units);
+    });
+
+    Check("stages", "fused", staged, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+        ParVm::Run(&fused, &globals, workScopes.data(), WorkScopeSize, units);
+    }), true);
+
+    Check("stages", "fused-wide", staged, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+        ParVm::RunWide(&fused, &globals, workScopes.data(), WorkScopeSize, units);
+    }), true);
+
+    Check("stages", "unrolled", staged, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+        ParVm::Run<StagesProgram>(&globals, workScopes.data(), WorkScopeSize, units);
+    }), true);
+
+    free(fused.pCode);
+    for(auto& stage : stages)
+        free(stage.pCode);
+
+    // Reading a local the stage in front left behind gives another result than a pass of its own, that can't fuse
+    bool staleRejected = false;
+    try
+    {
+        ParVm::Program stale = ParVm::Compiler::Compile(Header(false) +
+            "[ Write ]()\n{\n\tt0 = Float::+(f0, One);\n};\n"
+            "[ Read ]()\n{\n\tf1 = Float::+(t0, f1);\n};\n"
+            "[ Frame ](Write, Read);\n");
+        free(stale.pCode);
+    }
+    catch(const std::exception&)
+    {
+        staleRejected = true;
+    }
+
+    if(!staleRejected)
+    {
+        ++mismatches;
+        std::printf("MISMATCH stages on fused-locals, a stage reading what the one in front left in a local was fused\n");
+    }
+
+    // Every backend could agree on the wrong side of a constant condition, check the side itself
+    for(bool optimize : { false, true })
+    {
+        ParVm::CompileOptions options{};
+        options.optimize = optimize;
+        ParVm::Program select = ParVm::Compiler::Compile(Header(false) + "[ Worker ]()\n{\n\tf0 = Float::Select(1, One, Huge);\n\tf1 = Float::Select(0, Huge, One);\n};\n", options);
+
+        const Outcome outcome = RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+            ParVm::Run(&select, &globals, workScopes.data(), WorkScopeSize, units);
+        });
+
+        bool picked = true;
+        for(uint64_t unit = 0U; unit < units; ++unit)
+            picked &= outcome.workScopes[unit * FieldCount] == 1.f && outcome.workScopes[unit * FieldCount + 1U] == 1.f;
+
+        if(!picked)
+        {
+            ++mismatches;
+            std::printf("MISMATCH select on %s, a literal condition picked the wrong side\n", optimize ? "optimized" : "unoptimized");
+        }
+
+        free(select.pCode);
+    }
+
+    // The static program interpreted, unrolled and streamed through a file
+    const ParVm::Program mixed = MixedProgram.View();
+
+    // Both front ends on the same script, unoptimized Compile has to emit the very same bytes
+    ParVm::CompileOptions unoptimized{};
+    unoptimized.optimize = false;
+    ParVm::Program compiled = ParVm::Compiler::Compile(std::string(MixedSource.View()), unoptimized);
+
+    if(compiled.programSize != mixed.programSize || compiled.codeSize != mixed.codeSize || compiled.localScopeSize != mixed.localScopeSize ||
+       compiled.offsetSize != mixed.offsetSize || std::memcmp(compiled.pCode, mixed.pCode, mixed.programSize) != 0)
+    {
+        ++mismatches;
+        std::printf("MISMATCH static on compile, CompileStatic and Compile emit different bytecode\n");
+    }
+
+    free(compiled.pCode);
+
+    const Outcome interpreted = RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+        ParVm::Run(&mixed, &globals, workScopes.data(), WorkScopeSize, units);
+    });
+
+    Check("static", "unrolled", interpreted, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+        ParVm::Run<MixedProgram>(&globals, workScopes.data(), WorkScopeSize, units);
+    }), true);
+
+    const char *pStreamPath = "ParscriptVerify.bin";
+    for(bool parallel : { false, true })
+    {
+        ParVm::Stream::StreamOptions streamOptions{};
+        streamOptions.chunkBytes = 4096U * WorkScopeSize + 12U;   // Several chunks, the last one short
+        streamOptions.pPool = parallel ? &pool : nullptr;
+
+        Check("stream", parallel ? "file-par" : "file", interpreted, RunOutcome(initial, [&](std::vector<float> &workScopes, Globals &globals) {
+            // A failed write or read leaves zeroes behind, that shows up as a mismatch
+            if(!WriteWorkScopes(pStreamPath, workScopes))
+                return workScopes.assign(workScopes.size(), 0.f);
+
+            ParVm::Stream::RunFile(&mixed, &globals, pStreamPath, WorkScopeSize, streamOptions);
+
+            if(!ReadWorkScopes(pStreamPath, workScopes))
+                workScopes.assign(workScopes.size(), 0.f);
+        }), !parallel);
+    }
+
+    std::remove(pStreamPath);
+    return mismatches;
+}
+
+void RunBenchmarks(const Settings &settings)
+{
+    if(settings.csv)
+        std::printf("run,workload,backend,instructions,ns_per_unit,minstr_per_s,gb_per_s\n");
+    else
+        std::printf("%-8s %-12s %8s %12s %14s %10s\n", "workload", "backend", "instr", "ns/unit", "Minstr/s", "GB/s");
+
+    ParVm::ThreadPool pool{};
+
+    // Same starting values for every run, the work scope is reset before each backend
+    const std::vector<float> initial = InitialWorkScopes(settings.units);
+
+    std::vector<float> aos(initial.size());
+    std::vector<float> back(initial.size());    // Second buffer of the pipeline backend
+    std::vector<std::vector<float>> columns(FieldCount, std::vector<float>(settings.units));
+    std::vector<ParVm::Column> soa(FieldCount);
+
+    for(uint64_t field = 0U; field < FieldCount; ++field)
+        soa[field].pData = columns[field].data();
+
+    for(const auto& workload : Workloads())
+    {
+        ParVm::Program program = ParVm::Compiler::Compile(Script(workload, false));
+        ParVm::Program soaProgram = ParVm::Compiler::Compile(Script(workload, true));
+        ParVm::DecodedProgram decoded = program.hostCalls == 0U ? ParVm::Decode(&program) : ParVm::DecodedProgram{};
+        ParVm::Jit::NativeProgram native = ParVm::Jit::Compile(&program);
+
+        uint64_t instructionsPerUnit = ParVm::Disassemble(&program).size();
+        Globals globals{};
+
+        const auto Reset = [&]() {
+            globals = {};
+            aos = initial;
+            for(uint64_t unit = 0U; unit < settings.units; ++unit)
+                for(uint64_t field = 0U; field < FieldCount; ++field)
+                    columns[field][unit] = initial[unit * FieldCount + field];
+        };
+
+        Reset();
+        Report(settings, workload.pName, "scalar", instructionsPerUnit, Measure(settings, [&]() {
+            ParVm::WorkerState state{};
+            state.callBatch = settings.batch;
+            ParVm::RunRange(&program, state, &globals, aos.data(), WorkScopeSize, 0U, settings.units);
+        }));
+
+        Reset();
+        Report(settings, workload.pName, "wide", instructionsPerUnit, Measure(settings, [&]() {
+            ParVm::RunWide(&program, &globals, aos.data(), WorkScopeSize, settings.units);
+        }));
+
+        if(program.hostCalls == 0U)
+        {
+            Reset();
+            Report(settings, workload.pName, "threaded", instructionsPerUnit, Measure(settings, [&]() {
+                ParVm::Run(&decoded, &globals, aos.data(), WorkScopeSize, settings.units);
+            }));
+        }
+
+        if(native)
+        {
+            Reset();
+            Report(settings, workload.pName, "jit", instructionsPerUnit, Measure(settings, [&]() {
+                ParVm::Jit::Run(native, &program, &globals, aos.data(), WorkScopeSize, settings.units);
+            }));
+        }
+
+        Reset();
+        Report(settings, workload.pName, "parallel", instructionsPerUnit, Measure(settings, [&]() {
+            ParVm::RunParallel(pool, &program, &globals, aos.data(), WorkScopeSize, settings.units);
+        }));
+
+        // Kick and Flip back to back, what the frame loop costs when the host has nothing to overlap with it
+        Reset();
+        {
+            ParVm::FramePipeline pipeline(pool, &program, &globals, aos.data(), back.data(), WorkScopeSize, settings.units);
+            Report(settings, workload.pName, "pipeline", instructionsPerUnit, Measure(settings, [&]() {
+                pipeline.Kick();
+                pipeline.Flip();
+            }));
+        }
+
+        Reset();
+        Report(settings, workload.pName, "soa-scalar", instructionsPerUnit, Measure(settings, [&]() {
+            ParVm::Run(&soaProgram, &globals, soa.data(), settings.units);
+        }));
+
+        Reset();
+        Report(settings, workload.pName, "soa-wide", instructionsPerUnit, Measure(settings, [&]() {
+            ParVm::RunWide(&soaProgram, &globals, soa.data(), settings.units);
+        }));
+
+        free(program.pCode);
+        free(soaProgram.pCode);
+    }
+
+    // Every stage as its own pass over the work scopes against the stages fused in to one pass
+    const std::string stagesCode = StagesScript();
+    ParVm::Program fused = ParVm::Compiler::Compile(stagesCode);
+    std::vector<ParVm::Program> stages{};
+
+    for(const char *pStage : { "Integrate", "Age", "Collide" })
+    {
+        ParVm::CompileOptions options{};
+        options.entry = pStage;
+        stages.push_back(ParVm::Compiler::Compile(stagesCode, options));
+    }
+
+    uint64_t instructionsPerUnit = ParVm::Disassemble(&fused).size();
+    Globals globals{};
+
+    aos = initial;
+    Report(settings, "stages", "staged", instructionsPerUnit, Measure(settings, [&]() {
+        for(const auto& stage : stages)
+            ParVm::RunWide(&stage, &globals, aos.data(), WorkScopeSize, settings.units);
+    }));
+
+    aos = initial;
+    Report(settings, "stages", "fused", instructionsPerUnit, Measure(settings, [&]() {
+        ParVm::RunWide(&fused, &globals, aos.data(), WorkScopeSize, settings.units);
+    }));
+
+    aos = initial;
+    Report(settings, "stages", "staged-par", instructionsPerUnit, Measure(settings, [&]() {
+        for(const auto& stage : stages)
+            ParVm::RunParallel(pool, &stage, &globals, aos.data(), WorkScopeSize, settings.units);
+    }));
+
+    aos = initial;
+    Report(settings, "stages", "fused-par", instructionsPerUnit, Measure(settings, [&]() {
+        ParVm::RunParallel(pool, &fused, &globals, aos.data(), WorkScopeSize, settings.units);
+    }));
+
+    free(fused.pCode);
+    for(auto& stage : stages)
+        free(stage.pCode);
+
+    // The same static program interpreted and unrolled, neither is optimized
+    const ParVm::Program mixed = MixedProgram.View();
+    instructionsPerUnit = ParVm::Disassemble(&mixed).size();
+
+    aos = initial;
+    globals = {};
+    Report(settings, "static", "scalar", instructionsPerUnit, Measure(settings, [&]() {
+        ParVm::Run(&mixed, &globals, aos.data(), WorkScopeSize, settings.units);
+    }));
+
+    aos = initial;
+    globals = {};
+    Report(settings, "static", "unrolled", instructionsPerUnit, Measure(settings, [&]() {
+        ParVm::Run<MixedProgram>(&globals, aos.data(), WorkScopeSize, settings.units);
+    }));
+
+    // The same work units streamed through a file in place, a freshly written file mostly runs from the page cache
+    const char *pStreamPath = "ParscriptBenchmark.bin";
+    if(WriteWorkScopes(pStreamPath, initial))
+    {
+        ParVm::Stream::StreamOptions streamOptions{};
+        globals = {};
+        Report(settings, "stream", "file", instructionsPerUnit, Measure(settings, [&]() {
+            ParVm::Stream::RunFile(&mixed, &globals, pStreamPath, WorkScopeSize, streamOptions);
+        }));
+
+        streamOptions.pPool = &pool;
+        globals = {};
+        Report(settings, "stream", "file-par", instructionsPerUnit, Measure(settings, [&]() {
+            ParVm::Stream::RunFile(&mixed, &globals, pStreamPath, WorkScopeSize, streamOptions);
+        }));
+    }
+
+    std::remove(pStreamPath);
+}
+
+// Parses and emits one large generated script, optimizer included
+void CompileBenchmark(const Settings &settings)
+{
+    std::string body{};
+    const auto workloads = Workloads();
+
+    // Labels have to be unique within a worker, the branch workload can't repeat
+    while (body.size() < settings.lines * 24U)
+        for(const auto& workload : workloads)
+            if(workload.body.find("JumpConditional") == std::string::npos)
+                body += workload.body;
+
+    Workload large{ "large", body };
+    std::string code = Script(large, false);
+
+    uint64_t lineCount = 0U;
+    for(char c : code)
+        lineCount += c == '\n';
+
+    double seconds = 1e30;
+    for(uint64_t repeat = 0U; repeat < settings.repeats; ++repeat)
+    {
+        double start = Now();
+        ParVm::Program program = ParVm::Compiler::Compile(code);
+        seconds = std::min(seconds, Now() - start);
+        free(program.pCode);
+    }
+
+    if(settings.csv)
+        std::printf("compile,%llu,%llu,%.4f,%.1f,%.3f\n", (unsigned long long)lineCount, (unsigned long long)code.size(),
+                    seconds * 1e3, (double)lineCount / seconds / 1e3, (double)code.size() / seconds / 1e6);
+    else
+        std::printf("\ncompile: %llu lines, %llu bytes in %.2f ms -> %.1f klines/s, %.2f MB/s\n", (unsigned long long)lineCount,
+                    (unsigned long long)code.size(), seconds * 1e3, (double)lineCount / seconds / 1e3, (double)code.size() / seconds / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    Settings settings{};
+
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        std::string_view option = argv[arg];
+        const auto Value = [&option]() { return std::strtoull(option.data() + option.find('=') + 1U, nullptr, 10); };
+
+        if(option.starts_with("--units="))          settings.units = std::max<uint64_t>(Value(), 1U);
+        else if(option.starts_with("--frames="))    settings.frames = std::max<uint64_t>(Value(), 1U);
+        else if(option.starts_with("--repeats="))   settings.repeats = std::max<uint64_t>(Value(), 1U);
+        else if(option.starts_with("--lines="))     settings.lines = std::max<uint64_t>(Value(), 1U);
+        else if(option.starts_with("--batch="))     settings.batch = std::max<uint64_t>(Value(), 1U);
+        else if(option == "--csv")                  settings.csv = true;
+        else if(option == "--verify")               settings.verifyOnly = true;
+        else
+        {
+            std::printf("Usage: %s [--units=N] [--frames=N] [--repeats=N] [--lines=N] [--batch=N] [--csv] [--verify]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // The call workload's host function, one loop over the whole batch
+    ParVm::Compiler::RegisterFunction("Bench", "Mul", "ff", true, [](const ParVm::HostBatch &batch) {
+        for(uint64_t unit = 0U; unit < batch.count; ++unit)
+            batch.Get<float>(0U, unit) = batch.Get<float>(1U, unit) * batch.Get<float>(2U, unit);
+    });
+
+    // Numbers of a backend that computes something else are worthless
+    if(uint64_t mismatches = Verify(settings))
+    {
+        std::printf("%llu backends differ from the scalar interpreter\n", (unsigned long long)mismatches);
+        return 1;
+    }
+
+    if(settings.verifyOnly)
+    {
+        std::printf("Every backend matches the scalar interpreter over %llu work units\n", (unsigned long long)settings.units);
+        return 0;
+    }
+
+    if(!settings.csv)
+        std::printf("%llu work units of %llu bytes, %llu frames, best of %llu\n\n", (unsigned long long)settings.units,
+                    (unsigned long long)WorkScopeSize, (unsigned long long)settings.frames, (unsigned long long)settings.repeats);
+
+    RunBenchmarks(settings);
+    CompileBenchmark(settings);
+
+    return 0;
+}
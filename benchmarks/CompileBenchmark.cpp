@@ -0,0 +1,82 @@
+#include "../Parscript.h"
+
+#include <chrono>
+#include <cstdio>
+
+// Compile time against script size, the front end is a single pass so time per line should stay flat as scripts grow
+// NOTE(tomas): the optimizer is switched off, this measures parsing and emission only
+
+std::string GenerateScript(uint64_t lineCount)
+{
+    std::string code =
+        "[ GlobalScope[16] ]\n"
+        "{\n"
+        "\t[0]\t\t-> DoneCounter;\n"
+        "\t[4]\t\t-> DeltaTime;\n"
+        "\t[8]\t\t-> ParticleLifeTime;\n"
+        "\t[12]\t-> CoolInteger;\n"
+        "};\n\n"
+        "[ WorkScope[32] ]\n"
+        "{\n"
+        "\t[0, 4, 8]\t\t-> pos[x, y, z];\n"
+        "\t[12, 16, 20]\t-> dir[x, y, z];\n"
+        "\t[24]\t\t\t-> gravity;\n"
+        "\t[28]\t\t\t-> lifetime;\n"
+        "};\n\n"
+        "[ LocalScope[8] ]\n"
+        "{\n"
+        "\t[0] -> MulTemp;\n"
+        "\t[4] -> ShouldHalt;\n"
+        "};\n\n"
+        "[ Worker ]()\n"
+        "{\n";
+
+    static const char* axes[] = { "x", "y", "z" };
+
+    for(uint64_t lineIdx = 0U; lineIdx < lineCount; lineIdx += 3U)
+    {
+        const char* axis = axes[(lineIdx / 3U) % 3U];
+
+        code += "\t// Apply direction\n";
+        code += std::string("\tMulTemp = Float:: * (dir.") + axis + ", DeltaTime);\n";
+        code += std::string("\tpos.") + axis + " = Float:: + (pos." + axis + ", MulTemp);\n";
+        code += "\tInt:: ++ (DoneCounter);\n";
+    }
+
+    code += "};\n";
+    return code;
+}
+
+int main()
+{
+    ParVm::CompileOptions options{};
+    options.optimize = false;
+
+    std::printf("%10s %12s %12s %12s %10s\n", "lines", "bytes", "ms", "ns/line", "MB/s");
+
+    for(uint64_t lineCount : { 1000U, 10000U, 100000U, 1000000U })
+    {
+        std::string code = GenerateScript(lineCount);
+
+        // Best of a few runs, the first one pays for page faults
+        double best = 1e30;
+        for(int run = 0; run < 3; ++run)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            ParVm::Program program = ParVm::Compiler::Compile(code, options);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            free(program.pCode);
+            best = std::min(best, std::chrono::duration<double>(end - start).count());
+        }
+
+        std::printf("%10llu %12llu %12.2f %12.1f %10.1f\n",
+                    (unsigned long long)lineCount,
+                    (unsigned long long)code.size(),
+                    best * 1e3,
+                    best * 1e9 / (double)lineCount,
+                    (double)code.size() / best / (1024.0 * 1024.0));
+    }
+
+    return 0;
+}
@@ -1,4 +1,4 @@
-#include "Parscript.h"
+#include "ParscriptCache.h"
 
 void main()
 {
@@ -9,7 +9,10 @@ void main()
     while (std::getline(stream, buff))
         code += buff + "\n";
 
-    ParVm::Program program = ParVm::Compiler::Compile(code);
+    // Compiles on the first run, later runs map the cached bytecode
+    ParVm::Cache::ProgramCache cache{ "." };
+    ParVm::Cache::MappedProgram mapped = cache.Load(code);
+    ParVm::Program &program = mapped.program;
 
     for (int i = 0; i < program.programSize; ++i)
         std::cout << (int)program.pCode[i] << " ";
@@ -39,8 +42,10 @@ void main()
 
     pWork->lifetime = 30.f; // This one will halt before the others
 
-    for (int j = 0; j < 60 * 10; ++j)
-        ParVm::Run(&program, &pGlobal, &pWork, 32, 3);
+    // Ten seconds at 60 frames, all frames of a block of work units run back to back
+    ParVm::Executor executor{ &program };
+    executor.Bind(&pGlobal, &pWork, 32, 3);
+    executor.RunFrames(60 * 10);
 
     std::cout << pWork[0].pos.x << " ";
     std::cout << pWork[1].pos.y << " ";
@@ -54,6 +59,4 @@ void main()
 
     std::cout << pGlobal.DoneCounter << std::endl;
     std::cout << pGlobal.CoolInteger << std::endl;
-
-    free(program.pCode);
 }
\ No newline at end of file